@@ -2,6 +2,8 @@ TARGET = harbour-pilvi
 
 CONFIG += sailfishapp
 
+QT += concurrent
+
 # OAuth Configuration - loaded from .qmake.conf
 CLIENT_ID = $$pilvi_client_id
 CLIENT_SECRET = $$pilvi_client_secret
@@ -33,22 +35,46 @@ message("=================================")
 
 SOURCES += \
     src/harbour-pilvi.cpp \
+    src/googledrive/foldertransfer.cpp \
     src/googledrive/googledriveapi.cpp \
     src/googledrive/oauthflow.cpp \
+    src/googledrive/searchsession.cpp \
+    src/googledrive/syncengine.cpp \
     src/models/filemodel.cpp \
     src/models/fileitem.cpp \
+    src/network/batchrequest.cpp \
+    src/network/downloadtask.cpp \
     src/network/networkrequest.cpp \
+    src/network/retrypolicy.cpp \
+    src/network/thumbnailprovider.cpp \
+    src/network/transfermanager.cpp \
+    src/network/uploadtask.cpp \
+    src/storage/checksumengine.cpp \
     src/storage/credentialstore.cpp \
-    src/storage/filecache.cpp
+    src/storage/filecache.cpp \
+    src/storage/searchindex.cpp \
+    src/storage/syncjournal.cpp
 
 HEADERS += \
+    src/googledrive/foldertransfer.h \
     src/googledrive/googledriveapi.h \
     src/googledrive/oauthflow.h \
+    src/googledrive/searchsession.h \
+    src/googledrive/syncengine.h \
     src/models/filemodel.h \
     src/models/fileitem.h \
+    src/network/batchrequest.h \
+    src/network/downloadtask.h \
     src/network/networkrequest.h \
+    src/network/retrypolicy.h \
+    src/network/thumbnailprovider.h \
+    src/network/transfermanager.h \
+    src/network/uploadtask.h \
+    src/storage/checksumengine.h \
     src/storage/credentialstore.h \
-    src/storage/filecache.h
+    src/storage/filecache.h \
+    src/storage/searchindex.h \
+    src/storage/syncjournal.h
 
 DISTFILES += \
     qml/harbour-pilvi.qml \
@@ -59,7 +85,9 @@ DISTFILES += \
     qml/pages/SettingsPage.qml \
     qml/pages/AuthPage.qml \
     qml/pages/SearchPage.qml \
+    qml/pages/TransfersPage.qml \
     qml/cover/CoverPage.qml \
+    qml/components/FileThumbnail.qml \
     qml/dialogs/InputDialog.qml \
     qml/dialogs/ShareDialog.qml \
     rpm/harbour-pilvi.spec \
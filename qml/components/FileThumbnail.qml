@@ -0,0 +1,30 @@
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+
+// Theme icon for a file or folder, covered by the Drive thumbnail once it
+// has loaded
+Item {
+    property string fileId
+    property bool isFolder
+    property bool hasThumbnail
+
+    width: Theme.iconSizeMedium
+    height: Theme.iconSizeMedium
+
+    Image {
+        anchors.fill: parent
+        visible: !thumbnail.visible
+        source: isFolder ? "image://theme/icon-m-folder" : "image://theme/icon-m-file-other"
+    }
+
+    Image {
+        id: thumbnail
+        anchors.fill: parent
+        fillMode: Image.PreserveAspectCrop
+        clip: true
+        sourceSize.width: width
+        sourceSize.height: height
+        source: !isFolder && hasThumbnail ? "image://drivethumb/" + fileId : ""
+        visible: status === Image.Ready
+    }
+}
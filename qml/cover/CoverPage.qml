@@ -56,7 +56,7 @@ CoverBackground {
         CoverAction {
             iconSource: "image://theme/icon-cover-refresh"
             onTriggered: {
-                driveApi.listFiles("root", "")
+                driveApi.getChanges()
             }
         }
 
@@ -11,7 +11,7 @@ Page {
         id: oauthFlow
 
         onAuthenticationSucceeded: {
-            credentialStore.saveCredentials(accessToken, refreshToken)
+            credentialStore.saveCredentials(accessToken, refreshToken, expiresIn)
             pageStack.replace(Qt.resolvedUrl("MainPage.qml"))
         }
 
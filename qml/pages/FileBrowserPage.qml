@@ -1,12 +1,15 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
 import harbour.pilvi.models 1.0
+import "../components"
 
 Page {
     id: page
 
     property string folderId: "root"
     property string folderName: "Google Drive"
+    // Ids of folders being created from this page
+    property var createRequests: ({})
 
     FileModel {
         id: fileModel
@@ -18,42 +21,40 @@ Page {
 
     onStatusChanged: {
         if (status === PageStatus.Active) {
-            // Reload files when page becomes active (e.g., after returning from sub-folder)
-            loadFiles()
+            // Pick up changes made while away (e.g. in a sub-folder) from
+            // the changes feed instead of listing the folder again
+            driveApi.getChanges()
         }
     }
 
     function loadFiles() {
-        driveApi.listFiles(folderId, "")
+        driveApi.loadFolder(fileModel, folderId)
     }
 
     Connections {
         target: driveApi
-        onFilesListed: {
-            fileModel.clear()
-            for (var i = 0; i < files.length; i++) {
-                var file = files[i]
-                fileModel.addFile(
-                    file.id,
-                    file.name,
-                    file.mimeType,
-                    file.size || 0,
-                    file.modifiedTime || "",
-                    file.starred || false,
-                    file.iconLink || "",
-                    file.thumbnailLink || "",
-                    file.webViewLink || ""
-                )
-            }
+        onChangesReceived: {
+            fileModel.applyChanges(changes, folderId)
         }
         onFolderCreated: {
-            loadFiles()
+            if (createRequests[requestId]) {
+                delete createRequests[requestId]
+                loadFiles()
+            }
         }
         onFileUploaded: {
+            if (metadata.parents && metadata.parents.indexOf(folderId) >= 0) {
+                loadFiles()
+            }
+        }
+        onFolderUploaded: {
             loadFiles()
         }
         onFileDeleted: {
-            loadFiles()
+            fileModel.removeFilesById([fileId])
+        }
+        onRequestFailed: {
+            delete createRequests[requestId]
         }
     }
 
@@ -75,10 +76,20 @@ Page {
                         placeholderText: qsTr("Folder name")
                     })
                     dialog.accepted.connect(function() {
-                        driveApi.createFolder(dialog.value, folderId)
+                        createRequests[driveApi.createFolder(dialog.value, folderId)] = true
                     })
                 }
             }
+            MenuItem {
+                text: syncEngine.folderId === folderId ? qsTr("Sync now") : qsTr("Keep in sync on device")
+                onClicked: {
+                    if (syncEngine.folderId === folderId) {
+                        syncEngine.syncNow()
+                    } else {
+                        syncEngine.pin(StandardPaths.documents + "/Pilvi/" + folderName, folderId)
+                    }
+                }
+            }
             MenuItem {
                 text: qsTr("Upload file")
                 onClicked: {
@@ -98,13 +109,13 @@ Page {
             id: listItem
             contentHeight: Theme.itemSizeMedium
 
-            Image {
+            FileThumbnail {
                 id: icon
                 x: Theme.horizontalPageMargin
                 anchors.verticalCenter: parent.verticalCenter
-                width: Theme.iconSizeMedium
-                height: Theme.iconSizeMedium
-                source: isFolder ? "image://theme/icon-m-folder" : "image://theme/icon-m-file-other"
+                fileId: model.fileId
+                isFolder: model.isFolder
+                hasThumbnail: model.thumbnailUrl !== ""
             }
 
             Column {
@@ -166,10 +177,13 @@ Page {
             menu: ContextMenu {
                 MenuItem {
                     text: qsTr("Download")
-                    visible: !isFolder
                     onClicked: {
                         var downloadPath = StandardPaths.download + "/" + fileName
-                        driveApi.downloadFile(fileId, downloadPath)
+                        if (isFolder) {
+                            driveApi.downloadFolder(fileId, downloadPath)
+                        } else {
+                            driveApi.downloadFile(fileId, downloadPath)
+                        }
                         remorse.execute(listItem, qsTr("Downloading"), function() {})
                     }
                 }
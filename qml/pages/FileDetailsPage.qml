@@ -56,8 +56,10 @@ Page {
                 width: parent.width
                 height: width * 0.75
                 fillMode: Image.PreserveAspectFit
-                source: mimeType.startsWith("image/") ? thumbnailUrl : ""
-                visible: source !== ""
+                sourceSize.width: width
+                sourceSize.height: height
+                source: mimeType.startsWith("image/") ? "image://drivethumb/" + fileId : ""
+                visible: status === Image.Ready
             }
 
             DetailItem {
@@ -66,6 +66,13 @@ Page {
         }
 
         PullDownMenu {
+            MenuItem {
+                text: qsTr("Upload this folder")
+                onClicked: {
+                    driveApi.uploadFolder(currentPath, parentFolderId)
+                    pageStack.pop()
+                }
+            }
             MenuItem {
                 text: qsTr("Parent folder")
                 enabled: currentPath !== "/"
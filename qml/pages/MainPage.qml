@@ -1,6 +1,7 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
 import harbour.pilvi.models 1.0
+import "../components"
 
 Page {
     id: page
@@ -11,30 +12,17 @@ Page {
 
     Component.onCompleted: {
         loadFiles()
+        driveApi.resumeUploads()
     }
 
     function loadFiles() {
-        driveApi.listFiles("root", "")
+        driveApi.loadFolder(fileModel, "root")
     }
 
     Connections {
         target: driveApi
-        onFilesListed: {
-            fileModel.clear()
-            for (var i = 0; i < files.length; i++) {
-                var file = files[i]
-                fileModel.addFile(
-                    file.id,
-                    file.name,
-                    file.mimeType,
-                    file.size || 0,
-                    file.modifiedTime || "",
-                    file.starred || false,
-                    file.iconLink || "",
-                    file.thumbnailLink || "",
-                    file.webViewLink || ""
-                )
-            }
+        onChangesReceived: {
+            fileModel.applyChanges(changes, "root")
         }
     }
 
@@ -48,6 +36,11 @@ Page {
                 text: qsTr("Settings")
                 onClicked: pageStack.push(Qt.resolvedUrl("SettingsPage.qml"))
             }
+            MenuItem {
+                text: qsTr("Transfers")
+                visible: transferManager.count > 0
+                onClicked: pageStack.push(Qt.resolvedUrl("TransfersPage.qml"))
+            }
             MenuItem {
                 text: qsTr("Refresh")
                 onClicked: loadFiles()
@@ -92,13 +85,13 @@ Page {
             id: listItem
             contentHeight: Theme.itemSizeMedium
 
-            Image {
+            FileThumbnail {
                 id: icon
                 x: Theme.horizontalPageMargin
                 anchors.verticalCenter: parent.verticalCenter
-                width: Theme.iconSizeMedium
-                height: Theme.iconSizeMedium
-                source: isFolder ? "image://theme/icon-m-folder" : "image://theme/icon-m-file-other"
+                fileId: model.fileId
+                isFolder: model.isFolder
+                hasThumbnail: model.thumbnailUrl !== ""
             }
 
             Column {
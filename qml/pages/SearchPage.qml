@@ -1,41 +1,22 @@
 import QtQuick 2.0
 import Sailfish.Silica 1.0
-import harbour.pilvi.models 1.0
+import harbour.pilvi.googledrive 1.0
+import "../components"
 
 Page {
     id: page
 
     allowedOrientations: Orientation.All
 
-    FileModel {
-        id: searchResultsModel
-    }
-
-    Connections {
-        target: driveApi
-        onSearchCompleted: {
-            searchResultsModel.clear()
-            for (var i = 0; i < results.length; i++) {
-                var file = results[i]
-                searchResultsModel.addFile(
-                    file.id,
-                    file.name,
-                    file.mimeType,
-                    file.size || 0,
-                    file.modifiedTime || "",
-                    file.starred || false,
-                    file.iconLink || "",
-                    file.thumbnailLink || "",
-                    file.webViewLink || ""
-                )
-            }
-        }
+    SearchSession {
+        id: searchSession
+        api: driveApi
     }
 
     SilicaListView {
         id: listView
         anchors.fill: parent
-        model: searchResultsModel
+        model: searchSession.model
 
         header: Column {
             width: parent.width
@@ -51,16 +32,12 @@ Page {
                 EnterKey.iconSource: "image://theme/icon-m-enter-accept"
                 EnterKey.onClicked: {
                     if (text.length > 0) {
-                        driveApi.searchFiles(text)
+                        searchSession.searchNow()
                         focus = false
                     }
                 }
 
-                onTextChanged: {
-                    if (text.length === 0) {
-                        searchResultsModel.clear()
-                    }
-                }
+                onTextChanged: searchSession.query = text
             }
         }
 
@@ -68,13 +45,13 @@ Page {
             id: listItem
             contentHeight: Theme.itemSizeMedium
 
-            Image {
+            FileThumbnail {
                 id: icon
                 x: Theme.horizontalPageMargin
                 anchors.verticalCenter: parent.verticalCenter
-                width: Theme.iconSizeMedium
-                height: Theme.iconSizeMedium
-                source: isFolder ? "image://theme/icon-m-folder" : "image://theme/icon-m-file-other"
+                fileId: model.fileId
+                isFolder: model.isFolder
+                hasThumbnail: model.thumbnailUrl !== ""
             }
 
             Column {
@@ -122,7 +99,7 @@ Page {
         }
 
         ViewPlaceholder {
-            enabled: listView.count === 0 && searchField.text.length > 0 && !driveApi.busy
+            enabled: listView.count === 0 && searchField.text.length > 0 && !searchSession.searching
             text: qsTr("No results")
             hintText: qsTr("Try a different search term")
         }
@@ -136,7 +113,7 @@ Page {
         BusyIndicator {
             size: BusyIndicatorSize.Large
             anchors.centerIn: parent
-            running: driveApi.busy
+            running: searchSession.searching && listView.count === 0
         }
 
         VerticalScrollDecorator {}
@@ -45,15 +45,54 @@ Page {
 
             DetailItem {
                 label: qsTr("Cache size")
-                value: "0 KB"
+                value: Format.formatFileSize(fileCache.cacheSize)
             }
 
             Button {
                 anchors.horizontalCenter: parent.horizontalCenter
                 text: qsTr("Clear cache")
-                onClicked: {
-                    // TODO: Implement cache clearing
-                }
+                onClicked: remorse.execute(qsTr("Clearing cache"), function() {
+                    fileCache.clear()
+                })
+            }
+
+            SectionHeader {
+                text: qsTr("Transfers")
+            }
+
+            Slider {
+                width: parent.width
+                label: qsTr("Parallel transfers")
+                minimumValue: 1
+                maximumValue: transferManager.maxConcurrentLimit
+                stepSize: 1
+                value: transferManager.maxConcurrent
+                valueText: value
+                onReleased: transferManager.maxConcurrent = value
+            }
+
+            SectionHeader {
+                text: qsTr("Sync")
+            }
+
+            DetailItem {
+                label: qsTr("Synced folder")
+                value: syncEngine.active ? syncEngine.localPath : qsTr("None")
+            }
+
+            DetailItem {
+                visible: syncEngine.conflicts > 0
+                label: qsTr("Conflict copies")
+                value: syncEngine.conflicts
+            }
+
+            Button {
+                anchors.horizontalCenter: parent.horizontalCenter
+                visible: syncEngine.active
+                text: qsTr("Stop syncing")
+                onClicked: remorse.execute(qsTr("Stopping sync"), function() {
+                    syncEngine.unpin()
+                })
             }
 
             SectionHeader {
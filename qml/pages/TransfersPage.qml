@@ -0,0 +1,139 @@
+import QtQuick 2.0
+import Sailfish.Silica 1.0
+import harbour.pilvi.models 1.0
+
+Page {
+    id: page
+
+    allowedOrientations: Orientation.All
+
+    function stateText(state, eta, error) {
+        switch (state) {
+        case TransferManager.Queued:
+            return qsTr("Waiting")
+        case TransferManager.Running:
+            return eta >= 0 ? qsTr("%1 left").arg(Format.formatDuration(eta, Formatter.DurationShort))
+                            : qsTr("Transferring")
+        case TransferManager.Paused:
+            return qsTr("Paused")
+        case TransferManager.Completed:
+            return qsTr("Done")
+        case TransferManager.Failed:
+            return error !== "" ? error : qsTr("Failed")
+        case TransferManager.Canceled:
+            return qsTr("Canceled")
+        }
+        return ""
+    }
+
+    SilicaListView {
+        id: listView
+        anchors.fill: parent
+        model: transferManager
+
+        PullDownMenu {
+            MenuItem {
+                text: qsTr("Clear finished")
+                onClicked: transferManager.clearFinished()
+            }
+            MenuItem {
+                text: qsTr("Pause all")
+                onClicked: transferManager.pauseAll()
+            }
+            MenuItem {
+                text: qsTr("Resume all")
+                onClicked: transferManager.resumeAll()
+            }
+        }
+
+        header: PageHeader {
+            title: qsTr("Transfers")
+            description: transferManager.activeCount > 0
+                         ? qsTr("%1/s").arg(Format.formatFileSize(transferManager.throughput))
+                         : ""
+        }
+
+        delegate: ListItem {
+            id: listItem
+            contentHeight: Theme.itemSizeMedium
+            menu: contextMenu
+
+            property bool unfinished: transferState === TransferManager.Queued
+                                      || transferState === TransferManager.Running
+                                      || transferState === TransferManager.Paused
+
+            Image {
+                id: icon
+                x: Theme.horizontalPageMargin
+                anchors.verticalCenter: parent.verticalCenter
+                source: kind === TransferManager.Upload ? "image://theme/icon-m-cloud-upload"
+                                                        : "image://theme/icon-m-cloud-download"
+            }
+
+            Column {
+                anchors {
+                    left: icon.right
+                    leftMargin: Theme.paddingMedium
+                    right: parent.right
+                    rightMargin: Theme.horizontalPageMargin
+                    verticalCenter: parent.verticalCenter
+                }
+
+                Label {
+                    width: parent.width
+                    text: name
+                    truncationMode: TruncationMode.Fade
+                    color: listItem.highlighted ? Theme.highlightColor : Theme.primaryColor
+                }
+
+                Label {
+                    width: parent.width
+                    text: (bytesTotal > 0 ? Format.formatFileSize(bytesDone) + " / " + Format.formatFileSize(bytesTotal) + " · " : "")
+                          + page.stateText(transferState, eta, error)
+                    truncationMode: TruncationMode.Fade
+                    font.pixelSize: Theme.fontSizeExtraSmall
+                    color: Theme.secondaryColor
+                }
+
+                ProgressBar {
+                    width: parent.width
+                    leftMargin: 0
+                    rightMargin: 0
+                    minimumValue: 0
+                    maximumValue: 1
+                    value: progress
+                    visible: listItem.unfinished
+                }
+            }
+
+            Component {
+                id: contextMenu
+                ContextMenu {
+                    MenuItem {
+                        text: transferState === TransferManager.Paused ? qsTr("Resume") : qsTr("Pause")
+                        visible: listItem.unfinished
+                        onClicked: {
+                            if (transferState === TransferManager.Paused) {
+                                transferManager.resume(transferId)
+                            } else {
+                                transferManager.pause(transferId)
+                            }
+                        }
+                    }
+                    MenuItem {
+                        text: qsTr("Cancel")
+                        visible: listItem.unfinished
+                        onClicked: transferManager.cancel(transferId)
+                    }
+                }
+            }
+        }
+
+        ViewPlaceholder {
+            enabled: listView.count === 0
+            text: qsTr("No transfers")
+        }
+
+        VerticalScrollDecorator {}
+    }
+}
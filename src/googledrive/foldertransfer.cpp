@@ -0,0 +1,238 @@
+#include "foldertransfer.h"
+#include "googledriveapi.h"
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTimer>
+#include <QDebug>
+
+// Files handed to the transfer manager at once; it decides how many of
+// them actually run in parallel
+const int FolderTransfer::MAX_RUNNING = 32;
+// Whole folders in as few pages as Drive allows
+const int FolderTransfer::LIST_PAGE_SIZE = 1000;
+
+namespace {
+
+const QString FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
+// Docs, Sheets and the like have no content to fetch with alt=media
+const QString GOOGLE_APPS_MIME_PREFIX = "application/vnd.google-apps.";
+
+} // namespace
+
+FolderTransfer::FolderTransfer(GoogleDriveApi *api, Direction direction, QObject *parent)
+    : QObject(parent)
+    , m_api(api)
+    , m_direction(direction)
+    , m_filesDone(0)
+    , m_filesTotal(0)
+    , m_failures(0)
+    , m_done(false)
+{
+    connect(m_api, &GoogleDriveApi::filesListed, this, &FolderTransfer::handleFilesListed);
+    connect(m_api, &GoogleDriveApi::folderCreated, this, &FolderTransfer::handleFolderCreated);
+    connect(m_api, &GoogleDriveApi::fileUploaded, this, &FolderTransfer::handleFileDone);
+    connect(m_api, &GoogleDriveApi::uploadSkipped, this, &FolderTransfer::handleFileDone);
+    connect(m_api, &GoogleDriveApi::fileDownloaded, this, &FolderTransfer::handleFileDone);
+    connect(m_api, &GoogleDriveApi::requestFailed, this, &FolderTransfer::handleRequestFailed);
+}
+
+void FolderTransfer::startUpload(const QString &localDir, const QString &parentId)
+{
+    if (!QFileInfo(localDir).isDir()) {
+        QTimer::singleShot(0, this, [this, localDir]() {
+            emit failed(QString("%1 is not a folder").arg(localDir));
+        });
+        return;
+    }
+
+    // The parent mirrors nothing; listing it finds a folder to reuse
+    m_localRoot = QDir::cleanPath(localDir);
+    Folder parent;
+    parent.remoteId = parentId;
+    listFolder(parent);
+}
+
+void FolderTransfer::startDownload(const QString &folderId, const QString &localDir)
+{
+    m_localRoot = QDir::cleanPath(localDir);
+    Folder root;
+    root.localPath = m_localRoot;
+    root.remoteId = folderId;
+    listFolder(root);
+}
+
+void FolderTransfer::listFolder(const Folder &folder)
+{
+    const int requestId = m_api->listFiles(folder.remoteId, QString(), LIST_PAGE_SIZE);
+    m_listings.insert(requestId, folder);
+}
+
+void FolderTransfer::handleFilesListed(int requestId, const QJsonArray &files)
+{
+    if (!m_listings.contains(requestId))
+        return;
+
+    const Folder folder = m_listings.take(requestId);
+    if (m_direction == Upload) {
+        mirrorUpload(folder, files);
+    } else {
+        mirrorDownload(folder, files);
+    }
+    feed();
+}
+
+void FolderTransfer::handleFolderCreated(int requestId, const QJsonObject &metadata)
+{
+    if (!m_creations.contains(requestId))
+        return;
+
+    Folder folder;
+    folder.localPath = m_creations.take(requestId);
+    folder.remoteId = metadata["id"].toString();
+    if (folder.localPath == m_localRoot) {
+        m_root = metadata;
+    }
+
+    // Just created, so there is nothing in it to list
+    mirrorUpload(folder, QJsonArray());
+    feed();
+}
+
+void FolderTransfer::mirrorUpload(const Folder &folder, const QJsonArray &files)
+{
+    QStringList subdirs;
+    if (folder.localPath.isEmpty()) {
+        subdirs << m_localRoot;
+    } else {
+        const QDir dir(folder.localPath);
+        const QFileInfoList dirs = dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks, QDir::Name);
+        for (const QFileInfo &info : dirs) {
+            subdirs << info.filePath();
+        }
+
+        // Files already in Drive are caught by the duplicate check of
+        // uploadFile, so re-running a folder upload sends only what changed
+        const QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::NoSymLinks, QDir::Name);
+        for (const QFileInfo &info : entries) {
+            File file;
+            file.localPath = info.filePath();
+            file.remoteId = folder.remoteId;
+            m_queue.append(file);
+            m_filesTotal++;
+        }
+    }
+
+    // Subfolders are created, or looked into, in parallel once their
+    // parent exists
+    for (const QString &subdir : subdirs) {
+        const QString name = QFileInfo(subdir).fileName();
+
+        QJsonObject existing;
+        for (const QJsonValue &value : files) {
+            const QJsonObject file = value.toObject();
+            if (file["name"].toString() == name && file["mimeType"].toString() == FOLDER_MIME_TYPE) {
+                existing = file;
+                break;
+            }
+        }
+
+        if (existing.isEmpty()) {
+            m_creations.insert(m_api->createFolder(name, folder.remoteId), subdir);
+            continue;
+        }
+
+        if (subdir == m_localRoot) {
+            m_root = existing;
+        }
+        Folder child;
+        child.localPath = subdir;
+        child.remoteId = existing["id"].toString();
+        listFolder(child);
+    }
+}
+
+void FolderTransfer::mirrorDownload(const Folder &folder, const QJsonArray &files)
+{
+    if (!QDir().mkpath(folder.localPath)) {
+        qWarning() << "Cannot create" << folder.localPath;
+        m_failures++;
+        return;
+    }
+
+    for (const QJsonValue &value : files) {
+        const QJsonObject file = value.toObject();
+        const QString mimeType = file["mimeType"].toString();
+        // Drive names may contain slashes; local ones cannot
+        const QString name = file["name"].toString().replace('/', '_');
+        if (name.isEmpty())
+            continue;
+
+        if (mimeType == FOLDER_MIME_TYPE) {
+            Folder child;
+            child.localPath = folder.localPath + "/" + name;
+            child.remoteId = file["id"].toString();
+            listFolder(child);
+        } else if (!mimeType.startsWith(GOOGLE_APPS_MIME_PREFIX)) {
+            File entry;
+            entry.localPath = folder.localPath + "/" + name;
+            entry.remoteId = file["id"].toString();
+            m_queue.append(entry);
+            m_filesTotal++;
+        }
+    }
+}
+
+void FolderTransfer::handleFileDone(int requestId)
+{
+    if (!m_running.remove(requestId))
+        return;
+
+    m_filesDone++;
+    feed();
+}
+
+void FolderTransfer::handleRequestFailed(int requestId, const QString &error)
+{
+    if (m_running.remove(requestId)) {
+        m_filesDone++;
+    } else if (m_listings.contains(requestId)) {
+        qWarning() << "Cannot list" << m_listings.take(requestId).remoteId << error;
+    } else if (m_creations.contains(requestId)) {
+        qWarning() << "Cannot create folder for" << m_creations.take(requestId) << error;
+    } else {
+        return;
+    }
+
+    m_failures++;
+    feed();
+}
+
+void FolderTransfer::feed()
+{
+    // Topped up in bursts rather than one file at a time, so uploads added
+    // together share one listing of their folder
+    if (m_running.size() <= MAX_RUNNING / 2) {
+        while (m_running.size() < MAX_RUNNING && !m_queue.isEmpty()) {
+            const File file = m_queue.takeFirst();
+            m_running.insert(m_direction == Upload ? m_api->uploadFile(file.localPath, file.remoteId)
+                                                   : m_api->downloadFile(file.remoteId, file.localPath));
+        }
+    }
+
+    emit progress(m_filesDone, m_filesTotal);
+    finishIfDone();
+}
+
+void FolderTransfer::finishIfDone()
+{
+    if (m_done || !m_listings.isEmpty() || !m_creations.isEmpty() || !m_queue.isEmpty() || !m_running.isEmpty())
+        return;
+
+    m_done = true;
+    if (m_failures > 0) {
+        emit failed(QString("%1 items could not be transferred").arg(m_failures));
+    } else {
+        emit finished(m_root);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef FOLDERTRANSFER_H
+#define FOLDERTRANSFER_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QList>
+#include <QSet>
+#include <QString>
+
+class GoogleDriveApi;
+
+// Copies a whole folder tree between the device and Drive on top of the
+// single-file calls of GoogleDriveApi. Folders are listed, and on upload
+// created, as soon as their parent is known, all branches at once; files
+// are handed to the transfer manager a window at a time.
+class FolderTransfer : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Direction {
+        Upload,
+        Download
+    };
+
+    FolderTransfer(GoogleDriveApi *api, Direction direction, QObject *parent = nullptr);
+
+    // Recreates localDir, under its own name, inside parentId. A folder
+    // of that name already there is reused rather than duplicated.
+    void startUpload(const QString &localDir, const QString &parentId);
+    // Writes the contents of folderId into localDir
+    void startDownload(const QString &folderId, const QString &localDir);
+
+signals:
+    void progress(int filesDone, int filesTotal);
+    // root is the metadata of the uploaded top folder; empty on download
+    void finished(const QJsonObject &root);
+    void failed(const QString &error);
+
+private slots:
+    void handleFilesListed(int requestId, const QJsonArray &files);
+    void handleFolderCreated(int requestId, const QJsonObject &metadata);
+    void handleFileDone(int requestId);
+    void handleRequestFailed(int requestId, const QString &error);
+
+private:
+    // A local directory and the Drive folder it corresponds to
+    struct Folder {
+        QString localPath;
+        QString remoteId;
+    };
+
+    // Local path and, for uploads the parent id, for downloads the file id
+    struct File {
+        QString localPath;
+        QString remoteId;
+    };
+
+    void listFolder(const Folder &folder);
+    void mirrorUpload(const Folder &folder, const QJsonArray &files);
+    void mirrorDownload(const Folder &folder, const QJsonArray &files);
+    void feed();
+    void finishIfDone();
+
+    GoogleDriveApi *m_api;
+    Direction m_direction;
+    QString m_localRoot;
+    QJsonObject m_root;
+    QHash<int, Folder> m_listings;
+    QHash<int, QString> m_creations;
+    QList<File> m_queue;
+    QSet<int> m_running;
+    int m_filesDone;
+    int m_filesTotal;
+    int m_failures;
+    bool m_done;
+
+    static const int MAX_RUNNING;
+    static const int LIST_PAGE_SIZE;
+};
+
+#endif // FOLDERTRANSFER_H
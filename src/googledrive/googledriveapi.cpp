@@ -1,31 +1,84 @@
 #include "googledriveapi.h"
+#include "foldertransfer.h"
+#include "oauthflow.h"
+#include "../network/batchrequest.h"
+#include "../network/downloadtask.h"
+#include "../network/networkrequest.h"
+#include "../network/retrypolicy.h"
+#include "../network/transfermanager.h"
+#include "../network/uploadtask.h"
+#include "../storage/checksumengine.h"
 #include <QFile>
 #include <QFileInfo>
 #include <QJsonDocument>
-#include <QHttpMultiPart>
 #include <QUrlQuery>
-#include <QMimeDatabase>
 #include <QBuffer>
+#include <QDateTime>
+#include <QTimer>
+#include <QVector>
 #include <QDebug>
+#include <climits>
 
 const QString GoogleDriveApi::API_BASE_URL = "https://www.googleapis.com/drive/v3";
 const QString GoogleDriveApi::UPLOAD_URL = "https://www.googleapis.com/upload/drive/v3/files";
-
-GoogleDriveApi::GoogleDriveApi(CredentialStore *credStore, QObject *parent)
+const int GoogleDriveApi::MAX_PAGE_SIZE = 1000;
+// Seconds before expiry at which the access token is replaced
+const int GoogleDriveApi::REFRESH_MARGIN = 300;
+// Long enough to absorb a page being pushed and popped, short enough that
+// nothing visibly lags behind the server
+const int GoogleDriveApi::FRESHNESS_WINDOW = 2000;
+
+GoogleDriveApi::GoogleDriveApi(CredentialStore *credStore, FileCache *fileCache, QObject *parent)
     : QObject(parent)
     , m_networkManager(new QNetworkAccessManager(this))
+    , m_scheduler(new NetworkRequest(this))
+    , m_retryPolicy(new RetryPolicy(this))
+    , m_transfers(new TransferManager(m_scheduler, this))
+    , m_checksums(new ChecksumEngine(this))
+    , m_oauth(new OAuthFlow(this))
+    , m_refreshTimer(new QTimer(this))
+    , m_apiUrl(API_BASE_URL)
+    , m_batchUrl(BatchRequest::BATCH_URL)
     , m_credentialStore(credStore)
+    , m_fileCache(fileCache)
     , m_uploadProgress(0.0)
     , m_downloadProgress(0.0)
     , m_busy(false)
+    , m_nextRequestId(1)
+    , m_syncRequestId(0)
+    , m_retryingRequests(0)
+    , m_refreshing(false)
+    , m_batchDepth(0)
+    , m_uploadChunkSize(UploadTask::DEFAULT_CHUNK_SIZE)
+    , m_freshnessWindow(FRESHNESS_WINDOW)
 {
+    connect(m_oauth, &OAuthFlow::authenticationSucceeded, this, &GoogleDriveApi::handleTokenRefreshed);
+    connect(m_oauth, &OAuthFlow::authenticationFailed, this, &GoogleDriveApi::handleTokenRefreshFailed);
+    connect(m_transfers, &TransferManager::progressChanged, this, &GoogleDriveApi::updateTransferProgress);
+    connect(m_transfers, &TransferManager::transferCanceled, this, &GoogleDriveApi::handleTransferCanceled);
+    connect(m_checksums, &ChecksumEngine::checksumReady, this, &GoogleDriveApi::handleUploadChecksum);
+    connect(this, &GoogleDriveApi::filesListed, this, &GoogleDriveApi::handleUploadListing);
+    connect(this, &GoogleDriveApi::requestFailed, this, &GoogleDriveApi::handleUploadListingFailed);
+    connect(this, &GoogleDriveApi::fileMetadataReceived, this, &GoogleDriveApi::handleDownloadMetadata);
+    connect(this, &GoogleDriveApi::requestFailed, this, &GoogleDriveApi::handleDownloadMetadataFailed);
+    connect(m_fileCache, &FileCache::contentRestored, this, &GoogleDriveApi::handleContentRestored);
+
+    // Replace the token ahead of expiry while there is traffic; when idle
+    // the next request refreshes it before it is sent
+    m_refreshTimer->setSingleShot(true);
+    connect(m_refreshTimer, &QTimer::timeout, this, [this]() {
+        if (m_busy)
+            refreshAccessToken();
+    });
+    connect(m_credentialStore, &CredentialStore::accessTokenChanged, this, &GoogleDriveApi::scheduleTokenRefresh);
+    scheduleTokenRefresh();
 }
 
 GoogleDriveApi::~GoogleDriveApi()
 {
 }
 
-void GoogleDriveApi::listFiles(const QString &folderId, const QString &query)
+int GoogleDriveApi::listFiles(const QString &folderId, const QString &query, int pageSize)
 {
     QUrlQuery urlQuery;
     QString q = QString("'%1' in parents and trashed=false").arg(folderId);
@@ -33,101 +86,294 @@ void GoogleDriveApi::listFiles(const QString &folderId, const QString &query)
         q += " and " + query;
     }
     urlQuery.addQueryItem("q", q);
-    urlQuery.addQueryItem("fields", "files(id,name,mimeType,size,modifiedTime,starred,iconLink,thumbnailLink,webViewLink)");
-    urlQuery.addQueryItem("pageSize", "100");
+    urlQuery.addQueryItem("fields", "nextPageToken,files(id,name,mimeType,size,modifiedTime,starred,iconLink,thumbnailLink,webViewLink,md5Checksum)");
+    urlQuery.addQueryItem("pageSize", QString::number(qBound(1, pageSize, MAX_PAGE_SIZE)));
     urlQuery.addQueryItem("orderBy", "folder,name");
 
-    QUrl url(API_BASE_URL + "/files");
+    QUrl url(m_apiUrl + "/files");
     url.setQuery(urlQuery);
 
-    makeRequest(url, ListFiles);
+    PendingRequest pending;
+    pending.type = ListFiles;
+    pending.requestId = m_nextRequestId++;
+    pending.url = url;
+    pending.method = "GET";
+    m_openListings.insert(pending.requestId);
+
+    // Plain folder listings are cached: paint the stored rows right away
+    // and let the network response revalidate them
+    if (query.isEmpty()) {
+        pending.cacheKey = folderId;
+
+        QJsonArray cached;
+        if (m_fileCache->folderListing(folderId, &cached)) {
+            pending.revalidating = true;
+            m_cachedResults.insert(pending.requestId, cached);
+
+            // Queued so the caller has the request id before the rows arrive
+            const int requestId = pending.requestId;
+            QTimer::singleShot(0, this, [this, requestId, cached]() {
+                if (!isSuperseded(requestId))
+                    deliverPage(requestId, cached, true);
+            });
+        }
+    }
+
+    if (!shareRequest(pending)) {
+        sendRequest(pending);
+    }
+    return pending.requestId;
+}
+
+int GoogleDriveApi::loadFolder(FileModel *model, const QString &folderId)
+{
+    // Pages still in flight for an earlier folder must not land in model
+    for (auto it = m_modelRequests.begin(); it != m_modelRequests.end(); ++it) {
+        if (it.value() == model)
+            it.value() = nullptr;
+    }
+
+    int requestId = listFiles(folderId);
+    if (model)
+        m_modelRequests.insert(requestId, model);
+    return requestId;
 }
 
-void GoogleDriveApi::getFileMetadata(const QString &fileId)
+int GoogleDriveApi::getFileMetadata(const QString &fileId)
 {
     QUrlQuery urlQuery;
     urlQuery.addQueryItem("fields", "*");
 
-    QUrl url(API_BASE_URL + "/files/" + fileId);
+    QUrl url(m_apiUrl + "/files/" + fileId);
     url.setQuery(urlQuery);
 
-    makeRequest(url, GetMetadata);
+    return makeRequest(url, GetMetadata);
 }
 
-void GoogleDriveApi::downloadFile(const QString &fileId, const QString &localPath)
+int GoogleDriveApi::downloadFile(const QString &fileId, const QString &localPath)
 {
-    QUrl url(API_BASE_URL + "/files/" + fileId);
+    // Serve unchanged files from the content cache without touching the network
+    const QJsonObject metadata = m_fileCache->fileMetadata(fileId);
+    const QString version = FileCache::contentVersion(metadata);
+    const int requestId = m_nextRequestId++;
+    if (m_fileCache->restoreContent(fileId, version, localPath)) {
+        DownloadCheck restore;
+        restore.requestId = requestId;
+        restore.fileId = fileId;
+        restore.localPath = localPath;
+        m_contentRestores.append(restore);
+        updateBusy();
+        return requestId;
+    }
+
+    fetchContent(requestId, fileId, localPath, metadata);
+    return requestId;
+}
+
+void GoogleDriveApi::fetchContent(int requestId, const QString &fileId, const QString &localPath,
+                                  const QJsonObject &metadata)
+{
+    // A part file is resumed only at the revision it was started at, and
+    // cached metadata may be behind: ask the server which one is current
+    if (QFile::exists(DownloadTask::progressPath(localPath))) {
+        QUrlQuery urlQuery;
+        urlQuery.addQueryItem("fields", "id,name,size,md5Checksum,modifiedTime");
+        QUrl url(m_apiUrl + "/files/" + fileId);
+        url.setQuery(urlQuery);
+
+        DownloadCheck check;
+        check.requestId = requestId;
+        check.fileId = fileId;
+        check.localPath = localPath;
+        m_downloadChecks.insert(makeRequest(url, GetMetadata), check);
+        return;
+    }
+
+    startDownload(requestId, fileId, localPath, metadata);
+}
+
+void GoogleDriveApi::startDownload(int requestId, const QString &fileId, const QString &localPath,
+                                   const QJsonObject &metadata)
+{
+    QUrl url(m_apiUrl + "/files/" + fileId);
     QUrlQuery urlQuery;
     urlQuery.addQueryItem("alt", "media");
     url.setQuery(urlQuery);
 
-    QNetworkRequest request(url);
-    request.setRawHeader("Authorization", QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+    // Stream the body to disk instead of buffering it in the reply
+    DownloadTask *task = new DownloadTask(m_networkManager, authorizedRequest(url), localPath, this);
+    task->setFileId(fileId);
+    task->setVersion(FileCache::contentVersion(metadata));
+    // Drive sends sizes as strings; absent for Google Docs
+    task->setExpectedSize(metadata.contains("size") ? metadata["size"].toString().toLongLong() : -1);
+    task->setMd5(metadata.value("md5Checksum").toString());
+    task->setScheduler(m_scheduler);
+    task->setChecksums(m_checksums);
+    task->setRetryPolicy(m_retryPolicy);
+    m_downloads.insert(task);
+    m_taskRequests.insert(task, requestId);
+
+    connect(task, &DownloadTask::finished, this, &GoogleDriveApi::handleDownloadFinished);
+    connect(task, &DownloadTask::failed, this, &GoogleDriveApi::handleDownloadFailed);
+    connect(task, &DownloadTask::authorizationExpired, this, &GoogleDriveApi::handleTaskAuthorizationExpired);
+
+    m_transfers->add(task, TransferManager::Download, requestId, QFileInfo(localPath).fileName());
+    updateBusy();
+}
 
-    QNetworkReply *reply = m_networkManager->get(request);
-    m_pendingRequests[reply] = Download;
-    m_downloadPaths[reply] = localPath;
+int GoogleDriveApi::uploadFile(const QString &localPath, const QString &parentId)
+{
+    // Asking again for a running upload hands out the id it already has
+    for (UploadTask *running : m_uploads) {
+        if (running->localPath() == localPath && running->parentId() == parentId)
+            return m_taskRequests.value(running);
+    }
+    for (QHash<int, UploadCheck>::const_iterator it = m_uploadChecks.constBegin(); it != m_uploadChecks.constEnd(); ++it) {
+        if (it->localPath == localPath && it->parentId == parentId)
+            return it.key();
+    }
 
-    connect(reply, &QNetworkReply::finished, this, &GoogleDriveApi::handleNetworkReply);
-    connect(reply, &QNetworkReply::downloadProgress, this, &GoogleDriveApi::handleDownloadProgress);
+    const int requestId = m_nextRequestId++;
 
-    setBusy(true);
+    // Hash the file while the folder is listed. Uploads into one folder
+    // made together share that listing, see shareRequest.
+    UploadCheck check;
+    check.localPath = localPath;
+    check.parentId = parentId;
+    check.listRequestId = listFiles(parentId, QString(), MAX_PAGE_SIZE);
+    m_uploadChecks.insert(requestId, check);
+    m_checksums->requestMd5(localPath);
+
+    updateBusy();
+    return requestId;
 }
 
-void GoogleDriveApi::uploadFile(const QString &localPath, const QString &parentId)
+void GoogleDriveApi::startUpload(int requestId, const QString &localPath, const QString &parentId,
+                                 const QString &fileId)
 {
-    QFile file(localPath);
-    if (!file.open(QIODevice::ReadOnly)) {
-        setError("Cannot open file: " + localPath);
-        return;
-    }
-
-    QFileInfo fileInfo(localPath);
-    QMimeDatabase mimeDb;
-    QString mimeType = mimeDb.mimeTypeForFile(fileInfo).name();
+    // Resumable upload: sent in chunks, continues from the committed offset
+    UploadTask *task = new UploadTask(m_networkManager, m_credentialStore, localPath, parentId, this);
+    task->setFileId(fileId);
+    task->setChunkSize(m_uploadChunkSize);
+    m_uploads.insert(task);
+    m_taskRequests.insert(task, requestId);
+
+    connect(task, &UploadTask::finished, this, &GoogleDriveApi::handleUploadFinished);
+    connect(task, &UploadTask::failed, this, &GoogleDriveApi::handleUploadFailed);
+    connect(task, &UploadTask::authorizationExpired, this, &GoogleDriveApi::handleTaskAuthorizationExpired);
+
+    m_transfers->add(task, TransferManager::Upload, requestId, QFileInfo(localPath).fileName());
+    updateBusy();
+}
 
-    // Metadata
-    QJsonObject metadata;
-    metadata["name"] = fileInfo.fileName();
-    metadata["parents"] = QJsonArray() << parentId;
+void GoogleDriveApi::finishUploadCheck(int requestId)
+{
+    QHash<int, UploadCheck>::const_iterator it = m_uploadChecks.constFind(requestId);
+    if (it == m_uploadChecks.constEnd() || !it->listed || !it->hashed)
+        return;
 
-    QByteArray metadataBytes = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+    const UploadCheck check = m_uploadChecks.take(requestId);
+
+    // Drive allows several files of one name, so only identical content
+    // counts; without a checksum the upload goes ahead
+    if (!check.md5.isEmpty()) {
+        const QString name = QFileInfo(check.localPath).fileName();
+        for (const QJsonValue &value : check.listing) {
+            const QJsonObject file = value.toObject();
+            if (file["name"].toString() == name && file["md5Checksum"].toString() == check.md5) {
+                qDebug() << "Not uploading" << check.localPath << "- already in Drive as" << file["id"].toString();
+                UploadTask::discardSession(check.localPath, check.parentId);
+                updateBusy();
+                emit uploadSkipped(requestId, file);
+                return;
+            }
+        }
+    }
 
-    // Multipart upload
-    QHttpMultiPart *multiPart = new QHttpMultiPart(QHttpMultiPart::RelatedType);
+    startUpload(requestId, check.localPath, check.parentId);
+}
 
-    QHttpPart metadataPart;
-    metadataPart.setHeader(QNetworkRequest::ContentTypeHeader, "application/json; charset=UTF-8");
-    metadataPart.setBody(metadataBytes);
+int GoogleDriveApi::updateFile(const QString &fileId, const QString &localPath)
+{
+    for (UploadTask *running : m_uploads) {
+        if (running->localPath() == localPath && running->fileId() == fileId)
+            return m_taskRequests.value(running);
+    }
 
-    QHttpPart filePart;
-    filePart.setHeader(QNetworkRequest::ContentTypeHeader, mimeType);
-    filePart.setBodyDevice(&file);
-    file.setParent(multiPart);
+    const int requestId = m_nextRequestId++;
+    startUpload(requestId, localPath, QString(), fileId);
+    return requestId;
+}
 
-    multiPart->append(metadataPart);
-    multiPart->append(filePart);
+void GoogleDriveApi::resumeUploads()
+{
+    const QList<QStringList> sessions = UploadTask::pendingSessions();
+    for (const QStringList &session : sessions) {
+        if (session.size() != 3 || !QFileInfo::exists(session.at(0)))
+            continue;
+        if (session.at(2).isEmpty()) {
+            uploadFile(session.at(0), session.at(1));
+        } else {
+            updateFile(session.at(2), session.at(0));
+        }
+    }
+}
 
-    QUrl url(UPLOAD_URL);
-    QUrlQuery urlQuery;
-    urlQuery.addQueryItem("uploadType", "multipart");
-    urlQuery.addQueryItem("fields", "id,name,mimeType,size,modifiedTime");
-    url.setQuery(urlQuery);
+int GoogleDriveApi::uploadFolder(const QString &localDir, const QString &parentId)
+{
+    const int requestId = m_nextRequestId++;
+    FolderTransfer *transfer = new FolderTransfer(this, FolderTransfer::Upload, this);
+    trackFolderTransfer(transfer, requestId);
+    connect(transfer, &FolderTransfer::finished, this, [this, requestId](const QJsonObject &root) {
+        emit folderUploaded(requestId, root);
+    });
+    transfer->startUpload(localDir, parentId);
+    return requestId;
+}
 
-    QNetworkRequest request(url);
-    request.setRawHeader("Authorization", QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+int GoogleDriveApi::downloadFolder(const QString &folderId, const QString &localDir)
+{
+    const int requestId = m_nextRequestId++;
+    FolderTransfer *transfer = new FolderTransfer(this, FolderTransfer::Download, this);
+    trackFolderTransfer(transfer, requestId);
+    connect(transfer, &FolderTransfer::finished, this, [this, requestId, localDir]() {
+        emit folderDownloaded(requestId, localDir);
+    });
+    transfer->startDownload(folderId, localDir);
+    return requestId;
+}
 
-    QNetworkReply *reply = m_networkManager->post(request, multiPart);
-    multiPart->setParent(reply);
-    m_pendingRequests[reply] = Upload;
+void GoogleDriveApi::trackFolderTransfer(FolderTransfer *transfer, int requestId)
+{
+    connect(transfer, &FolderTransfer::progress, this, [this, requestId](int filesDone, int filesTotal) {
+        emit folderProgress(requestId, filesDone, filesTotal);
+    });
+    connect(transfer, &FolderTransfer::finished, transfer, &QObject::deleteLater);
+    connect(transfer, &FolderTransfer::failed, this, [this, requestId, transfer](const QString &error) {
+        transfer->deleteLater();
+        setError(error);
+        emit requestFailed(requestId, error);
+    });
+}
 
-    connect(reply, &QNetworkReply::finished, this, &GoogleDriveApi::handleNetworkReply);
-    connect(reply, &QNetworkReply::uploadProgress, this, &GoogleDriveApi::handleUploadProgress);
+void GoogleDriveApi::setUploadChunkSize(qint64 size)
+{
+    if (m_uploadChunkSize != size && size > 0) {
+        m_uploadChunkSize = size;
+        emit uploadChunkSizeChanged();
+    }
+}
 
-    setBusy(true);
+void GoogleDriveApi::setFreshnessWindow(int msecs)
+{
+    if (m_freshnessWindow != msecs) {
+        m_freshnessWindow = msecs;
+        m_freshResponses.clear();
+        emit freshnessWindowChanged();
+    }
 }
 
-void GoogleDriveApi::createFolder(const QString &name, const QString &parentId)
+int GoogleDriveApi::createFolder(const QString &name, const QString &parentId)
 {
     QJsonObject metadata;
     metadata["name"] = name;
@@ -135,41 +381,50 @@ void GoogleDriveApi::createFolder(const QString &name, const QString &parentId)
     metadata["parents"] = QJsonArray() << parentId;
 
     QByteArray data = QJsonDocument(metadata).toJson();
-    QUrl url(API_BASE_URL + "/files");
+    QUrl url(m_apiUrl + "/files");
 
-    makeRequest(url, CreateFolder, data, "POST");
+    return makeRequest(url, CreateFolder, data, "POST");
 }
 
-void GoogleDriveApi::deleteFile(const QString &fileId)
+int GoogleDriveApi::deleteFile(const QString &fileId)
 {
-    QUrl url(API_BASE_URL + "/files/" + fileId);
-    makeRequest(url, Delete, QByteArray(), "DELETE");
+    QUrl url(m_apiUrl + "/files/" + fileId);
+    return makeRequest(url, Delete, QByteArray(), "DELETE");
 }
 
-void GoogleDriveApi::renameFile(const QString &fileId, const QString &newName)
+int GoogleDriveApi::trashFile(const QString &fileId)
+{
+    QJsonObject metadata;
+    metadata["trashed"] = true;
+
+    QUrl url(m_apiUrl + "/files/" + fileId);
+    return makeRequest(url, Delete, QJsonDocument(metadata).toJson(), "PATCH");
+}
+
+int GoogleDriveApi::renameFile(const QString &fileId, const QString &newName)
 {
     QJsonObject metadata;
     metadata["name"] = newName;
 
     QByteArray data = QJsonDocument(metadata).toJson();
-    QUrl url(API_BASE_URL + "/files/" + fileId);
+    QUrl url(m_apiUrl + "/files/" + fileId);
 
-    makeRequest(url, Rename, data, "PATCH");
+    return makeRequest(url, Rename, data, "PATCH");
 }
 
-void GoogleDriveApi::moveFile(const QString &fileId, const QString &newParentId)
+int GoogleDriveApi::moveFile(const QString &fileId, const QString &newParentId)
 {
     QUrlQuery urlQuery;
     urlQuery.addQueryItem("addParents", newParentId);
     urlQuery.addQueryItem("fields", "id,name,parents");
 
-    QUrl url(API_BASE_URL + "/files/" + fileId);
+    QUrl url(m_apiUrl + "/files/" + fileId);
     url.setQuery(urlQuery);
 
-    makeRequest(url, Move, QByteArray(), "PATCH");
+    return makeRequest(url, Move, QByteArray(), "PATCH");
 }
 
-void GoogleDriveApi::copyFile(const QString &fileId, const QString &newParentId)
+int GoogleDriveApi::copyFile(const QString &fileId, const QString &newParentId)
 {
     QJsonObject metadata;
     if (!newParentId.isEmpty()) {
@@ -177,23 +432,23 @@ void GoogleDriveApi::copyFile(const QString &fileId, const QString &newParentId)
     }
 
     QByteArray data = QJsonDocument(metadata).toJson();
-    QUrl url(API_BASE_URL + "/files/" + fileId + "/copy");
+    QUrl url(m_apiUrl + "/files/" + fileId + "/copy");
 
-    makeRequest(url, Copy, data, "POST");
+    return makeRequest(url, Copy, data, "POST");
 }
 
-void GoogleDriveApi::starFile(const QString &fileId, bool starred)
+int GoogleDriveApi::starFile(const QString &fileId, bool starred)
 {
     QJsonObject metadata;
     metadata["starred"] = starred;
 
     QByteArray data = QJsonDocument(metadata).toJson();
-    QUrl url(API_BASE_URL + "/files/" + fileId);
+    QUrl url(m_apiUrl + "/files/" + fileId);
 
-    makeRequest(url, Star, data, "PATCH");
+    return makeRequest(url, Star, data, "PATCH");
 }
 
-void GoogleDriveApi::shareFile(const QString &fileId, const QString &email, const QString &role)
+int GoogleDriveApi::shareFile(const QString &fileId, const QString &email, const QString &role)
 {
     QJsonObject permission;
     permission["type"] = "user";
@@ -201,59 +456,378 @@ void GoogleDriveApi::shareFile(const QString &fileId, const QString &email, cons
     permission["emailAddress"] = email;
 
     QByteArray data = QJsonDocument(permission).toJson();
-    QUrl url(API_BASE_URL + "/files/" + fileId + "/permissions");
+    QUrl url(m_apiUrl + "/files/" + fileId + "/permissions");
 
-    makeRequest(url, Share, data, "POST");
+    return makeRequest(url, Share, data, "POST");
 }
 
-void GoogleDriveApi::searchFiles(const QString &query)
+int GoogleDriveApi::searchFiles(const QString &query, int pageSize)
 {
+    pageSize = qBound(1, pageSize, MAX_PAGE_SIZE);
+    const int requestId = m_nextRequestId++;
+    m_openListings.insert(requestId);
+
+    // Show what the cache already knows as the first page; server pages
+    // then only add files that are not in it
+    const QJsonArray hits = m_fileCache->searchNames(query, pageSize);
+    if (!hits.isEmpty()) {
+        QSet<QString> &ids = m_searchHits[requestId];
+        for (const QJsonValue &hit : hits) {
+            ids.insert(hit.toObject().value("id").toString());
+        }
+        m_pagedResults.insert(requestId, hits);
+
+        // Queued so the caller has the request id before the rows arrive
+        QTimer::singleShot(0, this, [this, requestId, hits]() {
+            if (!isSuperseded(requestId))
+                deliverPage(requestId, hits, false);
+        });
+    }
+
     QUrlQuery urlQuery;
-    QString q = QString("name contains '%1' and trashed=false").arg(query);
-    urlQuery.addQueryItem("q", q);
-    urlQuery.addQueryItem("fields", "files(id,name,mimeType,size,modifiedTime,starred,iconLink,thumbnailLink)");
-    urlQuery.addQueryItem("pageSize", "50");
+    urlQuery.addQueryItem("q", buildQuery(query));
+    urlQuery.addQueryItem("fields", "nextPageToken,files(id,name,mimeType,size,modifiedTime,starred,iconLink,thumbnailLink)");
+    urlQuery.addQueryItem("pageSize", QString::number(pageSize));
 
-    QUrl url(API_BASE_URL + "/files");
+    QUrl url(m_apiUrl + "/files");
     url.setQuery(urlQuery);
 
-    makeRequest(url, Search);
+    return makeRequest(url, Search, QByteArray(), "GET", requestId);
 }
 
-void GoogleDriveApi::getChanges(const QString &pageToken)
+int GoogleDriveApi::searchLocal(const QString &query, int limit)
 {
-    QUrlQuery urlQuery;
-    if (!pageToken.isEmpty()) {
-        urlQuery.addQueryItem("pageToken", pageToken);
-    } else {
-        urlQuery.addQueryItem("pageToken", "1");
+    const int requestId = m_nextRequestId++;
+    const QJsonArray hits = m_fileCache->searchNames(query, limit);
+
+    QTimer::singleShot(0, this, [this, requestId, hits]() {
+        deliverPage(requestId, hits, true);
+        emit searchCompleted(requestId, hits);
+    });
+    return requestId;
+}
+
+QString GoogleDriveApi::buildQuery(const QString &query)
+{
+    // Quotes and backslashes in the term would end the string literal
+    QString term = query;
+    term.replace("\\", "\\\\");
+    term.replace("'", "\\'");
+    return QString("name contains '%1' and trashed=false").arg(term);
+}
+
+int GoogleDriveApi::getChanges(const QString &pageToken)
+{
+    // One sync at a time; callers asking again just join the running one
+    if (m_syncRequestId != 0)
+        return m_syncRequestId;
+
+    m_syncRequestId = m_nextRequestId++;
+    m_syncPageToken = pageToken;
+    continueSync();
+    return m_syncRequestId;
+}
+
+void GoogleDriveApi::continueSync()
+{
+    // The changes feed names the real id of "My Drive"; it is needed to
+    // match changes against the "root" alias the pages list
+    if (m_fileCache->rootFolderId().isEmpty()) {
+        QUrlQuery urlQuery;
+        urlQuery.addQueryItem("fields", "id");
+        QUrl url(m_apiUrl + "/files/root");
+        url.setQuery(urlQuery);
+        makeRequest(url, RootFolder, QByteArray(), "GET", m_syncRequestId);
+        return;
     }
-    urlQuery.addQueryItem("fields", "newStartPageToken,changes(fileId,file(id,name,mimeType,trashed))");
 
-    QUrl url(API_BASE_URL + "/changes");
+    QString pageToken = m_syncPageToken.isEmpty() ? m_fileCache->changesToken() : m_syncPageToken;
+    if (pageToken.isEmpty()) {
+        // First run: start from now, the listings already hold the state
+        QUrlQuery urlQuery;
+        urlQuery.addQueryItem("fields", "startPageToken");
+        QUrl url(m_apiUrl + "/changes/startPageToken");
+        url.setQuery(urlQuery);
+        makeRequest(url, StartPageToken, QByteArray(), "GET", m_syncRequestId);
+        return;
+    }
+
+    QUrlQuery urlQuery;
+    urlQuery.addQueryItem("pageToken", pageToken);
+    urlQuery.addQueryItem("pageSize", QString::number(MAX_PAGE_SIZE));
+    urlQuery.addQueryItem("fields", "nextPageToken,newStartPageToken,changes(fileId,removed,file(id,name,mimeType,size,modifiedTime,starred,iconLink,thumbnailLink,webViewLink,md5Checksum,parents,trashed))");
+
+    QUrl url(m_apiUrl + "/changes");
     url.setQuery(urlQuery);
 
-    makeRequest(url, Changes);
+    makeRequest(url, Changes, QByteArray(), "GET", m_syncRequestId);
+}
+
+void GoogleDriveApi::handleChangesPage(const PendingRequest &request, const QJsonObject &response)
+{
+    const QString rootFolderId = m_fileCache->rootFolderId();
+
+    QJsonArray &allChanges = m_pagedResults[request.requestId];
+    const QJsonArray changes = response["changes"].toArray();
+    for (const QJsonValue &value : changes) {
+        QJsonObject change = value.toObject();
+
+        // Let changes in My Drive match listings keyed on the "root" alias
+        QJsonObject file = change.value("file").toObject();
+        QJsonArray parents = file.value("parents").toArray();
+        if (!rootFolderId.isEmpty() && parents.contains(rootFolderId)) {
+            parents.append(QString("root"));
+            file["parents"] = parents;
+            change["file"] = file;
+        }
+
+        allChanges.append(change);
+    }
+
+    QString nextPageToken = response["nextPageToken"].toString();
+    if (!nextPageToken.isEmpty()) {
+        m_syncPageToken = nextPageToken;
+        continueSync();
+        return;
+    }
+
+    QJsonArray results = m_pagedResults.take(request.requestId);
+    QString newStartPageToken = response["newStartPageToken"].toString();
+
+    m_fileCache->applyChanges(results);
+    m_fileCache->setChangesToken(newStartPageToken);
+
+    m_syncRequestId = 0;
+    m_syncPageToken.clear();
+    if (!results.isEmpty()) {
+        m_freshResponses.clear();
+    }
+    emit changesReceived(request.requestId, results, newStartPageToken);
 }
 
-void GoogleDriveApi::getAbout()
+int GoogleDriveApi::getAbout()
 {
     QUrlQuery urlQuery;
     urlQuery.addQueryItem("fields", "user,storageQuota");
 
-    QUrl url(API_BASE_URL + "/about");
+    QUrl url(m_apiUrl + "/about");
     url.setQuery(urlQuery);
 
-    makeRequest(url, About);
+    return makeRequest(url, About);
 }
 
-void GoogleDriveApi::makeRequest(const QUrl &url, RequestType type, const QByteArray &data, const QString &method)
+void GoogleDriveApi::beginBatch()
 {
-    QNetworkRequest request(url);
-    request.setRawHeader("Authorization", QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+    ++m_batchDepth;
+}
+
+void GoogleDriveApi::commitBatch()
+{
+    if (m_batchDepth == 0 || --m_batchDepth > 0)
+        return;
+
+    QList<PendingRequest> requests;
+    requests.swap(m_batchedRequests);
+    sendBatch(requests);
+}
+
+void GoogleDriveApi::deleteFiles(const QStringList &fileIds)
+{
+    beginBatch();
+    for (const QString &fileId : fileIds) {
+        deleteFile(fileId);
+    }
+    commitBatch();
+}
+
+int GoogleDriveApi::makeRequest(const QUrl &url, RequestType type, const QByteArray &data,
+                                const QString &method, int requestId)
+{
+    PendingRequest pending;
+    pending.type = type;
+    pending.requestId = requestId != 0 ? requestId : m_nextRequestId++;
+    pending.url = url;
+    pending.data = data;
+    pending.method = method;
+
+    // Paged requests chain on their own replies and are never batched
+    if (m_batchDepth > 0 && type != ListFiles && type != Search && type != Changes) {
+        m_batchedRequests.append(pending);
+        return pending.requestId;
+    }
+
+    if (!shareRequest(pending)) {
+        sendRequest(pending);
+    }
+    return pending.requestId;
+}
+
+bool GoogleDriveApi::shareRequest(PendingRequest &pending)
+{
+    // Plain reads only; the changes feed already runs one sync at a time
+    if (pending.method != "GET" || (pending.type != ListFiles && pending.type != Search
+                                    && pending.type != GetMetadata && pending.type != About)) {
+        return false;
+    }
+
+    pending.shareKey = pending.url.toString(QUrl::FullyEncoded);
+
+    auto fresh = m_freshResponses.constFind(pending.shareKey);
+    if (fresh != m_freshResponses.constEnd()
+            && QDateTime::currentMSecsSinceEpoch() - fresh->received < m_freshnessWindow) {
+        // Queued so the caller has the request id before the result arrives
+        const PendingRequest request = pending;
+        const QByteArray data = fresh->data;
+        QTimer::singleShot(0, this, [this, request, data]() {
+            dispatchResponse(request, data);
+        });
+        return true;
+    }
+
+    // The same read is already on the wire: wait for its reply
+    int leader = m_sharedRequests.value(pending.shareKey);
+    if (leader != 0) {
+        if (m_pagingShares.contains(leader)) {
+            // Its first pages are gone; this one needs the listing from the start
+            pending.shareKey.clear();
+            return false;
+        }
+        m_followers[leader].append(pending);
+        return true;
+    }
+
+    m_sharedRequests.insert(pending.shareKey, pending.requestId);
+    return false;
+}
+
+bool GoogleDriveApi::isSharedLeader(const PendingRequest &request) const
+{
+    return !request.shareKey.isEmpty() && m_sharedRequests.value(request.shareKey) == request.requestId;
+}
+
+void GoogleDriveApi::dispatchShared(const PendingRequest &request, const QByteArray &data)
+{
+    dispatchResponse(request, data);
+
+    // Listings hand every page to their followers themselves
+    if (request.type == ListFiles || request.type == Search)
+        return;
+
+    const QList<PendingRequest> followers = m_followers.take(request.requestId);
+    for (const PendingRequest &follower : followers) {
+        dispatchResponse(follower, data);
+    }
+    releaseShared(request, data);
+}
+
+void GoogleDriveApi::releaseShared(const PendingRequest &request, const QByteArray &data)
+{
+    if (!isSharedLeader(request))
+        return;
+
+    m_sharedRequests.remove(request.shareKey);
+    m_pagingShares.remove(request.requestId);
+    if (m_freshnessWindow <= 0 || data.isEmpty())
+        return;
+
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = m_freshResponses.begin(); it != m_freshResponses.end();) {
+        if (now - it->received >= m_freshnessWindow) {
+            it = m_freshResponses.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    FreshResponse fresh;
+    fresh.received = now;
+    fresh.data = data;
+    m_freshResponses.insert(request.shareKey, fresh);
+}
+
+void GoogleDriveApi::sendBatch(const QList<PendingRequest> &requests)
+{
+    for (int first = 0; first < requests.count(); first += BatchRequest::MAX_PARTS) {
+        QList<PendingRequest> parts = requests.mid(first, BatchRequest::MAX_PARTS);
+        if (parts.count() == 1) {
+            sendRequest(parts.first());
+            continue;
+        }
+
+        BatchRequest batch;
+        for (const PendingRequest &part : parts) {
+            batch.addPart(part.method, part.url, part.data);
+        }
+
+        PendingRequest pending;
+        pending.type = Batch;
+        pending.requestId = m_nextRequestId++;
+        pending.url = QUrl(m_batchUrl);
+        pending.data = batch.body();
+        pending.contentType = batch.contentType();
+        pending.method = "POST";
+
+        m_batches.insert(pending.requestId, parts);
+        sendRequest(pending);
+    }
+}
+
+void GoogleDriveApi::cancelRequest(int requestId)
+{
+    // Finished already; a mark now would never be removed
+    if (!m_openListings.contains(requestId))
+        return;
+
+    // Marked like a superseded load, so pages already on their way are
+    // dropped and no further ones are asked for. The mark goes once the
+    // request is discarded or its paging stops.
+    m_modelRequests.insert(requestId, QPointer<FileModel>());
+
+    for (auto it = m_pendingRequests.begin(); it != m_pendingRequests.end(); ++it) {
+        if (it->requestId != requestId)
+            continue;
+        if (!isWanted(it.value()))
+            it.key()->abort();
+        return;
+    }
+}
+
+void GoogleDriveApi::sendRequest(const PendingRequest &pending)
+{
+    // Held back while the interactive lane is full; see NetworkRequest.
+    // Without an owner: API calls are canceled by request id, and one
+    // reply may answer several callers, see shareRequest.
+    m_scheduler->enqueueReply(NetworkRequest::Interactive, nullptr, [this, pending]() {
+        return startRequest(pending);
+    });
+    setBusy(true);
+}
+
+QNetworkReply *GoogleDriveApi::startRequest(const PendingRequest &pending)
+{
+    // Canceled while queued, retrying or parked
+    if (!isWanted(pending)) {
+        discardRequest(pending);
+        return nullptr;
+    }
+
+    // Hold the request back rather than send it with a token that is
+    // about to be replaced
+    if (m_refreshing || (m_credentialStore->tokenExpiresWithin(REFRESH_MARGIN)
+                         && !m_credentialStore->refreshToken().isEmpty())) {
+        m_parkedRequests.append(pending);
+        refreshAccessToken();
+        return nullptr;
+    }
+
+    const QByteArray &data = pending.data;
+    const QString &method = pending.method;
+
+    QNetworkRequest request = authorizedRequest(pending.url);
 
     if (!data.isEmpty()) {
-        request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json");
+        request.setHeader(QNetworkRequest::ContentTypeHeader,
+                          pending.contentType.isEmpty() ? QByteArray("application/json") : pending.contentType);
     }
 
     QNetworkReply *reply = nullptr;
@@ -273,10 +847,10 @@ void GoogleDriveApi::makeRequest(const QUrl &url, RequestType type, const QByteA
     }
 
     if (reply) {
-        m_pendingRequests[reply] = type;
+        m_pendingRequests[reply] = pending;
         connect(reply, &QNetworkReply::finished, this, &GoogleDriveApi::handleNetworkReply);
-        setBusy(true);
     }
+    return reply;
 }
 
 void GoogleDriveApi::handleNetworkReply()
@@ -287,91 +861,732 @@ void GoogleDriveApi::handleNetworkReply()
 
     reply->deleteLater();
 
-    RequestType type = m_pendingRequests.take(reply);
-    setBusy(!m_pendingRequests.isEmpty());
+    PendingRequest request = m_pendingRequests.take(reply);
+
+    if (reply->error() == QNetworkReply::OperationCanceledError && !isWanted(request)) {
+        discardRequest(request);
+        updateBusy();
+        return;
+    }
 
     if (reply->error() != QNetworkReply::NoError) {
-        setError(reply->errorString());
+        int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (status == 401 && !request.reauthorized && !m_credentialStore->refreshToken().isEmpty()) {
+            request.reauthorized = true;
+            if (isStaleAuthorization(reply->request().rawHeader("Authorization"))) {
+                // Another 401 already got us a new token
+                sendRequest(request);
+            } else {
+                m_parkedRequests.append(request);
+                refreshAccessToken();
+            }
+            updateBusy();
+            return;
+        }
+
+        int delay = m_retryPolicy->retryDelay(reply, request.attempt, isIdempotent(request.type));
+        if (delay >= 0) {
+            ++request.attempt;
+            ++m_retryingRequests;
+            QTimer::singleShot(delay, this, [this, request]() {
+                --m_retryingRequests;
+                sendRequest(request);
+            });
+            return;
+        }
+
+        failRequest(request, reply->errorString());
         return;
     }
 
+    m_retryPolicy->recordSuccess();
+
     QByteArray responseData = reply->readAll();
-    QJsonDocument doc = QJsonDocument::fromJson(responseData);
+    if (request.type == Batch) {
+        handleBatchResponse(request, reply->rawHeader("Content-Type"), reply->request().rawHeader("Authorization"),
+                            responseData);
+    } else {
+        dispatchShared(request, responseData);
+    }
 
-    switch (type) {
-    case ListFiles: {
-        QJsonArray files = doc.object()["files"].toArray();
-        emit filesListed(files);
-        break;
+    updateBusy();
+}
+
+void GoogleDriveApi::dispatchResponse(const PendingRequest &request, const QByteArray &data)
+{
+    QJsonDocument doc = QJsonDocument::fromJson(data);
+
+    // Whatever was read before a change may be out of date now
+    if (request.method != "GET") {
+        m_freshResponses.clear();
     }
-    case GetMetadata:
-        emit fileMetadataReceived(doc.object());
-        break;
-    case Download: {
-        QString localPath = m_downloadPaths.take(reply);
-        QFile file(localPath);
-        if (file.open(QIODevice::WriteOnly)) {
-            file.write(responseData);
-            file.close();
-            emit fileDownloaded(localPath);
-        } else {
-            setError("Failed to save file: " + localPath);
-        }
-        setDownloadProgress(0.0);
+
+    switch (request.type) {
+    case ListFiles:
+    case Search:
+        handleFilesPage(request, doc.object());
         break;
-    }
-    case Upload:
-        emit fileUploaded(doc.object());
-        setUploadProgress(0.0);
+    case GetMetadata:
+        emit fileMetadataReceived(request.requestId, doc.object());
         break;
     case CreateFolder:
-        emit folderCreated(doc.object());
+        emit folderCreated(request.requestId, doc.object());
         break;
     case Delete:
-        emit fileDeleted(reply->url().path().split("/").last());
+        emit fileDeleted(request.requestId, request.url.path().section('/', -1));
         break;
     case Rename:
+        emit fileRenamed(request.requestId, doc.object());
+        break;
     case Move:
-        emit fileMoved(doc.object());
+        emit fileMoved(request.requestId, doc.object());
         break;
     case Copy:
-        emit fileCopied(doc.object());
+        emit fileCopied(request.requestId, doc.object());
         break;
     case Star:
-        // Handle star response
+        // The PATCH response only carries the fields asked for, so take
+        // the new state from what was sent
+        emit fileStarred(request.requestId, request.url.path().section('/', -1),
+                         QJsonDocument::fromJson(request.data).object()["starred"].toBool());
         break;
     case Share:
-        emit fileShared(reply->url().path().split("/").first());
+        emit fileShared(request.requestId, request.url.path().section('/', -2, -2));
         break;
-    case Search: {
-        QJsonArray files = doc.object()["files"].toArray();
-        emit searchCompleted(files);
+    case RootFolder:
+        m_fileCache->setRootFolderId(doc.object()["id"].toString());
+        continueSync();
         break;
-    }
-    case Changes: {
-        QJsonArray changes = doc.object()["changes"].toArray();
-        QString newPageToken = doc.object()["newStartPageToken"].toString();
-        emit changesReceived(changes, newPageToken);
+    case StartPageToken: {
+        QString startPageToken = doc.object()["startPageToken"].toString();
+        m_fileCache->setChangesToken(startPageToken);
+        m_syncRequestId = 0;
+        emit changesReceived(request.requestId, QJsonArray(), startPageToken);
         break;
     }
+    case Changes:
+        handleChangesPage(request, doc.object());
+        break;
     case About:
-        emit aboutReceived(doc.object());
+        emit aboutReceived(request.requestId, doc.object());
+        break;
+    case Batch:
         break;
     }
 }
 
-void GoogleDriveApi::handleUploadProgress(qint64 bytesSent, qint64 bytesTotal)
+void GoogleDriveApi::handleBatchResponse(const PendingRequest &request, const QByteArray &contentType,
+                                         const QByteArray &authorization, const QByteArray &data)
 {
-    if (bytesTotal > 0) {
-        setUploadProgress(static_cast<qreal>(bytesSent) / bytesTotal);
+    const QList<PendingRequest> parts = m_batches.take(request.requestId);
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(contentType, data);
+
+    QVector<bool> answered(parts.count(), false);
+    QList<PendingRequest> retries;
+    bool refresh = false;
+
+    for (const BatchRequest::Response &response : responses) {
+        if (response.index < 0 || response.index >= parts.count() || answered.at(response.index))
+            continue;
+        answered[response.index] = true;
+
+        PendingRequest part = parts.at(response.index);
+        if (response.status >= 200 && response.status < 300) {
+            dispatchResponse(part, response.body);
+        } else if (response.status == 401 && !part.reauthorized && !m_credentialStore->refreshToken().isEmpty()) {
+            part.reauthorized = true;
+            m_parkedRequests.append(part);
+            refresh = true;
+        } else if (RetryPolicy::isTransientStatus(response.status, response.body)
+                   && (isIdempotent(part.type) || RetryPolicy::isUnprocessedStatus(response.status, response.body))
+                   && part.attempt + 1 < m_retryPolicy->maxAttempts()) {
+            ++part.attempt;
+            retries.append(part);
+        } else {
+            QString message = QJsonDocument::fromJson(response.body).object()["error"].toObject()["message"].toString();
+            failRequest(part, message.isEmpty() ? QString("Request failed with status %1").arg(response.status) : message);
+        }
+    }
+
+    // Calls the server did not answer are treated like a lost connection
+    for (int i = 0; i < parts.count(); ++i) {
+        if (answered.at(i))
+            continue;
+        PendingRequest part = parts.at(i);
+        if (isIdempotent(part.type) && part.attempt + 1 < m_retryPolicy->maxAttempts()) {
+            ++part.attempt;
+            retries.append(part);
+        } else {
+            failRequest(part, "No response in batch");
+        }
+    }
+
+    if (refresh) {
+        if (isStaleAuthorization(authorization)) {
+            QList<PendingRequest> parked;
+            parked.swap(m_parkedRequests);
+            for (const PendingRequest &part : parked) {
+                sendRequest(part);
+            }
+        } else {
+            refreshAccessToken();
+        }
+    }
+
+    if (!retries.isEmpty()) {
+        // Back off before sending the throttled calls again, as one batch
+        int attempt = 0;
+        for (const PendingRequest &part : retries) {
+            attempt = qMax(attempt, part.attempt);
+        }
+        ++m_retryingRequests;
+        QTimer::singleShot(m_retryPolicy->backoff(attempt - 1), this, [this, retries]() {
+            --m_retryingRequests;
+            sendBatch(retries);
+        });
+    }
+}
+
+void GoogleDriveApi::failRequest(const PendingRequest &request, const QString &error)
+{
+    if (request.type == Batch) {
+        const QList<PendingRequest> parts = m_batches.take(request.requestId);
+        for (const PendingRequest &part : parts) {
+            failRequest(part, error);
+        }
+        return;
+    }
+
+    const QList<PendingRequest> followers = m_followers.take(request.requestId);
+    for (const PendingRequest &follower : followers) {
+        failRequest(follower, error);
+    }
+    releaseShared(request, QByteArray());
+
+    m_pagedResults.remove(request.requestId);
+    m_cachedResults.remove(request.requestId);
+    m_searchHits.remove(request.requestId);
+    m_modelRequests.remove(request.requestId);
+    m_openListings.remove(request.requestId);
+    if (request.requestId == m_syncRequestId) {
+        m_syncRequestId = 0;
+        m_syncPageToken.clear();
+    }
+    updateBusy();
+    setError(error);
+    emit requestFailed(request.requestId, error);
+}
+
+QNetworkRequest GoogleDriveApi::authorizedRequest(const QUrl &url) const
+{
+    QNetworkRequest request(url);
+    request.setRawHeader("Authorization", QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+    return request;
+}
+
+bool GoogleDriveApi::isStaleAuthorization(const QByteArray &authorization) const
+{
+    return authorization != QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8();
+}
+
+void GoogleDriveApi::refreshAccessToken()
+{
+    // Everything that hits a 401 meanwhile waits for this one refresh
+    if (m_refreshing)
+        return;
+
+    m_refreshing = true;
+    m_refreshTimer->stop();
+    m_oauth->refreshAccessToken(m_credentialStore->refreshToken());
+}
+
+void GoogleDriveApi::scheduleTokenRefresh()
+{
+    QDateTime expiry = m_credentialStore->tokenExpiry();
+    if (!expiry.isValid() || m_credentialStore->refreshToken().isEmpty()) {
+        m_refreshTimer->stop();
+        return;
+    }
+
+    qint64 delay = QDateTime::currentDateTimeUtc().msecsTo(expiry) - REFRESH_MARGIN * 1000;
+    m_refreshTimer->start(static_cast<int>(qBound<qint64>(0, delay, INT_MAX)));
+}
+
+void GoogleDriveApi::handleTokenRefreshed(const QString &accessToken, const QString &refreshToken, int expiresIn)
+{
+    m_refreshing = false;
+    m_credentialStore->updateAccessToken(accessToken, expiresIn, refreshToken);
+
+    QList<PendingRequest> requests;
+    requests.swap(m_parkedRequests);
+    for (const PendingRequest &request : requests) {
+        sendRequest(request);
+    }
+
+    QList<QPointer<QObject> > tasks;
+    tasks.swap(m_parkedTasks);
+    for (const QPointer<QObject> &task : tasks) {
+        if (task)
+            replayTask(task);
+    }
+
+    QList<ParkedClient> clients;
+    clients.swap(m_parkedClients);
+    for (const ParkedClient &parked : clients) {
+        if (parked.client)
+            parked.callback(QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+    }
+
+    updateBusy();
+}
+
+void GoogleDriveApi::handleTokenRefreshFailed(const QString &error)
+{
+    m_refreshing = false;
+    qWarning() << "Access token refresh failed:" << error;
+
+    QList<PendingRequest> requests;
+    requests.swap(m_parkedRequests);
+    for (const PendingRequest &request : requests) {
+        failRequest(request, error);
+    }
+
+    QList<QPointer<QObject> > tasks;
+    tasks.swap(m_parkedTasks);
+    for (const QPointer<QObject> &task : tasks) {
+        if (task)
+            failTask(task, error);
+    }
+
+    QList<ParkedClient> clients;
+    clients.swap(m_parkedClients);
+    for (const ParkedClient &parked : clients) {
+        if (parked.client)
+            parked.callback(QByteArray());
+    }
+
+    updateBusy();
+}
+
+void GoogleDriveApi::handleTaskAuthorizationExpired(const QByteArray &authorization)
+{
+    QObject *task = sender();
+    if (!task)
+        return;
+
+    if (isStaleAuthorization(authorization)) {
+        replayTask(task);
+    } else if (m_reauthorizedTasks.contains(task) || m_credentialStore->refreshToken().isEmpty()) {
+        // Rejected again right after a refresh; the grant itself is gone
+        failTask(task, "Authorization failed");
+    } else {
+        m_parkedTasks.append(task);
+        refreshAccessToken();
     }
 }
 
-void GoogleDriveApi::handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal)
+void GoogleDriveApi::authorize(QObject *client, const QByteArray &rejected,
+                               const std::function<void(const QByteArray&)> &callback)
 {
-    if (bytesTotal > 0) {
-        setDownloadProgress(static_cast<qreal>(bytesReceived) / bytesTotal);
+    const bool canRefresh = !m_credentialStore->refreshToken().isEmpty();
+    bool refresh;
+    if (!rejected.isEmpty() && !isStaleAuthorization(rejected)) {
+        // The current token itself was turned down
+        if (!canRefresh) {
+            callback(QByteArray());
+            return;
+        }
+        refresh = true;
+    } else {
+        // Same rule as sendRequest(): no requests with a token on its way out
+        refresh = m_refreshing || (m_credentialStore->tokenExpiresWithin(REFRESH_MARGIN) && canRefresh);
     }
+
+    if (!refresh) {
+        callback(QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+        return;
+    }
+
+    ParkedClient parked;
+    parked.client = client;
+    parked.callback = callback;
+    m_parkedClients.append(parked);
+    refreshAccessToken();
+}
+
+void GoogleDriveApi::replayTask(QObject *task)
+{
+    // Paused while waiting for the token; resuming starts it afresh
+    if (m_transfers->isPaused(task))
+        return;
+
+    m_reauthorizedTasks.insert(task);
+
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+        download->setRequest(authorizedRequest(download->request().url()));
+        download->start();
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+        upload->resume();
+    }
+}
+
+void GoogleDriveApi::failTask(QObject *task, const QString &error)
+{
+    const int requestId = m_taskRequests.take(task);
+    m_transfers->fail(task, error);
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+        download->abort();
+        releaseDownload(download);
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+        upload->abort();
+        releaseUpload(upload);
+    }
+    setError(error);
+    emit requestFailed(requestId, error);
+}
+
+void GoogleDriveApi::handleTransferCanceled(QObject *task)
+{
+    const int requestId = m_taskRequests.take(task);
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+        releaseDownload(download);
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+        releaseUpload(upload);
+    }
+    emit requestFailed(requestId, "Canceled");
+}
+
+void GoogleDriveApi::releaseDownload(DownloadTask *task)
+{
+    m_downloads.remove(task);
+    m_reauthorizedTasks.remove(task);
+    m_scheduler->cancel(task);
+    task->deleteLater();
+    updateBusy();
+}
+
+void GoogleDriveApi::releaseUpload(UploadTask *task)
+{
+    m_uploads.remove(task);
+    m_reauthorizedTasks.remove(task);
+    m_scheduler->cancel(task);
+    task->deleteLater();
+    updateBusy();
+}
+
+void GoogleDriveApi::handleFilesPage(const PendingRequest &request, const QJsonObject &response)
+{
+    QJsonArray files = response["files"].toArray();
+    QString nextPageToken = response["nextPageToken"].toString();
+    bool isLastPage = nextPageToken.isEmpty();
+
+    // Identical listings asked for while this one was in flight get the
+    // same pages
+    QList<PendingRequest> subscribers = m_followers.value(request.requestId);
+    subscribers.prepend(request);
+    // Anyone joining later would miss the pages handed out from here
+    if (!isLastPage && isSharedLeader(request))
+        m_pagingShares.insert(request.requestId);
+
+    // Nobody wants the rest of a superseded listing; stop paging it
+    bool wanted = isWanted(request);
+    bool complete = isLastPage && !isSuperseded(request.requestId);
+
+    // Ask for the next page before handing this one out so the round trip
+    // overlaps with whatever the receivers do with the current rows
+    if (!isLastPage && wanted) {
+        PendingRequest next = request;
+        next.attempt = 0;
+        next.reauthorized = false;
+        QUrlQuery urlQuery(next.url);
+        urlQuery.removeAllQueryItems("pageToken");
+        urlQuery.addQueryItem("pageToken", nextPageToken);
+        next.url.setQuery(urlQuery);
+        sendRequest(next);
+    }
+
+    QJsonArray results;
+    for (const PendingRequest &subscriber : subscribers) {
+        QJsonArray listing = collectFilesPage(subscriber, files, isLastPage);
+        if (subscriber.requestId == request.requestId) {
+            results = listing;
+        }
+    }
+
+    if (isLastPage || !wanted) {
+        // No more pages: drop the marks of those who canceled
+        for (const PendingRequest &subscriber : subscribers) {
+            m_modelRequests.remove(subscriber.requestId);
+            m_openListings.remove(subscriber.requestId);
+        }
+        m_followers.remove(request.requestId);
+        QJsonObject listing;
+        listing["files"] = results;
+        releaseShared(request, complete ? QJsonDocument(listing).toJson(QJsonDocument::Compact) : QByteArray());
+    }
+}
+
+QJsonArray GoogleDriveApi::collectFilesPage(const PendingRequest &request, const QJsonArray &files, bool isLastPage)
+{
+    // Stays marked while pages keep coming for others who share the
+    // listing, so nothing more is delivered for it
+    if (isSuperseded(request.requestId)) {
+        m_pagedResults.remove(request.requestId);
+        m_cachedResults.remove(request.requestId);
+        m_searchHits.remove(request.requestId);
+        return QJsonArray();
+    }
+
+    // Search pages leave out the cached hits already delivered
+    QJsonArray pageFiles = files;
+    auto hits = m_searchHits.constFind(request.requestId);
+    if (hits != m_searchHits.constEnd()) {
+        pageFiles = QJsonArray();
+        for (const QJsonValue &file : files) {
+            if (!hits->contains(file.toObject().value("id").toString()))
+                pageFiles.append(file);
+        }
+        if (isLastPage)
+            m_searchHits.remove(request.requestId);
+    }
+
+    QJsonArray &allFiles = m_pagedResults[request.requestId];
+    for (const QJsonValue &file : pageFiles) {
+        allFiles.append(file);
+    }
+
+    // While revalidating a cached listing the pages are collected and only
+    // pushed once complete, and only if something changed
+    if (!request.revalidating) {
+        deliverPage(request.requestId, pageFiles, isLastPage);
+    }
+
+    if (!isLastPage)
+        return QJsonArray();
+
+    QJsonArray results = m_pagedResults.take(request.requestId);
+
+    if (request.revalidating) {
+        QJsonArray cached = m_cachedResults.take(request.requestId);
+        if (results != cached) {
+            deliverPage(request.requestId, results, true);
+        }
+    }
+
+    // Followers and replays carry what the leader already stored
+    if (!request.cacheKey.isEmpty() && (request.shareKey.isEmpty() || isSharedLeader(request))) {
+        m_fileCache->storeFolderListing(request.cacheKey, results);
+    }
+
+    m_modelRequests.remove(request.requestId);
+    m_openListings.remove(request.requestId);
+
+    if (request.type == ListFiles) {
+        emit filesListed(request.requestId, results);
+    } else {
+        emit searchCompleted(request.requestId, results);
+    }
+    return results;
+}
+
+bool GoogleDriveApi::isSuperseded(int requestId) const
+{
+    // Mapped but null: replaced by a newer load, or the model was destroyed
+    auto it = m_modelRequests.constFind(requestId);
+    return it != m_modelRequests.constEnd() && it.value().isNull();
+}
+
+bool GoogleDriveApi::isWanted(const PendingRequest &request) const
+{
+    if (!isSuperseded(request.requestId))
+        return true;
+
+    const QList<PendingRequest> followers = m_followers.value(request.requestId);
+    for (const PendingRequest &follower : followers) {
+        if (!isSuperseded(follower.requestId))
+            return true;
+    }
+    return false;
+}
+
+void GoogleDriveApi::discardRequest(const PendingRequest &request)
+{
+    // Like failRequest, but quietly: everyone involved has stopped waiting
+    const QList<PendingRequest> followers = m_followers.take(request.requestId);
+    for (const PendingRequest &follower : followers) {
+        discardRequest(follower);
+    }
+    releaseShared(request, QByteArray());
+
+    m_pagedResults.remove(request.requestId);
+    m_cachedResults.remove(request.requestId);
+    m_searchHits.remove(request.requestId);
+    m_modelRequests.remove(request.requestId);
+    m_openListings.remove(request.requestId);
+}
+
+void GoogleDriveApi::deliverPage(int requestId, const QJsonArray &files, bool isLastPage)
+{
+    if (FileModel *model = m_modelRequests.value(requestId)) {
+        // Diffed against the current rows, so a refresh keeps delegates
+        // and scroll position
+        model->applyPage(requestId, files, isLastPage);
+    }
+    emit filesPageListed(requestId, files, isLastPage);
+}
+
+void GoogleDriveApi::updateTransferProgress()
+{
+    // Combined over all unfinished transfers, so parallel ones do not
+    // overwrite each other
+    setUploadProgress(m_transfers->progress(TransferManager::Upload));
+    setDownloadProgress(m_transfers->progress(TransferManager::Download));
+}
+
+void GoogleDriveApi::handleDownloadFinished(const QString &localPath)
+{
+    DownloadTask *task = qobject_cast<DownloadTask*>(sender());
+    if (!task)
+        return;
+
+    const int requestId = m_taskRequests.take(task);
+    releaseDownload(task);
+
+    m_fileCache->storeContent(task->fileId(), task->version(), localPath);
+
+    emit fileDownloaded(requestId, localPath);
+}
+
+void GoogleDriveApi::handleDownloadFailed(const QString &error)
+{
+    DownloadTask *task = qobject_cast<DownloadTask*>(sender());
+    if (!task)
+        return;
+
+    const int requestId = m_taskRequests.take(task);
+    releaseDownload(task);
+
+    setError(error);
+    emit requestFailed(requestId, error);
+}
+
+void GoogleDriveApi::handleUploadFinished(const QJsonObject &metadata)
+{
+    UploadTask *task = qobject_cast<UploadTask*>(sender());
+    if (!task)
+        return;
+
+    const int requestId = m_taskRequests.take(task);
+    releaseUpload(task);
+
+    m_freshResponses.clear();
+
+    emit fileUploaded(requestId, metadata);
+}
+
+void GoogleDriveApi::handleUploadFailed(const QString &error)
+{
+    UploadTask *task = qobject_cast<UploadTask*>(sender());
+    if (!task)
+        return;
+
+    const int requestId = m_taskRequests.take(task);
+    releaseUpload(task);
+
+    setError(error);
+    emit requestFailed(requestId, error);
+}
+
+void GoogleDriveApi::handleUploadListing(int requestId, const QJsonArray &files)
+{
+    for (QHash<int, UploadCheck>::iterator it = m_uploadChecks.begin(); it != m_uploadChecks.end(); ++it) {
+        if (it->listRequestId == requestId) {
+            it->listed = true;
+            it->listing = files;
+            finishUploadCheck(it.key());
+            return;
+        }
+    }
+}
+
+void GoogleDriveApi::handleContentRestored(const QString &localPath, bool restored)
+{
+    for (int i = 0; i < m_contentRestores.count(); ++i) {
+        if (m_contentRestores.at(i).localPath != localPath)
+            continue;
+
+        const DownloadCheck restore = m_contentRestores.takeAt(i);
+        if (restored) {
+            updateBusy();
+            emit fileDownloaded(restore.requestId, localPath);
+        } else {
+            fetchContent(restore.requestId, restore.fileId, localPath, m_fileCache->fileMetadata(restore.fileId));
+        }
+        return;
+    }
+}
+
+void GoogleDriveApi::handleDownloadMetadata(int requestId, const QJsonObject &metadata)
+{
+    if (!m_downloadChecks.contains(requestId))
+        return;
+
+    const DownloadCheck check = m_downloadChecks.take(requestId);
+    startDownload(check.requestId, check.fileId, check.localPath, metadata);
+}
+
+void GoogleDriveApi::handleDownloadMetadataFailed(int requestId, const QString &error)
+{
+    if (!m_downloadChecks.contains(requestId))
+        return;
+
+    // The part file is kept for a later attempt
+    const DownloadCheck check = m_downloadChecks.take(requestId);
+    updateBusy();
+    emit requestFailed(check.requestId, error);
+}
+
+void GoogleDriveApi::handleUploadListingFailed(int requestId)
+{
+    // Without the listing nothing can be ruled out; upload anyway
+    handleUploadListing(requestId, QJsonArray());
+}
+
+void GoogleDriveApi::handleUploadChecksum(const QString &localPath, const QString &md5)
+{
+    QList<int> ready;
+    for (QHash<int, UploadCheck>::iterator it = m_uploadChecks.begin(); it != m_uploadChecks.end(); ++it) {
+        if (it->localPath == localPath && !it->hashed) {
+            it->hashed = true;
+            it->md5 = md5;
+            ready.append(it.key());
+        }
+    }
+    for (int requestId : ready) {
+        finishUploadCheck(requestId);
+    }
+}
+
+bool GoogleDriveApi::isIdempotent(RequestType type)
+{
+    // Sending these twice would create a second folder, copy or permission
+    switch (type) {
+    case CreateFolder:
+    case Copy:
+    case Share:
+    case Batch:
+        return false;
+    default:
+        return true;
+    }
+}
+
+void GoogleDriveApi::updateBusy()
+{
+    setBusy(!m_pendingRequests.isEmpty() || m_scheduler->queueDepth(NetworkRequest::Interactive) > 0
+            || m_retryingRequests > 0 || !m_parkedRequests.isEmpty()
+            || !m_downloads.isEmpty() || !m_uploads.isEmpty()
+            || !m_uploadChecks.isEmpty() || !m_downloadChecks.isEmpty() || !m_contentRestores.isEmpty());
 }
 
 void GoogleDriveApi::setBusy(bool busy)
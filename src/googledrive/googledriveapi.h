@@ -6,9 +6,23 @@
 #include <QNetworkReply>
 #include <QJsonArray>
 #include <QJsonObject>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <functional>
+#include "../models/filemodel.h"
 #include "../storage/credentialstore.h"
+#include "../storage/filecache.h"
 
-class FileModel;
+class QTimer;
+class ChecksumEngine;
+class DownloadTask;
+class FolderTransfer;
+class NetworkRequest;
+class OAuthFlow;
+class RetryPolicy;
+class TransferManager;
+class UploadTask;
 
 class GoogleDriveApi : public QObject
 {
@@ -17,64 +31,146 @@ class GoogleDriveApi : public QObject
     Q_PROPERTY(QString error READ error NOTIFY errorChanged)
     Q_PROPERTY(qreal uploadProgress READ uploadProgress NOTIFY uploadProgressChanged)
     Q_PROPERTY(qreal downloadProgress READ downloadProgress NOTIFY downloadProgressChanged)
+    Q_PROPERTY(qint64 uploadChunkSize READ uploadChunkSize WRITE setUploadChunkSize NOTIFY uploadChunkSizeChanged)
+    Q_PROPERTY(int freshnessWindow READ freshnessWindow WRITE setFreshnessWindow NOTIFY freshnessWindowChanged)
 
 public:
-    explicit GoogleDriveApi(CredentialStore *credStore, QObject *parent = nullptr);
+    GoogleDriveApi(CredentialStore *credStore, FileCache *fileCache, QObject *parent = nullptr);
     ~GoogleDriveApi();
 
     bool busy() const { return m_busy; }
     QString error() const { return m_error; }
     qreal uploadProgress() const { return m_uploadProgress; }
     qreal downloadProgress() const { return m_downloadProgress; }
+    qint64 uploadChunkSize() const { return m_uploadChunkSize; }
+    void setUploadChunkSize(qint64 size);
 
-    // File operations
-    Q_INVOKABLE void listFiles(const QString &folderId = "root", const QString &query = "");
-    Q_INVOKABLE void getFileMetadata(const QString &fileId);
-    Q_INVOKABLE void downloadFile(const QString &fileId, const QString &localPath);
-    Q_INVOKABLE void uploadFile(const QString &localPath, const QString &parentId = "root");
-    Q_INVOKABLE void createFolder(const QString &name, const QString &parentId = "root");
-    Q_INVOKABLE void deleteFile(const QString &fileId);
-    Q_INVOKABLE void renameFile(const QString &fileId, const QString &newName);
-    Q_INVOKABLE void moveFile(const QString &fileId, const QString &newParentId);
-    Q_INVOKABLE void copyFile(const QString &fileId, const QString &newParentId = "");
-    Q_INVOKABLE void starFile(const QString &fileId, bool starred);
-    Q_INVOKABLE void shareFile(const QString &fileId, const QString &email, const QString &role);
-    Q_INVOKABLE void searchFiles(const QString &query);
-    Q_INVOKABLE void getChanges(const QString &pageToken = "");
-    Q_INVOKABLE void getAbout();
+    // Milliseconds for which a completed read is answered again from
+    // memory instead of the network; 0 turns this off
+    int freshnessWindow() const { return m_freshnessWindow; }
+    void setFreshnessWindow(int msecs);
+
+    // Shared with other users of the connection, e.g. the thumbnail provider
+    NetworkRequest *scheduler() const { return m_scheduler; }
+    RetryPolicy *retryPolicy() const { return m_retryPolicy; }
+    TransferManager *transfers() const { return m_transfers; }
+    ChecksumEngine *checksums() const { return m_checksums; }
+    // For users of the connection that send their own requests. Calls back
+    // with the Authorization header to send once any token refresh under
+    // way is done. After a 401, pass the rejected header to have the token
+    // refreshed first. An empty header means the account cannot be
+    // authorized.
+    void authorize(QObject *client, const QByteArray &rejected,
+                   const std::function<void(const QByteArray&)> &callback);
+    // Where Drive requests go instead of Google's servers, e.g. a local
+    // stand-in in tests
+    void setApiUrl(const QString &url) { m_apiUrl = url; }
+    void setBatchUrl(const QString &url) { m_batchUrl = url; }
+    // A getChanges() call now would join the run in progress
+    bool fetchingChanges() const { return m_syncRequestId != 0; }
+
+    // File operations. Each returns a request id that the matching result
+    // signal, or requestFailed(), carries.
+    Q_INVOKABLE int listFiles(const QString &folderId = "root", const QString &query = "", int pageSize = 100);
+    Q_INVOKABLE int getFileMetadata(const QString &fileId);
+    Q_INVOKABLE int downloadFile(const QString &fileId, const QString &localPath);
+    // Nothing is sent if the folder already holds a file of the same name
+    // and content; uploadSkipped() is emitted instead of fileUploaded()
+    Q_INVOKABLE int uploadFile(const QString &localPath, const QString &parentId = "root");
+    // Replaces the content of fileId, keeping its id, name and parents;
+    // fileUploaded() carries the new metadata
+    Q_INVOKABLE int updateFile(const QString &fileId, const QString &localPath);
+    Q_INVOKABLE void resumeUploads();
+    // Whole trees; see FolderTransfer. folderProgress() counts files as
+    // they finish, and requestFailed() reports any that did not make it.
+    Q_INVOKABLE int uploadFolder(const QString &localDir, const QString &parentId = "root");
+    Q_INVOKABLE int downloadFolder(const QString &folderId, const QString &localDir);
+    Q_INVOKABLE int createFolder(const QString &name, const QString &parentId = "root");
+    Q_INVOKABLE int deleteFile(const QString &fileId);
+    // Recoverable from the Drive trash; also answered by fileDeleted()
+    Q_INVOKABLE int trashFile(const QString &fileId);
+    Q_INVOKABLE int renameFile(const QString &fileId, const QString &newName);
+    Q_INVOKABLE int moveFile(const QString &fileId, const QString &newParentId);
+    Q_INVOKABLE int copyFile(const QString &fileId, const QString &newParentId = "");
+    Q_INVOKABLE int starFile(const QString &fileId, bool starred);
+    Q_INVOKABLE int shareFile(const QString &fileId, const QString &email, const QString &role);
+    // Cached names matching query come first, then the server fills in
+    // whatever the cache does not know about. Pages continue until every
+    // match is listed.
+    Q_INVOKABLE int searchFiles(const QString &query, int pageSize = 50);
+    // Cached names only; answered at once without touching the network
+    Q_INVOKABLE int searchLocal(const QString &query, int limit = 50);
+    Q_INVOKABLE int getChanges(const QString &pageToken = "");
+    Q_INVOKABLE int getAbout();
+
+    // Lists a folder straight into model. A later load for the same model
+    // supersedes this one; pages of superseded listings, or of listings
+    // whose model is gone, are dropped.
+    Q_INVOKABLE int loadFolder(FileModel *model, const QString &folderId = "root");
+
+    // Calls made between these are sent together through the batch
+    // endpoint, up to 100 per request; results still arrive per call
+    Q_INVOKABLE void beginBatch();
+    Q_INVOKABLE void commitBatch();
+    // Drops a running listing or search nobody waits for any more: its
+    // reply is aborted unless an identical read shares it, and no further
+    // signals are emitted for it
+    Q_INVOKABLE void cancelRequest(int requestId);
+    Q_INVOKABLE void deleteFiles(const QStringList &fileIds);
 
 signals:
     void busyChanged();
     void errorChanged();
     void uploadProgressChanged();
     void downloadProgressChanged();
+    void uploadChunkSizeChanged();
+    void freshnessWindowChanged();
 
-    void filesListed(const QJsonArray &files);
-    void fileMetadataReceived(const QJsonObject &metadata);
-    void fileDownloaded(const QString &localPath);
-    void fileUploaded(const QJsonObject &metadata);
-    void folderCreated(const QJsonObject &metadata);
-    void fileDeleted(const QString &fileId);
-    void fileRenamed(const QJsonObject &metadata);
-    void fileMoved(const QJsonObject &metadata);
-    void fileCopied(const QJsonObject &metadata);
-    void fileStarred(const QString &fileId, bool starred);
-    void fileShared(const QString &fileId);
-    void searchCompleted(const QJsonArray &results);
-    void changesReceived(const QJsonArray &changes, const QString &newPageToken);
-    void aboutReceived(const QJsonObject &about);
+    void filesListed(int requestId, const QJsonArray &files);
+    void filesPageListed(int requestId, const QJsonArray &files, bool isLastPage);
+    void fileMetadataReceived(int requestId, const QJsonObject &metadata);
+    void fileDownloaded(int requestId, const QString &localPath);
+    void fileUploaded(int requestId, const QJsonObject &metadata);
+    // metadata is of the file already in Drive
+    void uploadSkipped(int requestId, const QJsonObject &metadata);
+    void folderUploaded(int requestId, const QJsonObject &metadata);
+    void folderDownloaded(int requestId, const QString &localDir);
+    void folderProgress(int requestId, int filesDone, int filesTotal);
+    void folderCreated(int requestId, const QJsonObject &metadata);
+    void fileDeleted(int requestId, const QString &fileId);
+    void fileRenamed(int requestId, const QJsonObject &metadata);
+    void fileMoved(int requestId, const QJsonObject &metadata);
+    void fileCopied(int requestId, const QJsonObject &metadata);
+    void fileStarred(int requestId, const QString &fileId, bool starred);
+    void fileShared(int requestId, const QString &fileId);
+    void searchCompleted(int requestId, const QJsonArray &results);
+    void changesReceived(int requestId, const QJsonArray &changes, const QString &newPageToken);
+    void aboutReceived(int requestId, const QJsonObject &about);
+    void requestFailed(int requestId, const QString &error);
 
 private slots:
     void handleNetworkReply();
-    void handleUploadProgress(qint64 bytesSent, qint64 bytesTotal);
-    void handleDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
+    void updateTransferProgress();
+    void handleTransferCanceled(QObject *task);
+    void handleDownloadFinished(const QString &localPath);
+    void handleDownloadFailed(const QString &error);
+    void handleUploadFinished(const QJsonObject &metadata);
+    void handleUploadFailed(const QString &error);
+    void handleUploadListing(int requestId, const QJsonArray &files);
+    void handleUploadListingFailed(int requestId);
+    void handleUploadChecksum(const QString &localPath, const QString &md5);
+    void handleContentRestored(const QString &localPath, bool restored);
+    void handleDownloadMetadata(int requestId, const QJsonObject &metadata);
+    void handleDownloadMetadataFailed(int requestId, const QString &error);
+    void handleTokenRefreshed(const QString &accessToken, const QString &refreshToken, int expiresIn);
+    void handleTokenRefreshFailed(const QString &error);
+    void handleTaskAuthorizationExpired(const QByteArray &authorization);
+    void scheduleTokenRefresh();
 
 private:
     enum RequestType {
         ListFiles,
         GetMetadata,
-        Download,
-        Upload,
         CreateFolder,
         Delete,
         Rename,
@@ -84,27 +180,156 @@ private:
         Share,
         Search,
         Changes,
-        About
+        StartPageToken,
+        RootFolder,
+        About,
+        Batch
+    };
+
+    struct PendingRequest {
+        PendingRequest()
+            : type(GetMetadata), requestId(0), revalidating(false), attempt(0), reauthorized(false) {}
+
+        RequestType type;
+        int requestId;
+        QUrl url;
+        QByteArray data;
+        QString method;
+        QByteArray contentType; // defaults to JSON when there is a body
+        QString cacheKey;       // folder id the listing is cached under
+        bool revalidating;      // cached rows were already delivered
+        int attempt;            // retries so far, see RetryPolicy
+        bool reauthorized;      // already replayed after a 401
+        QString shareKey;       // identical reads share one reply, see shareRequest
+    };
+
+    // An upload waiting for its checksum and the listing of its folder
+    struct UploadCheck {
+        UploadCheck() : listRequestId(0), listed(false), hashed(false) {}
+
+        QString localPath;
+        QString parentId;
+        int listRequestId;
+        bool listed;
+        bool hashed;
+        QJsonArray listing;
+        QString md5;
+    };
+
+    // A download waiting for current metadata before it resumes a part
+    // file, or for the content cache to place its copy
+    struct DownloadCheck {
+        int requestId;
+        QString fileId;
+        QString localPath;
+    };
+
+    // Waits with the parked requests for the token refresh
+    struct ParkedClient {
+        QPointer<QObject> client;
+        std::function<void(const QByteArray&)> callback;
+    };
+
+    struct FreshResponse {
+        qint64 received;
+        QByteArray data;
     };
 
-    void makeRequest(const QUrl &url, RequestType type, const QByteArray &data = QByteArray(), const QString &method = "GET");
+    int makeRequest(const QUrl &url, RequestType type, const QByteArray &data = QByteArray(),
+                    const QString &method = "GET", int requestId = 0);
+    void sendRequest(const PendingRequest &pending);
+    QNetworkReply *startRequest(const PendingRequest &pending);
+    void failRequest(const PendingRequest &request, const QString &error);
+    void dispatchResponse(const PendingRequest &request, const QByteArray &data);
+    bool shareRequest(PendingRequest &pending);
+    bool isSharedLeader(const PendingRequest &request) const;
+    void dispatchShared(const PendingRequest &request, const QByteArray &data);
+    void releaseShared(const PendingRequest &request, const QByteArray &data);
+    void sendBatch(const QList<PendingRequest> &requests);
+    void handleBatchResponse(const PendingRequest &request, const QByteArray &contentType,
+                             const QByteArray &authorization, const QByteArray &data);
+    QNetworkRequest authorizedRequest(const QUrl &url) const;
+    bool isStaleAuthorization(const QByteArray &authorization) const;
+    void refreshAccessToken();
+    void replayTask(QObject *task);
+    void failTask(QObject *task, const QString &error);
+    void releaseDownload(DownloadTask *task);
+    void releaseUpload(UploadTask *task);
+    void startUpload(int requestId, const QString &localPath, const QString &parentId,
+                     const QString &fileId = QString());
+    void finishUploadCheck(int requestId);
+    void fetchContent(int requestId, const QString &fileId, const QString &localPath,
+                      const QJsonObject &metadata);
+    void startDownload(int requestId, const QString &fileId, const QString &localPath,
+                       const QJsonObject &metadata);
+    void trackFolderTransfer(FolderTransfer *transfer, int requestId);
+    void handleFilesPage(const PendingRequest &request, const QJsonObject &response);
+    QJsonArray collectFilesPage(const PendingRequest &request, const QJsonArray &files, bool isLastPage);
+    bool isSuperseded(int requestId) const;
+    bool isWanted(const PendingRequest &request) const;
+    void discardRequest(const PendingRequest &request);
+    void deliverPage(int requestId, const QJsonArray &files, bool isLastPage);
+    void continueSync();
+    void handleChangesPage(const PendingRequest &request, const QJsonObject &response);
     void setBusy(bool busy);
     void setError(const QString &error);
     void setUploadProgress(qreal progress);
     void setDownloadProgress(qreal progress);
+    void updateBusy();
+    static bool isIdempotent(RequestType type);
     QString buildQuery(const QString &query);
 
     QNetworkAccessManager *m_networkManager;
+    NetworkRequest *m_scheduler;
+    RetryPolicy *m_retryPolicy;
+    TransferManager *m_transfers;
+    ChecksumEngine *m_checksums;
+    OAuthFlow *m_oauth;
+    QTimer *m_refreshTimer;
+    QString m_apiUrl;
+    QString m_batchUrl;
     CredentialStore *m_credentialStore;
+    FileCache *m_fileCache;
     QString m_error;
     qreal m_uploadProgress;
     qreal m_downloadProgress;
     bool m_busy;
-    QHash<QNetworkReply*, RequestType> m_pendingRequests;
-    QHash<QNetworkReply*, QString> m_downloadPaths;
+    QHash<QNetworkReply*, PendingRequest> m_pendingRequests;
+    QHash<int, QJsonArray> m_pagedResults;
+    QHash<int, QJsonArray> m_cachedResults;
+    QHash<int, QSet<QString> > m_searchHits;   // ids already shown from the cache
+    int m_nextRequestId;
+    int m_syncRequestId;
+    QString m_syncPageToken;
+    int m_retryingRequests;
+    bool m_refreshing;
+    QList<PendingRequest> m_parkedRequests;
+    QList<QPointer<QObject> > m_parkedTasks;
+    QSet<QObject*> m_reauthorizedTasks;
+    QList<ParkedClient> m_parkedClients;
+    int m_batchDepth;
+    QList<PendingRequest> m_batchedRequests;
+    QHash<int, QList<PendingRequest> > m_batches;
+    QSet<DownloadTask*> m_downloads;
+    QSet<UploadTask*> m_uploads;
+    QHash<int, UploadCheck> m_uploadChecks;
+    QHash<int, DownloadCheck> m_downloadChecks;     // by metadata request id
+    QList<DownloadCheck> m_contentRestores;
+    QHash<QObject*, int> m_taskRequests;
+    QHash<int, QPointer<FileModel> > m_modelRequests;
+    QSet<int> m_openListings;                   // listings and searches still paging
+    QHash<QString, int> m_sharedRequests;
+    QHash<int, QList<PendingRequest> > m_followers;
+    QSet<int> m_pagingShares;                   // leaders past their first page
+    QHash<QString, FreshResponse> m_freshResponses;
+    qint64 m_uploadChunkSize;
+    int m_freshnessWindow;
 
     static const QString API_BASE_URL;
     static const QString UPLOAD_URL;
+    static const int MAX_PAGE_SIZE;
+    static const int REFRESH_MARGIN;
+    static const int FRESHNESS_WINDOW;
 };
 
 #endif // GOOGLEDRIVEAPI_H
@@ -397,6 +397,7 @@ void OAuthFlow::handleTokenResponse()
 
     QString accessToken = response["access_token"].toString();
     QString refreshToken = response["refresh_token"].toString();
+    int expiresIn = response["expires_in"].toInt();
 
     if (accessToken.isEmpty()) {
         setError("No access token received");
@@ -408,7 +409,7 @@ void OAuthFlow::handleTokenResponse()
     qDebug() << "OAuth authentication succeeded!";
 
     setIsAuthenticating(false);
-    emit authenticationSucceeded(accessToken, refreshToken);
+    emit authenticationSucceeded(accessToken, refreshToken, expiresIn);
 }
 
 void OAuthFlow::sendResponseToClient(QTcpSocket *socket, const QString &message)
@@ -28,7 +28,7 @@ public:
 signals:
     void isAuthenticatingChanged();
     void errorChanged();
-    void authenticationSucceeded(const QString &accessToken, const QString &refreshToken);
+    void authenticationSucceeded(const QString &accessToken, const QString &refreshToken, int expiresIn);
     void authenticationFailed(const QString &error);
 
 private slots:
@@ -0,0 +1,191 @@
+#include "searchsession.h"
+#include <QDateTime>
+#include <QJsonObject>
+#include "../storage/searchindex.h"
+
+// Typing pause before the server is asked
+const int SearchSession::DEBOUNCE_DELAY = 300;
+const int SearchSession::MAX_ANSWERS = 20;
+const int SearchSession::ANSWER_LIFETIME = 2 * 60 * 1000;
+
+SearchSession::SearchSession(QObject *parent)
+    : QObject(parent)
+    , m_model(new FileModel(this))
+    , m_requestId(0)
+    , m_localRequestId(0)
+    , m_nextPageId(-2)
+    , m_searching(false)
+{
+    m_debounceTimer.setSingleShot(true);
+    m_debounceTimer.setInterval(DEBOUNCE_DELAY);
+    connect(&m_debounceTimer, &QTimer::timeout, this, &SearchSession::startSearch);
+}
+
+SearchSession::~SearchSession()
+{
+    // Leaving the page should not leave a search paging on
+    if (m_api && m_requestId != 0)
+        m_api->cancelRequest(m_requestId);
+}
+
+void SearchSession::setApi(GoogleDriveApi *api)
+{
+    if (m_api == api)
+        return;
+
+    cancel();
+    m_debounceTimer.stop();
+    updateSearching();
+    if (m_api)
+        disconnect(m_api, nullptr, this, nullptr);
+
+    m_api = api;
+    if (m_api) {
+        connect(m_api, &GoogleDriveApi::filesPageListed, this, &SearchSession::handleFilesPage);
+        connect(m_api, &GoogleDriveApi::searchCompleted, this, &SearchSession::handleSearchCompleted);
+        connect(m_api, &GoogleDriveApi::requestFailed, this, &SearchSession::handleRequestFailed);
+    }
+    emit apiChanged();
+}
+
+void SearchSession::setQuery(const QString &query)
+{
+    if (query == m_query)
+        return;
+
+    m_query = query;
+    emit queryChanged();
+
+    // Case, accents and surrounding spaces do not change the answer
+    const QString term = SearchIndex::fold(query.trimmed());
+    if (term == m_term)
+        return;
+
+    m_term = term;
+    m_localRequestId = 0;
+    m_debounceTimer.stop();
+    cancel();
+
+    if (term.isEmpty()) {
+        m_model->clear();
+    } else if (!narrow(term) && m_api) {
+        m_localRequestId = m_api->searchLocal(query);
+        m_debounceTimer.start();
+    }
+    updateSearching();
+}
+
+void SearchSession::searchNow()
+{
+    if (m_debounceTimer.isActive()) {
+        m_debounceTimer.stop();
+        startSearch();
+    }
+}
+
+void SearchSession::startSearch()
+{
+    if (!m_api || m_term.isEmpty())
+        return;
+
+    // Pages of the server search start with the same cached names, so a
+    // late local answer would only repaint what is already there
+    m_localRequestId = 0;
+    m_requestId = m_api->searchFiles(m_query);
+    m_requestTerm = m_term;
+    updateSearching();
+}
+
+void SearchSession::handleFilesPage(int requestId, const QJsonArray &files, bool isLastPage)
+{
+    if (requestId != 0 && (requestId == m_requestId || requestId == m_localRequestId))
+        m_model->applyPage(requestId, files, isLastPage);
+}
+
+void SearchSession::handleSearchCompleted(int requestId, const QJsonArray &results)
+{
+    if (requestId == 0 || requestId != m_requestId)
+        return;
+
+    remember(m_requestTerm, results, QDateTime::currentMSecsSinceEpoch());
+    m_requestId = 0;
+    updateSearching();
+}
+
+void SearchSession::handleRequestFailed(int requestId)
+{
+    if (requestId == 0 || requestId != m_requestId)
+        return;
+
+    m_requestId = 0;
+    updateSearching();
+}
+
+void SearchSession::cancel()
+{
+    if (m_requestId == 0)
+        return;
+
+    if (m_api)
+        m_api->cancelRequest(m_requestId);
+    m_requestId = 0;
+}
+
+bool SearchSession::narrow(const QString &term)
+{
+    // Every name containing term also contains any prefix of it, so a
+    // complete answer for a prefix holds all of this one's results
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QString prefix;
+    for (QHash<QString, Answer>::const_iterator it = m_answers.constBegin(); it != m_answers.constEnd(); ++it) {
+        if (now - it->received < ANSWER_LIFETIME && it.key().length() > prefix.length() && term.startsWith(it.key()))
+            prefix = it.key();
+    }
+    if (prefix.isEmpty())
+        return false;
+
+    const Answer answer = m_answers.value(prefix);
+    if (prefix == term) {
+        showPage(answer.files);
+        return true;
+    }
+
+    QJsonArray files;
+    for (const QJsonValue &file : answer.files) {
+        if (SearchIndex::fold(file.toObject().value("name").toString()).contains(term))
+            files.append(file);
+    }
+    showPage(files);
+    remember(term, files, answer.received);
+    return true;
+}
+
+void SearchSession::showPage(const QJsonArray &files)
+{
+    // Ids of its own, below anything the API hands out, so the model
+    // takes this as a fresh listing
+    m_model->applyPage(m_nextPageId--, files, true);
+}
+
+void SearchSession::remember(const QString &term, const QJsonArray &files, qint64 received)
+{
+    Answer answer;
+    answer.files = files;
+    answer.received = received;
+    m_answers.insert(term, answer);
+
+    m_answerOrder.removeAll(term);
+    m_answerOrder.append(term);
+    while (m_answerOrder.count() > MAX_ANSWERS) {
+        m_answers.remove(m_answerOrder.takeFirst());
+    }
+}
+
+void SearchSession::updateSearching()
+{
+    const bool searching = m_requestId != 0 || m_debounceTimer.isActive();
+    if (m_searching != searching) {
+        m_searching = searching;
+        emit searchingChanged();
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef SEARCHSESSION_H
+#define SEARCHSESSION_H
+
+#include <QObject>
+#include <QHash>
+#include <QJsonArray>
+#include <QPointer>
+#include <QStringList>
+#include <QTimer>
+#include "googledriveapi.h"
+#include "../models/filemodel.h"
+
+// Search as you type for one search page. Every keystroke shows cached
+// names at once; the server is asked only once typing pauses, and a query
+// that is no longer current has its request canceled, so a slow answer
+// can never replace newer results. Complete server answers are kept for a
+// while: a longer query that starts with one of them is narrowed from it
+// without any request.
+class SearchSession : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(GoogleDriveApi *api READ api WRITE setApi NOTIFY apiChanged)
+    Q_PROPERTY(QString query READ query WRITE setQuery NOTIFY queryChanged)
+    Q_PROPERTY(FileModel *model READ model CONSTANT)
+    Q_PROPERTY(bool searching READ searching NOTIFY searchingChanged)
+
+public:
+    explicit SearchSession(QObject *parent = nullptr);
+    ~SearchSession();
+
+    GoogleDriveApi *api() const { return m_api; }
+    void setApi(GoogleDriveApi *api);
+
+    QString query() const { return m_query; }
+    void setQuery(const QString &query);
+
+    FileModel *model() const { return m_model; }
+    // Also while waiting for typing to pause
+    bool searching() const { return m_searching; }
+
+    // Skips the typing pause, e.g. when the search is accepted
+    Q_INVOKABLE void searchNow();
+
+signals:
+    void apiChanged();
+    void queryChanged();
+    void searchingChanged();
+
+private slots:
+    void handleFilesPage(int requestId, const QJsonArray &files, bool isLastPage);
+    void handleSearchCompleted(int requestId, const QJsonArray &results);
+    void handleRequestFailed(int requestId);
+    void startSearch();
+
+private:
+    struct Answer {
+        QJsonArray files;
+        qint64 received;
+    };
+
+    void cancel();
+    bool narrow(const QString &term);
+    void showPage(const QJsonArray &files);
+    void remember(const QString &term, const QJsonArray &files, qint64 received);
+    void updateSearching();
+
+    QPointer<GoogleDriveApi> m_api;
+    FileModel *m_model;
+    QTimer m_debounceTimer;
+    QString m_query;
+    QString m_term;             // folded, see SearchIndex::fold
+    int m_requestId;            // server search
+    QString m_requestTerm;
+    int m_localRequestId;       // cached names
+    int m_nextPageId;
+    bool m_searching;
+    QHash<QString, Answer> m_answers;   // by folded term
+    QStringList m_answerOrder;
+
+    static const int DEBOUNCE_DELAY;
+    static const int MAX_ANSWERS;
+    static const int ANSWER_LIFETIME;
+};
+
+#endif // SEARCHSESSION_H
@@ -0,0 +1,718 @@
+#include "syncengine.h"
+#include "googledriveapi.h"
+#include "../network/downloadtask.h"
+#include "../storage/checksumengine.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QDebug>
+
+// Lets a burst of file system events settle into one pass
+const int SyncEngine::PASS_DELAY = 1000;
+// The changes feed has no push; also catches in-place writes, which
+// directory watches do not report
+const int SyncEngine::POLL_INTERVAL = 60 * 1000;
+const int SyncEngine::SAVE_DELAY = 2000;
+// Per operation, counted over poll intervals
+const int SyncEngine::MAX_ATTEMPTS = 3;
+const int SyncEngine::LIST_PAGE_SIZE = 1000;
+
+namespace {
+
+const QString FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
+// Docs, Sheets and the like have no content to sync
+const QString GOOGLE_APPS_MIME_PREFIX = "application/vnd.google-apps.";
+
+} // namespace
+
+SyncEngine::SyncEngine(GoogleDriveApi *api, QObject *parent)
+    : QObject(parent)
+    , m_api(api)
+    , m_journal(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/syncjournal.json")
+    , m_changesRequest(0)
+    , m_syncing(false)
+    , m_conflicts(0)
+{
+    m_passTimer.setSingleShot(true);
+    m_passTimer.setInterval(PASS_DELAY);
+    connect(&m_passTimer, &QTimer::timeout, this, &SyncEngine::runPass);
+
+    m_pollTimer.setInterval(POLL_INTERVAL);
+    connect(&m_pollTimer, &QTimer::timeout, this, &SyncEngine::poll);
+
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(SAVE_DELAY);
+    connect(&m_saveTimer, &QTimer::timeout, this, [this]() {
+        m_journal.save();
+    });
+
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged, this, &SyncEngine::handleDirectoryChanged);
+    connect(m_api->checksums(), &ChecksumEngine::checksumReady, this, &SyncEngine::handleChecksum);
+    connect(m_api, &GoogleDriveApi::changesReceived, this, &SyncEngine::handleChangesReceived);
+    connect(m_api, &GoogleDriveApi::filesListed, this, &SyncEngine::handleFilesListed);
+    connect(m_api, &GoogleDriveApi::fileDownloaded, this, &SyncEngine::handleFileDownloaded);
+    connect(m_api, &GoogleDriveApi::fileUploaded, this, &SyncEngine::handleFileUploaded);
+    connect(m_api, &GoogleDriveApi::uploadSkipped, this, &SyncEngine::handleFileUploaded);
+    connect(m_api, &GoogleDriveApi::folderCreated, this, &SyncEngine::handleFolderCreated);
+    connect(m_api, &GoogleDriveApi::fileDeleted, this, &SyncEngine::handleFileDeleted);
+    connect(m_api, &GoogleDriveApi::requestFailed, this, &SyncEngine::handleRequestFailed);
+
+    const QString localPath = QSettings().value("sync/localPath").toString();
+    if (!localPath.isEmpty()) {
+        m_journal.load();
+        if (!m_journal.folderId().isEmpty() && m_journal.contains("")) {
+            m_localPath = localPath;
+            start();
+        }
+    }
+}
+
+SyncEngine::~SyncEngine()
+{
+    if (m_saveTimer.isActive()) {
+        m_journal.save();
+    }
+}
+
+void SyncEngine::pin(const QString &localPath, const QString &folderId)
+{
+    if (localPath.isEmpty() || folderId.isEmpty())
+        return;
+
+    stop();
+    m_localPath = QDir::cleanPath(localPath);
+    QSettings().setValue("sync/localPath", m_localPath);
+    if (!QDir().mkpath(m_localPath)) {
+        qWarning() << "Cannot create" << m_localPath;
+    }
+
+    m_journal.reset(folderId);
+    journalChanged();
+
+    // The local side is scanned once the listing is in, so files on both
+    // sides are compared rather than uploaded twice
+    listRemote(QString(""));
+    start();
+    emit pinnedChanged();
+}
+
+void SyncEngine::unpin()
+{
+    if (!active())
+        return;
+
+    stop();
+    m_localPath.clear();
+    QSettings().remove("sync/localPath");
+    m_saveTimer.stop();
+    QFile::remove(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/syncjournal.json");
+    m_journal.reset(QString());
+    emit pinnedChanged();
+}
+
+void SyncEngine::syncNow()
+{
+    if (active())
+        poll();
+}
+
+void SyncEngine::start()
+{
+    // Nothing says what changed locally while we were not watching, so
+    // every folder is looked at once; that is stats only, content is
+    // hashed just where size or mtime moved
+    const QStringList folders = m_journal.folders();
+    for (const QString &folder : folders) {
+        watch(folder);
+        markDirty(folder);
+    }
+
+    m_pollTimer.start();
+    fetchChanges();
+}
+
+void SyncEngine::stop()
+{
+    m_pollTimer.stop();
+    m_passTimer.stop();
+    if (!m_watcher.directories().isEmpty()) {
+        m_watcher.removePaths(m_watcher.directories());
+    }
+
+    // Transfers already handed out finish on their own; their results are
+    // no longer ours
+    m_changesRequest = 0;
+    m_remoteChanges.clear();
+    m_dirty.clear();
+    m_pending.clear();
+    m_retries.clear();
+    m_busy.clear();
+    m_verifications.clear();
+    if (m_saveTimer.isActive()) {
+        m_saveTimer.stop();
+        m_journal.save();
+    }
+    updateSyncing();
+}
+
+void SyncEngine::poll()
+{
+    const QList<Pending> retries = m_retries;
+    m_retries.clear();
+    for (const Pending &retry : retries) {
+        if (retry.operation == List) {
+            listRemote(retry.path, retry.attempt);
+        } else if (retry.operation == Download) {
+            download(retry.path, retry.fileId, retry.md5, retry.attempt);
+        } else {
+            markDirty(SyncJournal::parentPath(retry.path));
+        }
+    }
+
+    const QStringList folders = m_journal.folders();
+    for (const QString &folder : folders) {
+        markDirty(folder);
+    }
+    fetchChanges();
+}
+
+void SyncEngine::fetchChanges()
+{
+    if (!active() || m_changesRequest != 0)
+        return;
+
+    // Joining a run started from another token could skip changes that
+    // came before it
+    if (m_api->fetchingChanges()) {
+        QTimer::singleShot(PASS_DELAY, this, &SyncEngine::fetchChanges);
+        return;
+    }
+
+    m_changesRequest = m_api->getChanges(m_journal.changesToken());
+    updateSyncing();
+}
+
+void SyncEngine::handleChangesReceived(int requestId, const QJsonArray &changes, const QString &newPageToken)
+{
+    if (requestId != m_changesRequest)
+        return;
+    m_changesRequest = 0;
+
+    for (const QJsonValue &change : changes) {
+        m_remoteChanges.append(change.toObject());
+    }
+    m_journal.setChangesToken(newPageToken);
+    journalChanged();
+    runPass();
+}
+
+void SyncEngine::runPass()
+{
+    if (!active())
+        return;
+
+    // Remote first: a file edited on both sides must be seen as a conflict
+    // before the local scan would upload it
+    const QList<QJsonObject> changes = m_remoteChanges;
+    m_remoteChanges.clear();
+    for (const QJsonObject &change : changes) {
+        applyRemoteChange(change);
+    }
+
+    const QSet<QString> dirty = m_dirty;
+    m_dirty.clear();
+    for (const QString &path : dirty) {
+        scanLocal(path);
+    }
+
+    updateSyncing();
+}
+
+void SyncEngine::applyRemoteChange(const QJsonObject &change)
+{
+    const QString fileId = change["fileId"].toString();
+    if (fileId == m_journal.folderId())
+        return;
+
+    const QJsonObject file = change["file"].toObject();
+    QString path;
+    const bool tracked = m_journal.findFile(fileId, &path);
+
+    // Where it is now, if still inside the synced tree
+    QString target;
+    QString name;
+    bool inside = false;
+    if (!change["removed"].toBool() && !file["trashed"].toBool() && remoteName(file, &name)) {
+        const QJsonArray parents = file["parents"].toArray();
+        for (const QJsonValue &parent : parents) {
+            QString parentPath;
+            if (m_journal.findFile(parent.toString(), &parentPath) && m_journal.entry(parentPath).folder) {
+                target = SyncJournal::childPath(parentPath, name);
+                inside = true;
+                break;
+            }
+        }
+    }
+
+    // Our own transfer is still out for this path; look again afterwards
+    if ((tracked && m_busy.contains(path)) || (inside && m_busy.contains(target))) {
+        m_remoteChanges.append(change);
+        return;
+    }
+
+    if (tracked && !inside) {
+        removeLocal(path);
+        return;
+    }
+    if (!inside)
+        return;
+
+    if (tracked && path != target) {
+        moveLocal(path, target);
+    }
+    applyRemote(target, file);
+}
+
+void SyncEngine::applyRemote(const QString &path, const QJsonObject &file)
+{
+    if (m_busy.contains(path))
+        return;
+
+    const QString fileId = file["id"].toString();
+    const QString absolute = absolutePath(path);
+    const bool tracked = m_journal.contains(path);
+    const SyncJournal::Entry entry = m_journal.entry(path);
+
+    if (file["mimeType"].toString() == FOLDER_MIME_TYPE) {
+        if (tracked)
+            return;
+        if (!QDir().mkpath(absolute)) {
+            qWarning() << "Cannot create" << absolute;
+            return;
+        }
+        SyncJournal::Entry folder;
+        folder.fileId = fileId;
+        folder.folder = true;
+        m_journal.insert(path, folder);
+        journalChanged();
+        watch(path);
+        // What it holds arrived without changes of its own, e.g. when the
+        // folder was moved in from elsewhere
+        listRemote(path);
+        return;
+    }
+
+    const QString md5 = file["md5Checksum"].toString();
+    if (tracked && entry.fileId == fileId && entry.md5 == md5)
+        return;
+
+    const QFileInfo info(absolute);
+    if (info.isDir()) {
+        qWarning() << "Not syncing" << absolute << "- a folder locally, a file in Drive";
+        return;
+    }
+    if (!info.exists() || (tracked && isUnchanged(entry, info))) {
+        download(path, fileId, md5);
+        return;
+    }
+
+    // Both sides hold content the journal has not seen; it may well be
+    // the same
+    verify(path, file);
+}
+
+void SyncEngine::removeLocal(const QString &path)
+{
+    if (!m_journal.contains(path))
+        return;
+
+    const SyncJournal::Entry entry = m_journal.entry(path);
+    const QString absolute = absolutePath(path);
+    if (entry.folder) {
+        const QStringList children = m_journal.children(path);
+        for (const QString &child : children) {
+            removeLocal(child);
+        }
+        // Fails if anything unsynced is left; the parent scan then uploads
+        // the folder again
+        QDir().rmdir(absolute);
+    } else {
+        // Local edits outlive a remote delete and are uploaded again
+        const QFileInfo info(absolute);
+        if (info.exists() && isUnchanged(entry, info)) {
+            QFile::remove(absolute);
+        }
+    }
+
+    m_journal.remove(path);
+    journalChanged();
+    markDirty(SyncJournal::parentPath(path));
+}
+
+void SyncEngine::moveLocal(const QString &from, const QString &to)
+{
+    const QString source = absolutePath(from);
+    const QString target = absolutePath(to);
+    if (QFileInfo::exists(target) || !QDir().rename(source, target)) {
+        // Let the new place be filled like a new file
+        removeLocal(from);
+        return;
+    }
+
+    if (m_journal.entry(from).folder) {
+        const QStringList watched = m_watcher.directories();
+        for (const QString &directory : watched) {
+            if (directory == source || directory.startsWith(source + "/"))
+                m_watcher.removePath(directory);
+        }
+    }
+    m_journal.move(from, to);
+    journalChanged();
+    if (m_journal.entry(to).folder) {
+        const QStringList folders = m_journal.folders();
+        for (const QString &folder : folders) {
+            if (folder == to || folder.startsWith(to + "/"))
+                watch(folder);
+        }
+    }
+}
+
+void SyncEngine::scanLocal(const QString &path)
+{
+    // Folders still being listed or created are marked again when done
+    if (m_busy.contains(path) || !m_journal.contains(path))
+        return;
+
+    const SyncJournal::Entry folder = m_journal.entry(path);
+    const QDir dir(absolutePath(path));
+    if (!folder.folder || !dir.exists())
+        return;
+
+    QSet<QString> present;
+    const QFileInfoList entries = dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    for (const QFileInfo &info : entries) {
+        if (isPartFile(info.fileName()))
+            continue;
+
+        const QString child = SyncJournal::childPath(path, info.fileName());
+        present.insert(child);
+        if (m_busy.contains(child))
+            continue;
+
+        if (!m_journal.contains(child)) {
+            if (info.isDir()) {
+                track(m_api->createFolder(info.fileName(), folder.fileId), CreateFolder, child);
+            } else {
+                track(m_api->uploadFile(info.filePath(), folder.fileId), Upload, child);
+            }
+            continue;
+        }
+
+        const SyncJournal::Entry entry = m_journal.entry(child);
+        if (!entry.folder && !info.isDir() && !isUnchanged(entry, info)) {
+            verify(child, QJsonObject());
+        }
+    }
+
+    const QStringList known = m_journal.children(path);
+    for (const QString &child : known) {
+        if (present.contains(child) || m_busy.contains(child))
+            continue;
+        // Removed here; Drive keeps it in the trash
+        track(m_api->trashFile(m_journal.entry(child).fileId), Trash, child);
+    }
+}
+
+void SyncEngine::verify(const QString &path, const QJsonObject &remote)
+{
+    const QString absolute = absolutePath(path);
+    Verification verification;
+    verification.path = path;
+    verification.remote = remote;
+    m_verifications.insert(absolute, verification);
+    m_busy.insert(path);
+    m_api->checksums()->requestMd5(absolute);
+    updateSyncing();
+}
+
+void SyncEngine::handleChecksum(const QString &localPath, const QString &md5)
+{
+    if (!m_verifications.contains(localPath))
+        return;
+
+    const Verification verification = m_verifications.take(localPath);
+    m_busy.remove(verification.path);
+
+    const QFileInfo info(localPath);
+    if (md5.isEmpty()) {
+        // Unreadable for now; the next scan tries again
+        updateSyncing();
+        return;
+    }
+
+    if (verification.remote.isEmpty()) {
+        const SyncJournal::Entry entry = m_journal.entry(verification.path);
+        if (md5 == entry.md5) {
+            // Touched, not changed
+            record(verification.path, entry.fileId, md5, info.size(), info.lastModified().toMSecsSinceEpoch());
+        } else {
+            // Drive keeps the replaced content as an older revision
+            track(m_api->updateFile(entry.fileId, localPath), Update, verification.path, entry.fileId, md5);
+        }
+    } else if (md5 == verification.remote["md5Checksum"].toString()) {
+        record(verification.path, verification.remote["id"].toString(), md5,
+               info.size(), info.lastModified().toMSecsSinceEpoch());
+    } else {
+        resolveConflict(verification.path, verification.remote);
+    }
+
+    if (!m_remoteChanges.isEmpty()) {
+        m_passTimer.start();
+    }
+    updateSyncing();
+}
+
+void SyncEngine::resolveConflict(const QString &path, const QJsonObject &remote)
+{
+    const QString absolute = absolutePath(path);
+    const QFileInfo info(absolute);
+    const QString stamp = QDateTime::currentDateTime().toString("yyyy-MM-dd hhmmss");
+    const QString copyName = info.suffix().isEmpty()
+            ? QString("%1 (conflict %2)").arg(info.fileName(), stamp)
+            : QString("%1 (conflict %2).%3").arg(info.completeBaseName(), stamp, info.suffix());
+    const QString copyPath = info.dir().filePath(copyName);
+
+    if (!QFile::rename(absolute, copyPath)) {
+        qWarning() << "Cannot set aside" << absolute << "- leaving the conflict for the next pass";
+        return;
+    }
+    qDebug() << "Conflict on" << absolute << "- local version kept as" << copyName;
+
+    m_conflicts++;
+    emit conflictsChanged();
+    emit conflictResolved(absolute, copyPath);
+
+    download(path, remote["id"].toString(), remote["md5Checksum"].toString());
+    markDirty(SyncJournal::parentPath(path));
+}
+
+void SyncEngine::listRemote(const QString &path, int attempt)
+{
+    const QString folderId = m_journal.entry(path).fileId;
+    track(m_api->listFiles(folderId, QString(), LIST_PAGE_SIZE), List, path, folderId, QString(), attempt);
+}
+
+void SyncEngine::download(const QString &path, const QString &fileId, const QString &md5, int attempt)
+{
+    track(m_api->downloadFile(fileId, absolutePath(path)), Download, path, fileId, md5, attempt);
+}
+
+void SyncEngine::handleFilesListed(int requestId, const QJsonArray &files)
+{
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    for (const QJsonValue &value : files) {
+        const QJsonObject file = value.toObject();
+        QString name;
+        if (remoteName(file, &name)) {
+            applyRemote(SyncJournal::childPath(pending.path, name), file);
+        }
+    }
+
+    // Now what is only local can be told apart
+    markDirty(pending.path);
+}
+
+void SyncEngine::handleFileDownloaded(int requestId)
+{
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    const QFileInfo info(absolutePath(pending.path));
+    record(pending.path, pending.fileId, pending.md5, info.size(), info.lastModified().toMSecsSinceEpoch());
+}
+
+void SyncEngine::handleFileUploaded(int requestId, const QJsonObject &metadata)
+{
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    // Size and mtime from when the upload started, so an edit made while
+    // it ran still counts as one
+    const QString md5 = metadata["md5Checksum"].toString();
+    record(pending.path, metadata["id"].toString(), md5.isEmpty() ? pending.md5 : md5,
+           pending.size, pending.modified);
+}
+
+void SyncEngine::handleFolderCreated(int requestId, const QJsonObject &metadata)
+{
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    SyncJournal::Entry folder;
+    folder.fileId = metadata["id"].toString();
+    folder.folder = true;
+    m_journal.insert(pending.path, folder);
+    journalChanged();
+    watch(pending.path);
+    markDirty(pending.path);
+}
+
+void SyncEngine::handleFileDeleted(int requestId)
+{
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    m_journal.remove(pending.path);
+    journalChanged();
+}
+
+void SyncEngine::handleRequestFailed(int requestId)
+{
+    if (requestId == m_changesRequest) {
+        m_changesRequest = 0;
+        updateSyncing();
+        return;
+    }
+
+    Pending pending;
+    if (!takePending(requestId, &pending))
+        return;
+
+    // Tried again on the next poll rather than right away, which would
+    // just spin while offline
+    if (++pending.attempt < MAX_ATTEMPTS) {
+        m_retries.append(pending);
+    } else {
+        qWarning() << "Giving up syncing" << absolutePath(pending.path);
+    }
+}
+
+void SyncEngine::track(int requestId, Operation operation, const QString &path, const QString &fileId,
+                       const QString &md5, int attempt)
+{
+    Pending pending;
+    pending.operation = operation;
+    pending.path = path;
+    pending.fileId = fileId;
+    pending.md5 = md5;
+    pending.attempt = attempt;
+    if (operation == Upload || operation == Update) {
+        const QFileInfo info(absolutePath(path));
+        pending.size = info.size();
+        pending.modified = info.lastModified().toMSecsSinceEpoch();
+    }
+
+    m_pending.insert(requestId, pending);
+    m_busy.insert(path);
+    updateSyncing();
+}
+
+bool SyncEngine::takePending(int requestId, Pending *pending)
+{
+    if (!m_pending.contains(requestId))
+        return false;
+
+    *pending = m_pending.take(requestId);
+    m_busy.remove(pending->path);
+    // Remote changes held back for this path can go now
+    if (!m_remoteChanges.isEmpty() || !m_dirty.isEmpty()) {
+        m_passTimer.start();
+    }
+    updateSyncing();
+    return true;
+}
+
+void SyncEngine::record(const QString &path, const QString &fileId, const QString &md5, qint64 size, qint64 modified)
+{
+    SyncJournal::Entry entry;
+    entry.fileId = fileId;
+    entry.md5 = md5;
+    entry.size = size;
+    entry.modified = modified;
+    m_journal.insert(path, entry);
+    journalChanged();
+}
+
+void SyncEngine::handleDirectoryChanged(const QString &path)
+{
+    const QString relative = relativePath(path);
+    if (!relative.isNull()) {
+        markDirty(relative);
+    }
+}
+
+void SyncEngine::markDirty(const QString &path)
+{
+    m_dirty.insert(path);
+    m_passTimer.start();
+}
+
+void SyncEngine::watch(const QString &path)
+{
+    const QString absolute = absolutePath(path);
+    if (!m_watcher.directories().contains(absolute)) {
+        m_watcher.addPath(absolute);
+    }
+}
+
+void SyncEngine::journalChanged()
+{
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+}
+
+void SyncEngine::updateSyncing()
+{
+    const bool syncing = !m_pending.isEmpty() || !m_verifications.isEmpty() || m_changesRequest != 0;
+    if (m_syncing != syncing) {
+        m_syncing = syncing;
+        emit syncingChanged();
+    }
+}
+
+QString SyncEngine::absolutePath(const QString &path) const
+{
+    return path.isEmpty() ? m_localPath : m_localPath + "/" + path;
+}
+
+QString SyncEngine::relativePath(const QString &absolutePath) const
+{
+    const QString path = QDir::cleanPath(absolutePath);
+    if (path == m_localPath)
+        return QString("");
+    if (path.startsWith(m_localPath + "/"))
+        return path.mid(m_localPath.length() + 1);
+    return QString();
+}
+
+bool SyncEngine::remoteName(const QJsonObject &file, QString *name)
+{
+    const QString mimeType = file["mimeType"].toString();
+    if (mimeType != FOLDER_MIME_TYPE && mimeType.startsWith(GOOGLE_APPS_MIME_PREFIX))
+        return false;
+
+    // Drive names may contain slashes; local ones cannot
+    *name = file["name"].toString().replace('/', '_');
+    return !name->isEmpty() && !isPartFile(*name);
+}
+
+bool SyncEngine::isUnchanged(const SyncJournal::Entry &entry, const QFileInfo &info)
+{
+    return info.size() == entry.size && info.lastModified().toMSecsSinceEpoch() == entry.modified;
+}
+
+bool SyncEngine::isPartFile(const QString &name)
+{
+    // Downloads stage into these; a user file named like one is not synced
+    return name.endsWith(DownloadTask::partPath(QString())) || name.endsWith(DownloadTask::progressPath(QString()));
+}
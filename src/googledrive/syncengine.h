@@ -0,0 +1,149 @@
+#ifndef SYNCENGINE_H
+#define SYNCENGINE_H
+
+#include <QObject>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QList>
+#include <QSet>
+#include <QTimer>
+#include "../storage/syncjournal.h"
+
+class GoogleDriveApi;
+
+// Keeps a local folder and a Drive folder in step both ways. Remote edits
+// come from the changes feed and local ones from directory watches, and
+// both are checked against the SyncJournal, so a pass costs in proportion
+// to what changed: with nothing changed it is one empty changes request
+// and some stats. Where a file changed on both sides the Drive version
+// keeps the name and the local one is kept next to it as a conflict copy,
+// which is then uploaded like any new file.
+class SyncEngine : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool active READ active NOTIFY pinnedChanged)
+    Q_PROPERTY(QString localPath READ localPath NOTIFY pinnedChanged)
+    Q_PROPERTY(QString folderId READ folderId NOTIFY pinnedChanged)
+    Q_PROPERTY(bool syncing READ syncing NOTIFY syncingChanged)
+    Q_PROPERTY(int conflicts READ conflicts NOTIFY conflictsChanged)
+
+public:
+    explicit SyncEngine(GoogleDriveApi *api, QObject *parent = nullptr);
+    ~SyncEngine();
+
+    bool active() const { return !m_localPath.isEmpty(); }
+    QString localPath() const { return m_localPath; }
+    QString folderId() const { return m_journal.folderId(); }
+    bool syncing() const { return m_syncing; }
+    // Conflict copies made since start-up
+    int conflicts() const { return m_conflicts; }
+
+    // Replaces any earlier pin. What is already on either side is merged:
+    // files only on one side are copied over, differing ones conflict.
+    Q_INVOKABLE void pin(const QString &localPath, const QString &folderId);
+    // Stops syncing; both copies stay as they are
+    Q_INVOKABLE void unpin();
+    Q_INVOKABLE void syncNow();
+
+signals:
+    void pinnedChanged();
+    void syncingChanged();
+    void conflictsChanged();
+    void conflictResolved(const QString &localPath, const QString &copyPath);
+
+private slots:
+    void handleDirectoryChanged(const QString &path);
+    void handleChangesReceived(int requestId, const QJsonArray &changes, const QString &newPageToken);
+    void handleFilesListed(int requestId, const QJsonArray &files);
+    void handleFileDownloaded(int requestId);
+    void handleFileUploaded(int requestId, const QJsonObject &metadata);
+    void handleFolderCreated(int requestId, const QJsonObject &metadata);
+    void handleFileDeleted(int requestId);
+    void handleRequestFailed(int requestId);
+    void handleChecksum(const QString &localPath, const QString &md5);
+    void poll();
+    void fetchChanges();
+    void runPass();
+
+private:
+    enum Operation {
+        List,
+        Download,
+        Upload,
+        Update,
+        CreateFolder,
+        Trash
+    };
+
+    struct Pending {
+        Pending() : operation(List), size(-1), modified(-1), attempt(0) {}
+
+        Operation operation;
+        QString path;
+        QString fileId;
+        QString md5;
+        qint64 size;        // of the local file when an upload started
+        qint64 modified;
+        int attempt;
+    };
+
+    // A local file whose content is being hashed; remote is the Drive
+    // version it has to agree with, empty for a local edit
+    struct Verification {
+        QString path;
+        QJsonObject remote;
+    };
+
+    void start();
+    void stop();
+    void applyRemoteChange(const QJsonObject &change);
+    void applyRemote(const QString &path, const QJsonObject &file);
+    void removeLocal(const QString &path);
+    void moveLocal(const QString &from, const QString &to);
+    void scanLocal(const QString &path);
+    void verify(const QString &path, const QJsonObject &remote);
+    void resolveConflict(const QString &path, const QJsonObject &remote);
+    void listRemote(const QString &path, int attempt = 0);
+    void download(const QString &path, const QString &fileId, const QString &md5, int attempt = 0);
+    void track(int requestId, Operation operation, const QString &path, const QString &fileId = QString(),
+               const QString &md5 = QString(), int attempt = 0);
+    bool takePending(int requestId, Pending *pending);
+    void record(const QString &path, const QString &fileId, const QString &md5, qint64 size, qint64 modified);
+    void markDirty(const QString &path);
+    void watch(const QString &path);
+    void journalChanged();
+    void updateSyncing();
+    QString absolutePath(const QString &path) const;
+    QString relativePath(const QString &absolutePath) const;
+    static bool remoteName(const QJsonObject &file, QString *name);
+    static bool isUnchanged(const SyncJournal::Entry &entry, const QFileInfo &info);
+    static bool isPartFile(const QString &name);
+
+    GoogleDriveApi *m_api;
+    SyncJournal m_journal;
+    QFileSystemWatcher m_watcher;
+    QTimer m_passTimer;
+    QTimer m_pollTimer;
+    QTimer m_saveTimer;
+    QString m_localPath;
+    int m_changesRequest;
+    QList<QJsonObject> m_remoteChanges;
+    QSet<QString> m_dirty;
+    QHash<int, Pending> m_pending;
+    QList<Pending> m_retries;
+    QSet<QString> m_busy;
+    QHash<QString, Verification> m_verifications;
+    bool m_syncing;
+    int m_conflicts;
+
+    static const int PASS_DELAY;
+    static const int POLL_INTERVAL;
+    static const int SAVE_DELAY;
+    static const int MAX_ATTEMPTS;
+    static const int LIST_PAGE_SIZE;
+};
+
+#endif // SYNCENGINE_H
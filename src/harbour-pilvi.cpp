@@ -2,8 +2,13 @@
 #include <sailfishapp.h>
 #include "googledrive/googledriveapi.h"
 #include "googledrive/oauthflow.h"
+#include "googledrive/searchsession.h"
+#include "googledrive/syncengine.h"
 #include "models/filemodel.h"
+#include "network/thumbnailprovider.h"
+#include "network/transfermanager.h"
 #include "storage/credentialstore.h"
+#include "storage/filecache.h"
 
 int main(int argc, char *argv[])
 {
@@ -15,14 +20,27 @@ int main(int argc, char *argv[])
 
     // Register QML types (only types that can be instantiated from QML)
     qmlRegisterType<OAuthFlow>("harbour.pilvi.googledrive", 1, 0, "OAuthFlow");
+    qmlRegisterType<SearchSession>("harbour.pilvi.googledrive", 1, 0, "SearchSession");
+    // So SearchSession.api accepts driveApi
+    qmlRegisterUncreatableType<GoogleDriveApi>("harbour.pilvi.googledrive", 1, 0, "GoogleDriveApi",
+                                               "Use the driveApi context property");
     qmlRegisterType<FileModel>("harbour.pilvi.models", 1, 0, "FileModel");
+    // Only for the Kind and State enums; the instance is transferManager
+    qmlRegisterUncreatableType<TransferManager>("harbour.pilvi.models", 1, 0, "TransferManager",
+                                                "Use the transferManager context property");
 
     // Create and expose singletons (driveApi needs CredentialStore, so expose as context property)
     CredentialStore *credentialStore = new CredentialStore(app.data());
-    GoogleDriveApi *driveApi = new GoogleDriveApi(credentialStore, app.data());
+    FileCache *fileCache = new FileCache(app.data());
+    GoogleDriveApi *driveApi = new GoogleDriveApi(credentialStore, fileCache, app.data());
+    SyncEngine *syncEngine = new SyncEngine(driveApi, app.data());
 
     view->rootContext()->setContextProperty("driveApi", driveApi);
     view->rootContext()->setContextProperty("credentialStore", credentialStore);
+    view->rootContext()->setContextProperty("fileCache", fileCache);
+    view->rootContext()->setContextProperty("transferManager", driveApi->transfers());
+    view->rootContext()->setContextProperty("syncEngine", syncEngine);
+    view->engine()->addImageProvider(ThumbnailProvider::PROVIDER_ID, new ThumbnailProvider(driveApi, fileCache));
 
     view->setSource(SailfishApp::pathTo("qml/harbour-pilvi.qml"));
     view->show();
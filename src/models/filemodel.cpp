@@ -1,14 +1,166 @@
 #include "filemodel.h"
 #include <QDateTime>
+#include <QHash>
+#include <QQmlEngine>
+#include <QSet>
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// Parses the fixed-layout RFC 3339 timestamps Drive returns
+// ("2024-05-01T12:34:56.789Z" or with a numeric offset) without going
+// through QDateTime's generic ISO parser.
+int parseDigits(const QChar *data, int count, bool *ok)
+{
+    int value = 0;
+    for (int i = 0; i < count; ++i) {
+        int digit = data[i].unicode() - '0';
+        if (digit < 0 || digit > 9) {
+            *ok = false;
+            return 0;
+        }
+        value = value * 10 + digit;
+    }
+    return value;
+}
+
+qint64 daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    const qint64 era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = static_cast<int>(year - era * 400);
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+qint64 parseRfc3339(const QString &value)
+{
+    const int length = value.size();
+    if (length < 19)
+        return FileRow::INVALID_TIME;
+
+    const QChar *data = value.constData();
+    if (data[4] != '-' || data[7] != '-' || (data[10] != 'T' && data[10] != 't')
+            || data[13] != ':' || data[16] != ':')
+        return FileRow::INVALID_TIME;
+
+    bool ok = true;
+    const int year = parseDigits(data, 4, &ok);
+    const int month = parseDigits(data + 5, 2, &ok);
+    const int day = parseDigits(data + 8, 2, &ok);
+    const int hour = parseDigits(data + 11, 2, &ok);
+    const int minute = parseDigits(data + 14, 2, &ok);
+    const int second = parseDigits(data + 17, 2, &ok);
+    if (!ok || month < 1 || month > 12 || day < 1 || day > 31)
+        return FileRow::INVALID_TIME;
+
+    int pos = 19;
+    int msecs = 0;
+    if (pos < length && data[pos] == '.') {
+        int scale = 100;
+        for (++pos; pos < length && data[pos].isDigit(); ++pos) {
+            msecs += (data[pos].unicode() - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    int offsetSeconds = 0;
+    if (pos < length && (data[pos] == '+' || data[pos] == '-')) {
+        if (length - pos < 6)
+            return FileRow::INVALID_TIME;
+        const int sign = data[pos] == '-' ? -1 : 1;
+        const int offsetHours = parseDigits(data + pos + 1, 2, &ok);
+        const int offsetMinutes = parseDigits(data + pos + 4, 2, &ok);
+        if (!ok)
+            return FileRow::INVALID_TIME;
+        offsetSeconds = sign * (offsetHours * 3600 + offsetMinutes * 60);
+    }
+
+    const qint64 seconds = daysFromCivil(year, month, day) * 86400
+            + hour * 3600 + minute * 60 + second - offsetSeconds;
+    return seconds * 1000 + msecs;
+}
+
+qint64 jsonSize(const QJsonValue &value)
+{
+    // Drive encodes int64 fields as strings
+    return value.isString() ? value.toString().toLongLong() : static_cast<qint64>(value.toDouble());
+}
+
+// MIME types and icon links repeat across nearly every row, so rows keep
+// an index into this table instead of their own copy of the string.
+class StringPool
+{
+public:
+    StringPool()
+    {
+        m_strings.append(QString());
+        m_indexes.insert(QString(), 0);
+    }
+
+    quint32 intern(const QString &value)
+    {
+        QHash<QString, quint32>::const_iterator it = m_indexes.constFind(value);
+        if (it != m_indexes.constEnd())
+            return it.value();
+
+        quint32 index = static_cast<quint32>(m_strings.count());
+        m_strings.append(value);
+        m_indexes.insert(value, index);
+        return index;
+    }
+
+    const QString &at(quint32 index) const { return m_strings.at(index); }
+
+private:
+    QVector<QString> m_strings;
+    QHash<QString, quint32> m_indexes;
+};
+
+StringPool &stringPool()
+{
+    static StringPool pool;
+    return pool;
+}
+
+quint32 folderMimeType()
+{
+    static const quint32 index = stringPool().intern("application/vnd.google-apps.folder");
+    return index;
+}
+
+// Same "folder,name" order the listings are requested in
+bool listedBefore(const FileRow &a, const FileRow &b)
+{
+    const bool aIsFolder = a.mimeType == folderMimeType();
+    if (aIsFolder != (b.mimeType == folderMimeType()))
+        return aIsFolder;
+    return a.name.compare(b.name, Qt::CaseInsensitive) < 0;
+}
+
+QDateTime toDateTime(qint64 msecs)
+{
+    if (msecs == FileRow::INVALID_TIME)
+        return QDateTime();
+    return QDateTime::fromMSecsSinceEpoch(msecs, Qt::UTC);
+}
+
+} // namespace
+
+const qint64 FileRow::INVALID_TIME = std::numeric_limits<qint64>::min();
 
 FileModel::FileModel(QObject *parent)
     : QAbstractListModel(parent)
+    , m_indexDirtyFrom(0)
+    , m_pageRequestId(-1)
+    , m_pageOffset(0)
 {
 }
 
 FileModel::~FileModel()
 {
-    qDeleteAll(m_files);
 }
 
 int FileModel::rowCount(const QModelIndex &parent) const
@@ -22,29 +174,29 @@ QVariant FileModel::data(const QModelIndex &index, int role) const
     if (!index.isValid() || index.row() >= m_files.count())
         return QVariant();
 
-    FileItem *file = m_files.at(index.row());
+    const FileRow &file = m_files.at(index.row());
 
     switch (role) {
     case IdRole:
-        return file->id();
+        return file.id;
     case NameRole:
-        return file->name();
+        return file.name;
     case MimeTypeRole:
-        return file->mimeType();
+        return stringPool().at(file.mimeType);
     case SizeRole:
-        return file->size();
+        return file.size;
     case ModifiedTimeRole:
-        return file->modifiedTime();
+        return toDateTime(file.modifiedTime);
     case IsFolderRole:
-        return file->isFolder();
+        return file.mimeType == folderMimeType();
     case StarredRole:
-        return file->starred();
+        return file.starred;
     case IconUrlRole:
-        return file->iconUrl();
+        return stringPool().at(file.iconUrl);
     case ThumbnailUrlRole:
-        return file->thumbnailUrl();
+        return file.thumbnailUrl;
     case WebViewLinkRole:
-        return file->webViewLink();
+        return file.webViewLink;
     default:
         return QVariant();
     }
@@ -68,9 +220,12 @@ QHash<int, QByteArray> FileModel::roleNames() const
 
 void FileModel::clear()
 {
+    m_pageOffset = 0;
+
     beginResetModel();
-    qDeleteAll(m_files);
     m_files.clear();
+    m_index.clear();
+    m_indexDirtyFrom = 0;
     endResetModel();
     emit countChanged();
 }
@@ -82,10 +237,90 @@ void FileModel::addFile(const QString &id, const QString &name, const QString &m
 {
     QDateTime dateTime = QDateTime::fromString(modifiedTime, Qt::ISODate);
 
+    FileRow file;
+    file.id = id;
+    file.name = name;
+    file.thumbnailUrl = thumbnailUrl;
+    file.webViewLink = webViewLink;
+    file.size = size;
+    file.modifiedTime = dateTime.isValid() ? dateTime.toMSecsSinceEpoch() : FileRow::INVALID_TIME;
+    file.mimeType = stringPool().intern(mimeType);
+    file.iconUrl = stringPool().intern(iconUrl);
+    file.starred = starred;
+
     beginInsertRows(QModelIndex(), m_files.count(), m_files.count());
-    FileItem *file = new FileItem(id, name, mimeType, size, dateTime, starred,
-                                  iconUrl, thumbnailUrl, webViewLink, this);
     m_files.append(file);
+    invalidateIndex(m_files.count() - 1);
+    endInsertRows();
+    emit countChanged();
+}
+
+void FileModel::setFiles(const QJsonArray &files)
+{
+    m_pageOffset = 0;
+
+    if (m_files.isEmpty()) {
+        appendFiles(files);
+        return;
+    }
+
+    const int oldCount = m_files.count();
+
+    // Drop rows that are gone first so they are not shuffled around below
+    QSet<QString> ids;
+    ids.reserve(files.count());
+    for (const QJsonValue &file : files) {
+        ids.insert(file.toObject().value("id").toString());
+    }
+    for (int row = m_files.count() - 1; row >= 0; --row) {
+        if (ids.contains(m_files.at(row).id))
+            continue;
+        int last = row;
+        while (row > 0 && !ids.contains(m_files.at(row - 1).id))
+            --row;
+        removeRange(row, last);
+    }
+
+    mergeFiles(0, files);
+    truncate(files.count());
+
+    if (m_files.count() != oldCount)
+        emit countChanged();
+}
+
+void FileModel::applyPage(int requestId, const QJsonArray &files, bool isLastPage)
+{
+    if (requestId != m_pageRequestId) {
+        m_pageRequestId = requestId;
+        m_pageOffset = 0;
+    }
+
+    const int oldCount = m_files.count();
+
+    mergeFiles(m_pageOffset, files);
+    m_pageOffset += files.count();
+
+    if (isLastPage) {
+        truncate(m_pageOffset);
+        m_pageOffset = 0;
+    }
+
+    if (m_files.count() != oldCount)
+        emit countChanged();
+}
+
+void FileModel::appendFiles(const QJsonArray &files)
+{
+    if (files.isEmpty())
+        return;
+
+    const int first = m_files.count();
+    beginInsertRows(QModelIndex(), first, first + files.count() - 1);
+    m_files.reserve(first + files.count());
+    for (const QJsonValue &file : files) {
+        m_files.append(createRow(file.toObject()));
+    }
+    invalidateIndex(first);
     endInsertRows();
     emit countChanged();
 }
@@ -95,25 +330,362 @@ void FileModel::removeFile(int index)
     if (index < 0 || index >= m_files.count())
         return;
 
-    beginRemoveRows(QModelIndex(), index, index);
-    delete m_files.takeAt(index);
-    endRemoveRows();
+    removeRange(index, index);
     emit countChanged();
 }
 
+void FileModel::updateFiles(const QJsonArray &files)
+{
+    for (const QJsonValue &value : files) {
+        const QJsonObject file = value.toObject();
+        int row = indexOf(file.value("id").toString(), 0);
+        if (row < 0 || !patchRow(m_files[row], file))
+            continue;
+
+        QModelIndex modelIndex = index(row);
+        emit dataChanged(modelIndex, modelIndex);
+    }
+}
+
+void FileModel::removeFilesById(const QStringList &ids)
+{
+    if (removeIds(ids))
+        emit countChanged();
+}
+
+void FileModel::applyChanges(const QJsonArray &changes, const QString &folderId)
+{
+    // Only the last change of a file counts
+    QSet<QString> removed;
+    QHash<QString, QJsonObject> listed;
+
+    for (const QJsonValue &value : changes) {
+        const QJsonObject change = value.toObject();
+        const QJsonObject file = change.value("file").toObject();
+        const QString id = change.value("fileId").toString();
+
+        // Trashed, deleted or moved elsewhere all mean the row goes away
+        const bool listedHere = !change.value("removed").toBool()
+                && !file.value("trashed").toBool()
+                && file.value("parents").toArray().contains(folderId);
+        if (listedHere) {
+            listed.insert(id, file);
+            removed.remove(id);
+        } else {
+            removed.insert(id);
+            listed.remove(id);
+        }
+    }
+
+    bool removedAny = removeIds(removed.toList());
+
+    QJsonArray updated;
+    QStringList moved;
+    QVector<FileRow> added;
+    for (QHash<QString, QJsonObject>::const_iterator it = listed.constBegin(); it != listed.constEnd(); ++it) {
+        int row = indexOf(it.key(), 0);
+        if (row < 0) {
+            added.append(createRow(it.value()));
+            continue;
+        }
+
+        // A rename or a change to or from a folder changes where the row
+        // belongs
+        const FileRow &current = m_files.at(row);
+        const QJsonObject &file = it.value();
+        if ((file.contains("name") && file.value("name").toString() != current.name)
+                || (file.contains("mimeType")
+                    && (stringPool().intern(file.value("mimeType").toString()) == folderMimeType())
+                       != (current.mimeType == folderMimeType()))) {
+            moved.append(it.key());
+        }
+        updated.append(file);
+    }
+    updateFiles(updated);
+
+    // Moved rows go back in with the new ones, so several of them can
+    // change places without any one being sorted against the others
+    const bool grew = !added.isEmpty();
+    for (const QString &id : moved) {
+        added.append(m_files.at(indexOf(id, 0)));
+    }
+    removeIds(moved);
+    insertSorted(added);
+
+    if (grew || removedAny)
+        emit countChanged();
+}
+
+bool FileModel::removeIds(const QStringList &ids)
+{
+    QVector<int> rows;
+    rows.reserve(ids.count());
+    for (const QString &id : ids) {
+        int row = indexOf(id, 0);
+        if (row >= 0)
+            rows.append(row);
+    }
+    if (rows.isEmpty())
+        return false;
+
+    // Remove from the bottom up, one signal per contiguous run
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    for (int i = rows.count() - 1; i >= 0; --i) {
+        int last = rows.at(i);
+        while (i > 0 && rows.at(i - 1) == rows.at(i) - 1)
+            --i;
+        removeRange(rows.at(i), last);
+    }
+    return true;
+}
+
+void FileModel::insertSorted(QVector<FileRow> rows)
+{
+    if (rows.isEmpty())
+        return;
+
+    // One pass over the rows places the whole sorted batch
+    std::stable_sort(rows.begin(), rows.end(), listedBefore);
+    QVector<int> positions;
+    positions.reserve(rows.count());
+    int row = 0;
+    for (const FileRow &newRow : rows) {
+        while (row < m_files.count() && !listedBefore(newRow, m_files.at(row)))
+            ++row;
+        positions.append(row);
+    }
+
+    // Bottom up, so the positions above stay valid, one signal per run
+    for (int end = rows.count(); end > 0;) {
+        int first = end - 1;
+        while (first > 0 && positions.at(first - 1) == positions.at(end - 1))
+            --first;
+
+        const int position = positions.at(first);
+        beginInsertRows(QModelIndex(), position, position + end - first - 1);
+        m_files.insert(position, end - first, FileRow());
+        std::move(rows.begin() + first, rows.begin() + end, m_files.begin() + position);
+        invalidateIndex(position);
+        endInsertRows();
+        end = first;
+    }
+}
+
 FileItem* FileModel::getFile(int index) const
 {
     if (index < 0 || index >= m_files.count())
         return nullptr;
 
-    return m_files.at(index);
+    // Built on demand for QML; the JS engine owns and collects it
+    const FileRow &file = m_files.at(index);
+    FileItem *item = new FileItem(file.id, file.name, stringPool().at(file.mimeType),
+                                  file.size, toDateTime(file.modifiedTime), file.starred,
+                                  stringPool().at(file.iconUrl), file.thumbnailUrl,
+                                  file.webViewLink);
+    QQmlEngine::setObjectOwnership(item, QQmlEngine::JavaScriptOwnership);
+    return item;
 }
 
 int FileModel::findFileById(const QString &id) const
 {
-    for (int i = 0; i < m_files.count(); ++i) {
-        if (m_files.at(i)->id() == id)
-            return i;
+    return indexOf(id, 0);
+}
+
+void FileModel::mergeFiles(int start, const QJsonArray &files)
+{
+    // Makes rows [start, start + files.count()) match files, keyed on id.
+    // Unchanged rows cost a comparison and emit nothing.
+    //
+    // The id index goes stale with the first insert or move and is rebuilt
+    // once on the next lookup after the merge. Rows only shift at or after
+    // start, so until then it still tells which ids wait further down.
+    ensureIndex();
+    QSet<QString> placed;
+    auto waiting = [this, start, &placed](const QString &id) {
+        return m_index.value(id, -1) >= start && !placed.contains(id);
+    };
+
+    int row = start;
+    for (int i = 0; i < files.count(); ++i, ++row) {
+        const QJsonObject file = files.at(i).toObject();
+        const QString id = file.value("id").toString();
+
+        if (row < m_files.count() && m_files.at(row).id == id) {
+            updateFile(row, file);
+            placed.insert(id);
+            continue;
+        }
+
+        int existing = -1;
+        if (waiting(id)) {
+            for (int candidate = row + 1; candidate < m_files.count(); ++candidate) {
+                if (m_files.at(candidate).id == id) {
+                    existing = candidate;
+                    break;
+                }
+            }
+        }
+
+        if (existing < 0) {
+            // Collect the run of unknown ids so it goes in with one insert
+            int end = i + 1;
+            while (end < files.count() && !waiting(files.at(end).toObject().value("id").toString())) {
+                ++end;
+            }
+
+            beginInsertRows(QModelIndex(), row, row + end - i - 1);
+            m_files.insert(row, end - i, FileRow());
+            for (int j = i; j < end; ++j) {
+                m_files[row + j - i] = createRow(files.at(j).toObject());
+                placed.insert(m_files.at(row + j - i).id);
+            }
+            invalidateIndex(row);
+            endInsertRows();
+
+            row += end - i - 1;
+            i = end - 1;
+            continue;
+        }
+
+        // Rows in front of the wanted one move to the tail. A later page
+        // picks them up again, otherwise they are cut off by truncate().
+        beginMoveRows(QModelIndex(), row, existing - 1, QModelIndex(), m_files.count());
+        std::rotate(m_files.begin() + row, m_files.begin() + existing, m_files.end());
+        invalidateIndex(row);
+        endMoveRows();
+
+        updateFile(row, file);
+        placed.insert(id);
     }
-    return -1;
+}
+
+void FileModel::updateFile(int row, const QJsonObject &file)
+{
+    FileRow &current = m_files[row];
+
+    // thumbnailLink is a signed URL that differs between listings, so it
+    // does not count as a change on its own
+    if (current.name == file.value("name").toString()
+            && stringPool().at(current.mimeType) == file.value("mimeType").toString()
+            && current.size == jsonSize(file.value("size"))
+            && current.starred == file.value("starred").toBool()
+            && stringPool().at(current.iconUrl) == file.value("iconLink").toString()
+            && current.webViewLink == file.value("webViewLink").toString()
+            && current.modifiedTime == parseRfc3339(file.value("modifiedTime").toString())) {
+        return;
+    }
+
+    current = createRow(file);
+
+    QModelIndex modelIndex = index(row);
+    emit dataChanged(modelIndex, modelIndex);
+}
+
+void FileModel::removeRange(int first, int last)
+{
+    beginRemoveRows(QModelIndex(), first, last);
+    for (int row = first; row <= last; ++row) {
+        m_index.remove(m_files.at(row).id);
+    }
+    m_files.remove(first, last - first + 1);
+    invalidateIndex(first);
+    endRemoveRows();
+}
+
+void FileModel::truncate(int count)
+{
+    if (m_files.count() > count) {
+        removeRange(count, m_files.count() - 1);
+    }
+}
+
+int FileModel::indexOf(const QString &id, int from) const
+{
+    ensureIndex();
+
+    QHash<QString, int>::const_iterator it = m_index.constFind(id);
+    if (it == m_index.constEnd() || it.value() < from)
+        return -1;
+    return it.value();
+}
+
+void FileModel::invalidateIndex(int from)
+{
+    m_indexDirtyFrom = qMin(m_indexDirtyFrom, from);
+}
+
+void FileModel::ensureIndex() const
+{
+    // Rows only shift at and after a structural change, so only that tail
+    // needs re-indexing, and only once per batch of changes
+    for (int row = m_indexDirtyFrom; row < m_files.count(); ++row) {
+        m_index.insert(m_files.at(row).id, row);
+    }
+    m_indexDirtyFrom = m_files.count();
+}
+
+bool FileModel::patchRow(FileRow &row, const QJsonObject &file)
+{
+    // Only fields present in the object are applied, so partial metadata
+    // from the changes feed or a PATCH response can be merged in
+    bool changed = false;
+
+    if (file.contains("name")) {
+        QString name = file.value("name").toString();
+        changed |= row.name != name;
+        row.name = name;
+    }
+    if (file.contains("mimeType")) {
+        quint32 mimeType = stringPool().intern(file.value("mimeType").toString());
+        changed |= row.mimeType != mimeType;
+        row.mimeType = mimeType;
+    }
+    if (file.contains("size")) {
+        qint64 size = jsonSize(file.value("size"));
+        changed |= row.size != size;
+        row.size = size;
+    }
+    if (file.contains("modifiedTime")) {
+        qint64 modifiedTime = parseRfc3339(file.value("modifiedTime").toString());
+        changed |= row.modifiedTime != modifiedTime;
+        row.modifiedTime = modifiedTime;
+    }
+    if (file.contains("starred")) {
+        bool starred = file.value("starred").toBool();
+        changed |= row.starred != starred;
+        row.starred = starred;
+    }
+    if (file.contains("iconLink")) {
+        quint32 iconUrl = stringPool().intern(file.value("iconLink").toString());
+        changed |= row.iconUrl != iconUrl;
+        row.iconUrl = iconUrl;
+    }
+    if (file.contains("thumbnailLink")) {
+        QString thumbnailUrl = file.value("thumbnailLink").toString();
+        changed |= row.thumbnailUrl != thumbnailUrl;
+        row.thumbnailUrl = thumbnailUrl;
+    }
+    if (file.contains("webViewLink")) {
+        QString webViewLink = file.value("webViewLink").toString();
+        changed |= row.webViewLink != webViewLink;
+        row.webViewLink = webViewLink;
+    }
+
+    return changed;
+}
+
+FileRow FileModel::createRow(const QJsonObject &file)
+{
+    FileRow row;
+    row.id = file.value("id").toString();
+    row.name = file.value("name").toString();
+    row.thumbnailUrl = file.value("thumbnailLink").toString();
+    row.webViewLink = file.value("webViewLink").toString();
+    row.size = jsonSize(file.value("size"));
+    row.modifiedTime = parseRfc3339(file.value("modifiedTime").toString());
+    row.mimeType = stringPool().intern(file.value("mimeType").toString());
+    row.iconUrl = stringPool().intern(file.value("iconLink").toString());
+    row.starred = file.value("starred").toBool();
+    return row;
 }
@@ -2,9 +2,31 @@
 #define FILEMODEL_H
 
 #include <QAbstractListModel>
-#include <QList>
+#include <QVector>
+#include <QHash>
+#include <QStringList>
+#include <QJsonArray>
+#include <QJsonObject>
 #include "fileitem.h"
 
+// One listing row stored by value. MIME type and icon link are indexes into
+// a string table shared by all models; the timestamp is kept as UTC msecs.
+struct FileRow
+{
+    QString id;
+    QString name;
+    QString thumbnailUrl;
+    QString webViewLink;
+    qint64 size;
+    qint64 modifiedTime;
+    quint32 mimeType;
+    quint32 iconUrl;
+    bool starred;
+
+    static const qint64 INVALID_TIME;
+};
+Q_DECLARE_TYPEINFO(FileRow, Q_MOVABLE_TYPE);
+
 class FileModel : public QAbstractListModel
 {
     Q_OBJECT
@@ -38,7 +60,14 @@ public:
                             qint64 size, const QString &modifiedTime, bool starred,
                             const QString &iconUrl, const QString &thumbnailUrl,
                             const QString &webViewLink);
+    Q_INVOKABLE void setFiles(const QJsonArray &files);
+    Q_INVOKABLE void appendFiles(const QJsonArray &files);
+    Q_INVOKABLE void applyPage(int requestId, const QJsonArray &files, bool isLastPage);
+    Q_INVOKABLE void updateFiles(const QJsonArray &files);
+    Q_INVOKABLE void removeFilesById(const QStringList &ids);
+    Q_INVOKABLE void applyChanges(const QJsonArray &changes, const QString &folderId);
     Q_INVOKABLE void removeFile(int index);
+    // Returns a new FileItem owned by the JavaScript engine
     Q_INVOKABLE FileItem* getFile(int index) const;
     Q_INVOKABLE int findFileById(const QString &id) const;
 
@@ -46,7 +75,24 @@ signals:
     void countChanged();
 
 private:
-    QList<FileItem*> m_files;
+    static FileRow createRow(const QJsonObject &file);
+    void mergeFiles(int start, const QJsonArray &files);
+    void updateFile(int row, const QJsonObject &file);
+    static bool patchRow(FileRow &row, const QJsonObject &file);
+    void removeRange(int first, int last);
+    bool removeIds(const QStringList &ids);
+    void insertSorted(QVector<FileRow> rows);
+    void truncate(int count);
+    int indexOf(const QString &id, int from) const;
+    void invalidateIndex(int from);
+    void ensureIndex() const;
+
+    QVector<FileRow> m_files;
+    // id -> row, valid for rows below m_indexDirtyFrom
+    mutable QHash<QString, int> m_index;
+    mutable int m_indexDirtyFrom;
+    int m_pageRequestId;
+    int m_pageOffset;
 };
 
 #endif // FILEMODEL_H
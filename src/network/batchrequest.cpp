@@ -0,0 +1,130 @@
+#include "batchrequest.h"
+#include <QUuid>
+#include <QDebug>
+
+// Drive rejects batches with more than 100 calls
+const int BatchRequest::MAX_PARTS = 100;
+const QString BatchRequest::BATCH_URL = "https://www.googleapis.com/batch/drive/v3";
+
+namespace {
+
+const QByteArray CONTENT_ID_PREFIX = "item-";
+
+// Splits a header block off the front of data; returns the offset of the
+// first byte after the blank line, or -1
+int headerEnd(const QByteArray &data, int from)
+{
+    int crlf = data.indexOf("\r\n\r\n", from);
+    int lf = data.indexOf("\n\n", from);
+    if (crlf >= 0 && (lf < 0 || crlf < lf))
+        return crlf + 4;
+    return lf >= 0 ? lf + 2 : -1;
+}
+
+QByteArray headerValue(const QByteArray &headers, const QByteArray &name)
+{
+    const QList<QByteArray> lines = headers.split('\n');
+    for (const QByteArray &line : lines) {
+        int colon = line.indexOf(':');
+        if (colon > 0 && line.left(colon).trimmed().toLower() == name)
+            return line.mid(colon + 1).trimmed();
+    }
+    return QByteArray();
+}
+
+} // namespace
+
+BatchRequest::BatchRequest()
+    : m_boundary("batch_" + QUuid::createUuid().toRfc4122().toHex())
+    , m_count(0)
+{
+}
+
+int BatchRequest::addPart(const QString &method, const QUrl &url, const QByteArray &body)
+{
+    int index = m_count++;
+
+    m_body += "--" + m_boundary + "\r\n";
+    m_body += "Content-Type: application/http\r\n";
+    m_body += "Content-ID: <" + CONTENT_ID_PREFIX + QByteArray::number(index) + ">\r\n\r\n";
+
+    // The inner request line carries the path relative to the API host
+    m_body += method.toLatin1() + ' ' + url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority) + " HTTP/1.1\r\n";
+    if (!body.isEmpty()) {
+        m_body += "Content-Type: application/json; charset=UTF-8\r\n";
+        m_body += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    }
+    m_body += "\r\n";
+    m_body += body;
+    m_body += "\r\n";
+
+    return index;
+}
+
+QByteArray BatchRequest::contentType() const
+{
+    return "multipart/mixed; boundary=" + m_boundary;
+}
+
+QByteArray BatchRequest::body() const
+{
+    return m_body + "--" + m_boundary + "--\r\n";
+}
+
+QList<BatchRequest::Response> BatchRequest::parseResponse(const QByteArray &contentType, const QByteArray &data)
+{
+    QList<Response> responses;
+
+    int boundaryAt = contentType.indexOf("boundary=");
+    if (boundaryAt < 0)
+        return responses;
+
+    QByteArray boundary = contentType.mid(boundaryAt + 9);
+    int semicolon = boundary.indexOf(';');
+    if (semicolon >= 0)
+        boundary.truncate(semicolon);
+    boundary = boundary.trimmed();
+    if (boundary.startsWith('"') && boundary.endsWith('"'))
+        boundary = boundary.mid(1, boundary.size() - 2);
+
+    const QByteArray delimiter = "--" + boundary;
+    int pos = data.indexOf(delimiter);
+    while (pos >= 0) {
+        int start = pos + delimiter.size();
+        if (data.mid(start, 2) == "--")
+            break;
+
+        int next = data.indexOf(delimiter, start);
+        QByteArray part = data.mid(start, next >= 0 ? next - start : -1);
+        pos = next;
+
+        // MIME headers of the part, then the embedded HTTP response
+        int mimeEnd = headerEnd(part, 0);
+        if (mimeEnd < 0)
+            continue;
+
+        QByteArray contentId = headerValue(part.left(mimeEnd), "content-id");
+        int idAt = contentId.indexOf(CONTENT_ID_PREFIX);
+        if (idAt < 0)
+            continue;
+
+        bool ok = false;
+        QByteArray id = contentId.mid(idAt + CONTENT_ID_PREFIX.size());
+        id.replace('>', "");
+        int index = id.toInt(&ok);
+        if (!ok)
+            continue;
+
+        int httpEnd = headerEnd(part, mimeEnd);
+        QByteArray statusLine = part.mid(mimeEnd, part.indexOf('\n', mimeEnd) - mimeEnd).trimmed();
+        QList<QByteArray> statusFields = statusLine.split(' ');
+
+        Response response;
+        response.index = index;
+        response.status = statusFields.size() > 1 ? statusFields.at(1).toInt() : 0;
+        response.body = httpEnd >= 0 ? part.mid(httpEnd).trimmed() : QByteArray();
+        responses.append(response);
+    }
+
+    return responses;
+}
@@ -0,0 +1,43 @@
+#ifndef BATCHREQUEST_H
+#define BATCHREQUEST_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QUrl>
+
+// Packs several API calls into one multipart/mixed request for the Drive
+// batch endpoint and splits the multipart response back into per-call
+// status codes and bodies. Parts are identified by their index.
+class BatchRequest
+{
+public:
+    struct Response {
+        int index;
+        int status;
+        QByteArray body;
+    };
+
+    BatchRequest();
+
+    // Returns the index of the part
+    int addPart(const QString &method, const QUrl &url, const QByteArray &body = QByteArray());
+    int count() const { return m_count; }
+
+    QByteArray contentType() const;
+    QByteArray body() const;
+
+    // Responses in the order they appear; parts that cannot be matched to
+    // a request index are skipped
+    static QList<Response> parseResponse(const QByteArray &contentType, const QByteArray &data);
+
+    static const int MAX_PARTS;
+    static const QString BATCH_URL;
+
+private:
+    QByteArray m_boundary;
+    QByteArray m_body;
+    int m_count;
+};
+
+#endif // BATCHREQUEST_H
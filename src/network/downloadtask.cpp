@@ -0,0 +1,817 @@
+#include "downloadtask.h"
+#include "networkrequest.h"
+#include "retrypolicy.h"
+#include "../storage/checksumengine.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QTimer>
+#include <QDebug>
+#include <cstdio>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Upper bound for data QNetworkAccessManager keeps in memory for us. Once it
+// is full the socket stops being read until we drain the reply.
+const qint64 DownloadTask::READ_BUFFER_SIZE = 512 * 1024;
+const int DownloadTask::CHUNK_SIZE = 64 * 1024;
+// Below this a single stream is quicker than setting up several
+const qint64 DownloadTask::SEGMENTED_MIN_SIZE = 16 * 1024 * 1024;
+// Per file; each beyond the first takes a bulk lane slot of its own
+const int DownloadTask::SEGMENT_CONNECTIONS = 4;
+const qint64 DownloadTask::MIN_SEGMENT_SIZE = 1024 * 1024;
+const qint64 DownloadTask::MAX_SEGMENT_SIZE = 32 * 1024 * 1024;
+// Ranges are sized to take about this long at the measured rate
+const int DownloadTask::SEGMENT_SECONDS = 4;
+// Without a retry policy to ask
+const int DownloadTask::MAX_RETRIES = 5;
+// A streamed download records its progress every few megabytes
+const qint64 DownloadTask::SAVE_INTERVAL = 4 * 1024 * 1024;
+
+DownloadTask::DownloadTask(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                           const QString &localPath, QObject *parent)
+    : QObject(parent)
+    , m_manager(manager)
+    , m_scheduler(nullptr)
+    , m_checksums(nullptr)
+    , m_retryPolicy(nullptr)
+    , m_request(request)
+    , m_localPath(localPath)
+    , m_file(partPath(localPath))
+    , m_reply(nullptr)
+    , m_bytesWritten(0)
+    , m_bytesTotal(-1)
+    , m_expectedSize(-1)
+    , m_ranged(false)
+    , m_streamOffset(0)
+    , m_lastSaved(0)
+    , m_segmentSize(MIN_SEGMENT_SIZE)
+    , m_retries(0)
+{
+    m_retryTimer.setSingleShot(true);
+    connect(&m_retryTimer, &QTimer::timeout, this, &DownloadTask::start);
+}
+
+DownloadTask::~DownloadTask()
+{
+    abort();
+}
+
+QString DownloadTask::partPath(const QString &localPath)
+{
+    return localPath + ".part";
+}
+
+QString DownloadTask::progressPath(const QString &localPath)
+{
+    return localPath + ".part.json";
+}
+
+void DownloadTask::start()
+{
+    if (m_reply || !m_segments.isEmpty())
+        return;
+
+    m_chunk.resize(CHUNK_SIZE);
+    m_bytesWritten = 0;
+    m_bytesTotal = -1;
+    m_doneRanges.clear();
+
+    // Continue a part file left by an earlier attempt at the same revision
+    bool resumed = restoreProgress();
+    QIODevice::OpenMode mode = resumed ? QIODevice::ReadWrite : QIODevice::WriteOnly | QIODevice::Truncate;
+    if (!m_file.open(mode)) {
+        failAndDiscard("Failed to save file: " + m_localPath);
+        return;
+    }
+    if (!resumed) {
+        QFile::remove(progressPath(m_localPath));
+    }
+
+    // Ranges only pay off over several connections, except to fill gaps
+    // an earlier attempt left
+    m_ranged = m_expectedSize >= SEGMENTED_MIN_SIZE
+            && (acquireSlot() || m_doneRanges.count() > 1
+                || (m_doneRanges.count() == 1 && m_doneRanges.first().first > 0));
+    if (m_ranged) {
+        startSegments();
+    } else {
+        startStream();
+    }
+}
+
+void DownloadTask::startStream()
+{
+    // Only the leading run of stored bytes is of use to a single stream
+    qint64 offset = 0;
+    if (!m_doneRanges.isEmpty() && m_doneRanges.first().first == 0)
+        offset = m_doneRanges.first().second + 1;
+    m_doneRanges.clear();
+    if (offset > 0)
+        m_doneRanges.append(qMakePair<qint64, qint64>(0, offset - 1));
+
+    m_bytesWritten = offset;
+    m_streamOffset = offset;
+    m_lastSaved = offset;
+    if (!m_file.seek(offset)) {
+        failAndDiscard("Failed to save file: " + m_localPath);
+        return;
+    }
+
+    QNetworkRequest request(m_request);
+    if (offset > 0) {
+        qDebug() << "Resuming download of" << m_localPath << "at byte" << offset;
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(offset) + '-');
+    }
+
+    m_reply = m_manager->get(request);
+    m_reply->setReadBufferSize(READ_BUFFER_SIZE);
+
+    connect(m_reply, &QNetworkReply::metaDataChanged, this, &DownloadTask::handleMetaDataChanged);
+    connect(m_reply, &QNetworkReply::readyRead, this, &DownloadTask::handleReadyRead);
+    connect(m_reply, &QNetworkReply::finished, this, &DownloadTask::handleFinished);
+}
+
+void DownloadTask::abort()
+{
+    m_retryTimer.stop();
+    if (m_checksums)
+        disconnect(m_checksums, &ChecksumEngine::checksumReady, this, &DownloadTask::handleChecksum);
+
+    // Record what arrived so a later start() continues from there
+    if (m_file.isOpen() && isResumable()) {
+        if (m_ranged) {
+            for (auto it = m_segments.constBegin(); it != m_segments.constEnd(); ++it) {
+                if (it->offset > it->start)
+                    markDone(it->start, it->offset - 1);
+            }
+        } else if (m_bytesWritten > 0) {
+            m_doneRanges.clear();
+            markDone(0, m_bytesWritten - 1);
+        }
+        saveProgress();
+    }
+
+    abortSegments();
+    releaseSlots();
+
+    if (m_reply) {
+        QNetworkReply *reply = m_reply;
+        m_reply = nullptr;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    if (m_file.isOpen()) {
+        m_file.close();
+        if (!isResumable())
+            m_file.remove();
+    }
+}
+
+void DownloadTask::discard()
+{
+    abort();
+    m_file.remove();
+    QFile::remove(progressPath(m_localPath));
+    m_doneRanges.clear();
+}
+
+bool DownloadTask::restoreProgress()
+{
+    if (!isResumable() || !m_file.exists())
+        return false;
+
+    QFile file(progressPath(m_localPath));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonObject saved = QJsonDocument::fromJson(file.readAll()).object();
+    if (saved["fileId"].toString() != m_fileId || saved["version"].toString() != m_version) {
+        qDebug() << "Remote file changed since" << m_localPath << "was partly downloaded";
+        return false;
+    }
+
+    qint64 size = static_cast<qint64>(saved["size"].toDouble(-1));
+    if (m_expectedSize >= 0 && size >= 0 && size != m_expectedSize)
+        return false;
+
+    const qint64 stored = m_file.size();
+    const QJsonArray ranges = saved["ranges"].toArray();
+    for (const QJsonValue &value : ranges) {
+        QJsonArray range = value.toArray();
+        qint64 first = static_cast<qint64>(range.at(0).toDouble(-1));
+        qint64 last = static_cast<qint64>(range.at(1).toDouble(-1));
+        if (first >= 0 && last >= first && last < stored)
+            markDone(first, last);
+    }
+
+    for (const QPair<qint64, qint64> &range : m_doneRanges) {
+        m_bytesWritten += range.second - range.first + 1;
+    }
+    return !m_doneRanges.isEmpty();
+}
+
+void DownloadTask::saveProgress()
+{
+    if (!isResumable() || !m_file.isOpen())
+        return;
+
+    // Only data that reached the disk may be recorded as stored, or a
+    // crash could leave ranges marked done that were never written
+    if (!m_file.flush())
+        return;
+#ifdef Q_OS_LINUX
+    if (fsync(m_file.handle()) != 0)
+        return;
+#endif
+
+    QJsonArray ranges;
+    for (const QPair<qint64, qint64> &done : m_doneRanges) {
+        QJsonArray range;
+        range.append(static_cast<double>(done.first));
+        range.append(static_cast<double>(done.second));
+        ranges.append(range);
+    }
+
+    QJsonObject saved;
+    saved["fileId"] = m_fileId;
+    saved["version"] = m_version;
+    saved["size"] = static_cast<double>(m_bytesTotal);
+    saved["ranges"] = ranges;
+
+    QSaveFile file(progressPath(m_localPath));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot record download progress for" << m_localPath;
+        return;
+    }
+    file.write(QJsonDocument(saved).toJson(QJsonDocument::Compact));
+    if (!file.commit()) {
+        qWarning() << "Cannot record download progress for" << m_localPath;
+    }
+    m_lastSaved = m_bytesWritten;
+}
+
+void DownloadTask::markDone(qint64 first, qint64 last)
+{
+    // Insert and merge with neighbours that touch or overlap
+    int i = 0;
+    while (i < m_doneRanges.count() && m_doneRanges.at(i).second + 1 < first)
+        ++i;
+    while (i < m_doneRanges.count() && m_doneRanges.at(i).first <= last + 1) {
+        first = qMin(first, m_doneRanges.at(i).first);
+        last = qMax(last, m_doneRanges.at(i).second);
+        m_doneRanges.removeAt(i);
+    }
+    m_doneRanges.insert(i, qMakePair(first, last));
+}
+
+void DownloadTask::handleMetaDataChanged()
+{
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status < 200 || status >= 300)
+        return;
+
+    if (status != 206 && m_streamOffset > 0) {
+        // Range was ignored; the body starts at byte 0
+        qDebug() << "Server ignored the resume range for" << m_localPath;
+        m_streamOffset = 0;
+        m_bytesWritten = 0;
+        m_lastSaved = 0;
+        m_doneRanges.clear();
+        if (!m_file.resize(0) || !m_file.seek(0)) {
+            failAndDiscard("Failed to save file: " + m_localPath);
+            return;
+        }
+    }
+
+    if (status == 206) {
+        // The part file holds the start of a file of exactly this size
+        const qint64 total = contentRangeTotal(m_reply);
+        if (total >= 0 && m_expectedSize >= 0 && total != m_expectedSize) {
+            QNetworkReply *reply = m_reply;
+            m_reply = nullptr;
+            reply->disconnect(this);
+            reply->abort();
+            reply->deleteLater();
+            restartWithSize(total);
+            return;
+        }
+    }
+
+    bool ok = false;
+    qint64 length = m_reply->header(QNetworkRequest::ContentLengthHeader).toLongLong(&ok);
+    if (ok && length > 0 && m_bytesTotal < 0) {
+        m_bytesTotal = m_streamOffset + length;
+        if (!preallocate(m_bytesTotal)) {
+            qWarning() << "Could not preallocate" << m_bytesTotal << "bytes for" << m_localPath;
+        }
+    }
+}
+
+void DownloadTask::handleReadyRead()
+{
+    // An error body must not end up in the part file
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (m_reply->error() != QNetworkReply::NoError || status < 200 || status >= 300)
+        return;
+
+    const qint64 written = m_bytesWritten;
+    if (!drainReply()) {
+        failAndDiscard("Failed to write file: " + m_localPath);
+        return;
+    }
+    if (m_bytesWritten > written)
+        m_retries = 0;
+
+    if (isResumable() && m_bytesWritten - m_lastSaved >= SAVE_INTERVAL) {
+        m_doneRanges.clear();
+        markDone(0, m_bytesWritten - 1);
+        saveProgress();
+    }
+
+    emit progress(m_bytesWritten, m_bytesTotal);
+}
+
+void DownloadTask::handleFinished()
+{
+    m_reply->deleteLater();
+
+    if (m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 401) {
+        m_reply = nullptr;
+        abort();
+        emit authorizationExpired(m_request.rawHeader("Authorization"));
+        return;
+    }
+
+    int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status >= 400 && RetryPolicy::isUnprocessed(m_reply)) {
+        m_reply = nullptr;
+        abort();
+        emit throttled();
+        return;
+    }
+
+    if (status == 416) {
+        // The stored part no longer fits the remote file; start over
+        m_reply = nullptr;
+        discard();
+        start();
+        return;
+    }
+
+    if (m_reply->error() != QNetworkReply::NoError) {
+        QNetworkReply *reply = m_reply;
+        m_reply = nullptr;
+        // Gone or forbidden for good: the partial data is of no use
+        if (status >= 400 && status < 500 && status != 408) {
+            failAndDiscard(reply->errorString());
+            return;
+        }
+
+        const int delay = retryDelay(reply, m_retries++);
+        if (delay < 0) {
+            fail(reply->errorString());
+            return;
+        }
+
+        // Keeps the part file when resumable, so the next attempt asks
+        // only for the rest
+        qDebug() << "Download of" << m_localPath << "failed:" << reply->errorString()
+                 << "- retrying in" << delay << "ms";
+        abort();
+        m_retryTimer.start(delay);
+        return;
+    }
+
+    bool drained = drainReply();
+    m_reply = nullptr;
+
+    if (!drained || !commit()) {
+        failAndDiscard("Failed to save file: " + m_localPath);
+        return;
+    }
+
+    if (m_retryPolicy)
+        m_retryPolicy->recordSuccess();
+    finish();
+}
+
+void DownloadTask::startSegments()
+{
+    m_bytesTotal = m_expectedSize;
+    if (m_file.size() != m_bytesTotal && !preallocate(m_bytesTotal)) {
+        qWarning() << "Could not preallocate" << m_bytesTotal << "bytes for" << m_localPath;
+    }
+
+    m_segmentSize = MIN_SEGMENT_SIZE;
+
+    // Fetch only the gaps an earlier attempt left
+    m_pendingRanges.clear();
+    qint64 next = 0;
+    for (const QPair<qint64, qint64> &done : m_doneRanges) {
+        if (done.first > next)
+            m_pendingRanges.append(qMakePair(next, done.first - 1));
+        next = done.second + 1;
+    }
+    if (next < m_bytesTotal)
+        m_pendingRanges.append(qMakePair(next, m_bytesTotal - 1));
+
+    if (m_pendingRanges.isEmpty()) {
+        // Everything was already there; report it once the caller returns
+        QTimer::singleShot(0, this, &DownloadTask::finishSegments);
+        return;
+    }
+
+    fillSegments();
+}
+
+void DownloadTask::fillSegments()
+{
+    // The first connection runs in the slot the transfer was scheduled
+    // into; each further one must find a free slot of its own
+    while (!m_pendingRanges.isEmpty()) {
+        if (m_segments.count() >= 1 + m_extraSlots.count()
+                && (m_segments.count() >= SEGMENT_CONNECTIONS || !acquireSlot()))
+            break;
+        startSegment();
+    }
+
+    // Hand back slots that no range needs any more
+    while (!m_extraSlots.isEmpty() && m_segments.count() < 1 + m_extraSlots.count()) {
+        m_scheduler->releaseSlot(m_extraSlots.takeLast());
+    }
+}
+
+bool DownloadTask::acquireSlot()
+{
+    if (!m_scheduler)
+        return false;
+
+    const int ticket = m_scheduler->tryAcquire(NetworkRequest::Bulk, this);
+    if (ticket == 0)
+        return false;
+    m_extraSlots.append(ticket);
+    return true;
+}
+
+void DownloadTask::releaseSlots()
+{
+    while (!m_extraSlots.isEmpty()) {
+        m_scheduler->releaseSlot(m_extraSlots.takeLast());
+    }
+}
+
+bool DownloadTask::startSegment()
+{
+    if (m_pendingRanges.isEmpty())
+        return false;
+
+    // Long gaps are cut into segments sized for the current rate
+    QPair<qint64, qint64> range = m_pendingRanges.takeFirst();
+    if (range.second - range.first + 1 > m_segmentSize) {
+        m_pendingRanges.prepend(qMakePair(range.first + m_segmentSize, range.second));
+        range.second = range.first + m_segmentSize - 1;
+    }
+
+    QNetworkRequest request(m_request);
+    request.setRawHeader("Range", "bytes=" + QByteArray::number(range.first) + '-' + QByteArray::number(range.second));
+
+    QNetworkReply *reply = m_manager->get(request);
+    reply->setReadBufferSize(READ_BUFFER_SIZE);
+
+    Segment &segment = m_segments[reply];
+    segment.start = range.first;
+    segment.offset = range.first;
+    segment.end = range.second;
+    segment.checked = false;
+    segment.timer.start();
+
+    connect(reply, &QNetworkReply::readyRead, this, &DownloadTask::handleSegmentReadyRead);
+    connect(reply, &QNetworkReply::finished, this, &DownloadTask::handleSegmentFinished);
+    return true;
+}
+
+void DownloadTask::handleSegmentReadyRead()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !m_segments.contains(reply) || reply->error() != QNetworkReply::NoError)
+        return;
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 200) {
+        // The server ignored Range and is sending the whole file
+        fallBackToStream();
+        return;
+    }
+    if (status != 206 || !checkRange(reply, m_segments[reply]))
+        return;
+
+    const qint64 written = m_bytesWritten;
+    if (!drainSegment(reply, m_segments[reply])) {
+        failAndDiscard("Failed to write file: " + m_localPath);
+        return;
+    }
+    if (m_bytesWritten > written)
+        m_retries = 0;
+
+    emit progress(m_bytesWritten, m_bytesTotal);
+}
+
+void DownloadTask::handleSegmentFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !m_segments.contains(reply))
+        return;
+
+    reply->deleteLater();
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if (status == 401) {
+        m_segments.remove(reply);
+        abort();
+        emit authorizationExpired(m_request.rawHeader("Authorization"));
+        return;
+    }
+
+    if (status >= 400 && RetryPolicy::isUnprocessed(reply)) {
+        m_segments.remove(reply);
+        abort();
+        emit throttled();
+        return;
+    }
+
+    if (status == 200 && reply->error() == QNetworkReply::NoError) {
+        fallBackToStream();
+        return;
+    }
+
+    if (status == 206 && !checkRange(reply, m_segments[reply]))
+        return;
+
+    Segment segment = m_segments.take(reply);
+    bool drained = reply->error() != QNetworkReply::NoError || status != 206 || drainSegment(reply, segment);
+    if (segment.offset > segment.start)
+        markDone(segment.start, segment.offset - 1);
+
+    if (!drained) {
+        failAndDiscard("Failed to write file: " + m_localPath);
+        return;
+    }
+
+    int delay = 0;
+    if (reply->error() == QNetworkReply::NoError && status == 206) {
+        adaptSegmentSize(segment);
+        saveProgress();
+    } else if (status >= 400 && status < 500 && status != 408) {
+        failAndDiscard(reply->errorString());
+        return;
+    } else if ((delay = retryDelay(reply, m_retries++)) < 0) {
+        fail(reply->errorString());
+        return;
+    }
+
+    // Whatever the range did not deliver is fetched again
+    if (segment.offset <= segment.end) {
+        m_pendingRanges.append(qMakePair(segment.offset, segment.end));
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        qDebug() << "Range" << segment.offset << "-" << segment.end << "failed:" << reply->errorString()
+                 << "- retrying in" << delay << "ms";
+        QTimer::singleShot(delay, this, [this]() {
+            if (m_file.isOpen() && !m_reply)
+                fillSegments();
+        });
+        return;
+    }
+
+    fillSegments();
+
+    if (m_segments.isEmpty() && m_pendingRanges.isEmpty())
+        finishSegments();
+}
+
+void DownloadTask::finishSegments()
+{
+    if (!m_file.isOpen())
+        return;
+
+    releaseSlots();
+
+    if (!commit()) {
+        failAndDiscard("Failed to save file: " + m_localPath);
+        return;
+    }
+    finish();
+}
+
+bool DownloadTask::checkRange(QNetworkReply *reply, Segment &segment)
+{
+    if (segment.checked)
+        return true;
+
+    // The size came from cached metadata; if the file has changed since,
+    // the planned ranges no longer cover it
+    const qint64 total = contentRangeTotal(reply);
+    if (total >= 0 && total != m_bytesTotal) {
+        restartWithSize(total);
+        return false;
+    }
+    segment.checked = true;
+    return true;
+}
+
+void DownloadTask::restartWithSize(qint64 size)
+{
+    qDebug() << m_localPath << "is" << size << "bytes on the server, not" << m_expectedSize << "- starting over";
+    discard();
+    m_expectedSize = size;
+    start();
+}
+
+qint64 DownloadTask::contentRangeTotal(const QNetworkReply *reply)
+{
+    // "bytes first-last/total", where total may be "*"
+    const QByteArray range = reply->rawHeader("Content-Range");
+    const int slash = range.lastIndexOf('/');
+    if (slash < 0)
+        return -1;
+
+    bool ok = false;
+    const qint64 total = range.mid(slash + 1).trimmed().toLongLong(&ok);
+    return ok ? total : -1;
+}
+
+bool DownloadTask::drainSegment(QNetworkReply *reply, Segment &segment)
+{
+    if (!m_file.seek(segment.offset))
+        return false;
+
+    while (reply->bytesAvailable() > 0) {
+        qint64 read = reply->read(m_chunk.data(), m_chunk.size());
+        if (read <= 0)
+            break;
+
+        // Never write past the range, whatever the server sends
+        qint64 length = qMin(read, segment.end - segment.offset + 1);
+        if (length <= 0)
+            break;
+        if (m_file.write(m_chunk.constData(), length) != length)
+            return false;
+
+        segment.offset += length;
+        m_bytesWritten += length;
+    }
+    return true;
+}
+
+int DownloadTask::retryDelay(QNetworkReply *reply, int attempt)
+{
+    // A body cut off after a good status line is as transient as a
+    // dropped connection, whatever the status says
+    const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (m_retryPolicy && (status < 200 || status >= 300))
+        return m_retryPolicy->retryDelay(reply, attempt, true);
+
+    const int maxAttempts = m_retryPolicy ? m_retryPolicy->maxAttempts() : MAX_RETRIES + 1;
+    if (attempt + 1 >= maxAttempts)
+        return -1;
+    return m_retryPolicy ? m_retryPolicy->backoff(attempt) : qMin(1000 << attempt, 32000);
+}
+
+void DownloadTask::adaptSegmentSize(const Segment &segment)
+{
+    qint64 elapsed = qMax<qint64>(1, segment.timer.elapsed());
+    qint64 rate = (segment.offset - segment.start) * 1000 / elapsed;
+
+    // Whole chunks, so ranges line up with the read buffer
+    qint64 size = qBound(MIN_SEGMENT_SIZE, rate * SEGMENT_SECONDS, MAX_SEGMENT_SIZE);
+    m_segmentSize = size / CHUNK_SIZE * CHUNK_SIZE;
+}
+
+void DownloadTask::fallBackToStream()
+{
+    qDebug() << "Range requests not honoured for" << m_localPath << "- downloading as one stream";
+    abortSegments();
+    releaseSlots();
+
+    m_ranged = false;
+    m_pendingRanges.clear();
+    m_doneRanges.clear();
+    m_bytesWritten = 0;
+    m_bytesTotal = -1;
+    if (!m_file.resize(0)) {
+        failAndDiscard("Failed to save file: " + m_localPath);
+        return;
+    }
+    startStream();
+}
+
+void DownloadTask::abortSegments()
+{
+    const QList<QNetworkReply*> replies = m_segments.keys();
+    m_segments.clear();
+    for (QNetworkReply *reply : replies) {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+bool DownloadTask::preallocate(qint64 size)
+{
+#ifdef Q_OS_LINUX
+    // Reserve the blocks up front so the filesystem can lay the file out
+    // contiguously and a full disk is reported before any data is fetched.
+    if (posix_fallocate(m_file.handle(), 0, size) == 0)
+        return true;
+#endif
+    return m_file.resize(size);
+}
+
+bool DownloadTask::drainReply()
+{
+    while (m_reply->bytesAvailable() > 0) {
+        qint64 read = m_reply->read(m_chunk.data(), m_chunk.size());
+        if (read <= 0)
+            break;
+        if (m_file.write(m_chunk.constData(), read) != read)
+            return false;
+        m_bytesWritten += read;
+    }
+    return true;
+}
+
+bool DownloadTask::commit()
+{
+    // Drop any preallocated tail the server did not fill
+    if (m_file.size() != m_bytesWritten && !m_file.resize(m_bytesWritten))
+        return false;
+
+    if (!m_file.flush())
+        return false;
+
+#ifdef Q_OS_LINUX
+    fsync(m_file.handle());
+#endif
+    m_file.close();
+
+    // rename(2) replaces an existing destination atomically, which
+    // QFile::rename() refuses to do.
+    if (std::rename(QFile::encodeName(m_file.fileName()).constData(),
+                    QFile::encodeName(m_localPath).constData()) != 0) {
+        m_file.remove();
+        return false;
+    }
+    QFile::remove(progressPath(m_localPath));
+    m_doneRanges.clear();
+    return true;
+}
+
+void DownloadTask::finish()
+{
+    emit progress(m_bytesWritten, m_bytesWritten);
+
+    if (m_md5.isEmpty() || !m_checksums) {
+        emit finished(m_localPath);
+        return;
+    }
+
+    // Resumed parts and ranges are pieced together from several replies;
+    // make sure they add up to the file Drive has
+    connect(m_checksums, &ChecksumEngine::checksumReady, this, &DownloadTask::handleChecksum);
+    m_checksums->requestMd5(m_localPath);
+}
+
+void DownloadTask::handleChecksum(const QString &localPath, const QString &md5)
+{
+    if (localPath != m_localPath)
+        return;
+
+    disconnect(m_checksums, &ChecksumEngine::checksumReady, this, &DownloadTask::handleChecksum);
+    if (md5.compare(m_md5, Qt::CaseInsensitive) != 0) {
+        qWarning() << "Checksum mismatch for" << m_localPath << "- expected" << m_md5 << "got" << md5;
+        QFile::remove(m_localPath);
+        emit failed("Downloaded file is damaged: " + m_localPath);
+        return;
+    }
+    emit finished(m_localPath);
+}
+
+void DownloadTask::fail(const QString &error)
+{
+    abort();
+    emit failed(error);
+}
+
+void DownloadTask::failAndDiscard(const QString &error)
+{
+    discard();
+    emit failed(error);
+}
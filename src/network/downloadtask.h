@@ -0,0 +1,174 @@
+#ifndef DOWNLOADTASK_H
+#define DOWNLOADTASK_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTimer>
+
+class ChecksumEngine;
+class NetworkRequest;
+class RetryPolicy;
+
+// Streams a single HTTP response body to disk. Data is written chunk by
+// chunk into "<localPath>.part" as it arrives and the part file is renamed
+// over the destination once the body is complete, so memory use does not
+// depend on the size of the file.
+//
+// Files whose size is known up front and large enough are fetched as byte
+// ranges over several connections, each written in place into the
+// preallocated part file. Segment sizes follow the measured throughput so
+// a range takes a few seconds on whatever link we are on. Every connection
+// past the first needs a free slot in the scheduler's bulk lane; without
+// one the file comes as a single stream.
+//
+// When the task knows the file id and revision, an interrupted download
+// keeps its part file and records the byte ranges already stored in a
+// sidecar next to it. The next start() for the same revision only fetches
+// what is missing. The revision has to come from current metadata, and
+// with an MD5 set the finished file is checked against it before
+// finished() is emitted.
+class DownloadTask : public QObject
+{
+    Q_OBJECT
+
+public:
+    DownloadTask(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                 const QString &localPath, QObject *parent = nullptr);
+    ~DownloadTask();
+
+    QString localPath() const { return m_localPath; }
+    QNetworkRequest request() const { return m_request; }
+    void setRequest(const QNetworkRequest &request) { m_request = request; }
+    qint64 bytesReceived() const { return m_bytesWritten; }
+    qint64 bytesTotal() const { return m_bytesTotal; }
+
+    // Identify the remote file for the content cache
+    QString fileId() const { return m_fileId; }
+    void setFileId(const QString &fileId) { m_fileId = fileId; }
+    QString version() const { return m_version; }
+    void setVersion(const QString &version) { m_version = version; }
+
+    // Size from the file metadata, -1 if unknown; enables ranged downloads
+    qint64 expectedSize() const { return m_expectedSize; }
+    void setExpectedSize(qint64 size) { m_expectedSize = size; }
+
+    // Where extra range connections take their slots; none without it
+    void setScheduler(NetworkRequest *scheduler) { m_scheduler = scheduler; }
+
+    // Expected content checksum, verified through checksums when both set
+    QString md5() const { return m_md5; }
+    void setMd5(const QString &md5) { m_md5 = md5; }
+    void setChecksums(ChecksumEngine *checksums) { m_checksums = checksums; }
+
+    // Decides when failed requests are sent again; a few plain retries
+    // without it. 401s and throttling are left to the owner, see below.
+    void setRetryPolicy(RetryPolicy *policy) { m_retryPolicy = policy; }
+
+    void start();
+    // Stops; the part file is kept for a later start() if it can resume
+    void abort();
+    // Stops and throws away whatever was downloaded
+    void discard();
+
+    static QString partPath(const QString &localPath);
+    static QString progressPath(const QString &localPath);
+
+signals:
+    void progress(qint64 bytesReceived, qint64 bytesTotal);
+    void finished(const QString &localPath);
+    void failed(const QString &error);
+    // The server rejected the token; start() again with a new one
+    void authorizationExpired(const QByteArray &authorization);
+    // The server turned the request away under load; start() again later
+    void throttled();
+
+private slots:
+    void handleMetaDataChanged();
+    void handleReadyRead();
+    void handleFinished();
+    void handleSegmentReadyRead();
+    void handleSegmentFinished();
+    void handleChecksum(const QString &localPath, const QString &md5);
+
+private:
+    struct Segment {
+        qint64 start;
+        qint64 offset;  // next byte to write
+        qint64 end;     // last byte of the range
+        bool checked;   // Content-Range matched the expected size
+        QElapsedTimer timer;
+    };
+
+    bool isResumable() const { return !m_fileId.isEmpty() && !m_version.isEmpty(); }
+    bool restoreProgress();
+    void saveProgress();
+    void markDone(qint64 first, qint64 last);
+    void startStream();
+    void startSegments();
+    bool startSegment();
+    void fillSegments();
+    bool acquireSlot();
+    void releaseSlots();
+    void finishSegments();
+    void fallBackToStream();
+    void abortSegments();
+    bool drainSegment(QNetworkReply *reply, Segment &segment);
+    bool checkRange(QNetworkReply *reply, Segment &segment);
+    void restartWithSize(qint64 size);
+    static qint64 contentRangeTotal(const QNetworkReply *reply);
+    int retryDelay(QNetworkReply *reply, int attempt);
+    void adaptSegmentSize(const Segment &segment);
+    bool preallocate(qint64 size);
+    bool drainReply();
+    bool commit();
+    void finish();
+    void fail(const QString &error);
+    void failAndDiscard(const QString &error);
+
+    QNetworkAccessManager *m_manager;
+    NetworkRequest *m_scheduler;
+    ChecksumEngine *m_checksums;
+    RetryPolicy *m_retryPolicy;
+    QList<int> m_extraSlots;    // bulk lane tickets, one per extra connection
+    QNetworkRequest m_request;
+    QString m_localPath;
+    QString m_fileId;
+    QString m_version;
+    QString m_md5;
+    QFile m_file;
+    QNetworkReply *m_reply;
+    QByteArray m_chunk;
+    qint64 m_bytesWritten;
+    qint64 m_bytesTotal;
+    qint64 m_expectedSize;
+    QHash<QNetworkReply*, Segment> m_segments;
+    QList<QPair<qint64, qint64> > m_pendingRanges;
+    // Stored byte ranges, sorted and merged, last byte inclusive
+    QList<QPair<qint64, qint64> > m_doneRanges;
+    bool m_ranged;
+    qint64 m_streamOffset;
+    qint64 m_lastSaved;
+    qint64 m_segmentSize;
+    int m_retries;              // since data last arrived
+    QTimer m_retryTimer;
+
+    static const qint64 READ_BUFFER_SIZE;
+    static const int CHUNK_SIZE;
+    static const qint64 SEGMENTED_MIN_SIZE;
+    static const int SEGMENT_CONNECTIONS;
+    static const qint64 MIN_SEGMENT_SIZE;
+    static const qint64 MAX_SEGMENT_SIZE;
+    static const int SEGMENT_SECONDS;
+    static const int MAX_RETRIES;
+    static const qint64 SAVE_INTERVAL;
+};
+
+#endif // DOWNLOADTASK_H
@@ -1,6 +1,190 @@
 #include "networkrequest.h"
+#include <QDebug>
+
+const int NetworkRequest::MAX_BULK_CONNECTIONS = 4;
 
 NetworkRequest::NetworkRequest(QObject *parent)
     : QObject(parent)
+    , m_nextTicket(1)
+    , m_dispatching(false)
+{
+    // QNetworkAccessManager opens at most six connections per host; keep
+    // two of them out of reach of bulk transfers
+    m_limits[Interactive] = 4;
+    m_limits[Thumbnail] = 4;
+    m_limits[Bulk] = 2;
+
+    for (int i = 0; i < PriorityCount; ++i) {
+        m_active[i] = 0;
+        m_peakDepth[i] = 0;
+    }
+}
+
+void NetworkRequest::enqueue(Priority priority, QObject *owner, const std::function<void()> &start)
+{
+    Job job;
+    job.ticket = m_nextTicket++;
+    job.owner = owner;
+    job.start = start;
+    push(priority, job);
+}
+
+void NetworkRequest::enqueueReply(Priority priority, QObject *owner, const std::function<QNetworkReply*()> &send)
+{
+    Job job;
+    job.ticket = m_nextTicket++;
+    job.owner = owner;
+    job.send = send;
+    push(priority, job);
+}
+
+int NetworkRequest::tryAcquire(Priority priority, QObject *owner)
+{
+    if (m_active[priority] >= m_limits[priority] || !m_queues[priority].isEmpty())
+        return 0;
+
+    if (owner) {
+        connect(owner, &QObject::destroyed, this, &NetworkRequest::handleOwnerDestroyed, Qt::UniqueConnection);
+    }
+
+    Running running;
+    running.priority = priority;
+    running.owner = owner;
+    const int ticket = m_nextTicket++;
+    m_running.insert(ticket, running);
+    ++m_active[priority];
+    return ticket;
+}
+
+void NetworkRequest::releaseSlot(int ticket)
+{
+    if (!m_running.contains(ticket))
+        return;
+
+    release(ticket);
+    dispatch();
+    emit queueChanged();
+}
+
+void NetworkRequest::cancel(QObject *owner)
+{
+    bool changed = false;
+
+    for (int i = 0; i < PriorityCount; ++i) {
+        QList<Job> &queue = m_queues[i];
+        for (int j = queue.count() - 1; j >= 0; --j) {
+            if (queue.at(j).owner == owner) {
+                queue.removeAt(j);
+                changed = true;
+            }
+        }
+    }
+
+    QList<int> tickets;
+    for (QHash<int, Running>::const_iterator it = m_running.constBegin(); it != m_running.constEnd(); ++it) {
+        if (it->owner == owner)
+            tickets.append(it.key());
+    }
+
+    for (int ticket : tickets) {
+        QPointer<QNetworkReply> reply = m_running.value(ticket).reply;
+        release(ticket);
+        if (reply) {
+            reply->abort();
+        }
+        changed = true;
+    }
+
+    if (changed) {
+        dispatch();
+        emit queueChanged();
+    }
+}
+
+void NetworkRequest::setLaneLimit(Priority priority, int limit)
 {
+    m_limits[priority] = qMax(1, priority == Bulk ? qMin(limit, MAX_BULK_CONNECTIONS) : limit);
+    dispatch();
+}
+
+int NetworkRequest::totalQueueDepth() const
+{
+    int depth = 0;
+    for (int i = 0; i < PriorityCount; ++i) {
+        depth += m_queues[i].count();
+    }
+    return depth;
+}
+
+void NetworkRequest::handleOwnerDestroyed(QObject *owner)
+{
+    cancel(owner);
+}
+
+void NetworkRequest::push(Priority priority, const Job &job)
+{
+    if (job.owner) {
+        connect(job.owner, &QObject::destroyed, this, &NetworkRequest::handleOwnerDestroyed, Qt::UniqueConnection);
+    }
+
+    m_queues[priority].append(job);
+    m_peakDepth[priority] = qMax(m_peakDepth[priority], m_queues[priority].count());
+
+    dispatch();
+    emit queueChanged();
+}
+
+void NetworkRequest::dispatch()
+{
+    // A job may finish synchronously and release its slot from inside run()
+    if (m_dispatching)
+        return;
+    m_dispatching = true;
+
+    for (int i = 0; i < PriorityCount; ++i) {
+        Priority priority = static_cast<Priority>(i);
+        while (m_active[i] < m_limits[i] && !m_queues[i].isEmpty()) {
+            run(priority, m_queues[i].takeFirst());
+        }
+    }
+
+    m_dispatching = false;
+}
+
+void NetworkRequest::run(Priority priority, const Job &job)
+{
+    Running running;
+    running.priority = priority;
+    running.owner = job.owner;
+    m_running.insert(job.ticket, running);
+    ++m_active[priority];
+
+    if (job.start) {
+        job.start();
+        return;
+    }
+
+    QNetworkReply *reply = job.send();
+    if (!reply || reply->isFinished()) {
+        release(job.ticket);
+        return;
+    }
+
+    m_running[job.ticket].reply = reply;
+    int ticket = job.ticket;
+    connect(reply, &QNetworkReply::finished, this, [this, ticket]() {
+        release(ticket);
+        dispatch();
+        emit queueChanged();
+    });
+}
+
+void NetworkRequest::release(int ticket)
+{
+    QHash<int, Running>::iterator it = m_running.find(ticket);
+    if (it == m_running.end())
+        return;
+
+    --m_active[it->priority];
+    m_running.erase(it);
 }
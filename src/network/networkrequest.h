@@ -2,12 +2,96 @@
 #define NETWORKREQUEST_H
 
 #include <QObject>
+#include <QHash>
+#include <QList>
+#include <QNetworkReply>
+#include <QPointer>
+#include <functional>
 
+// Schedules network work in priority lanes. Each lane has its own limit on
+// how many jobs run at once, so bulk transfers cannot take every connection
+// Qt keeps to a host and leave folder listings waiting behind them. Lanes
+// are started in priority order whenever a slot frees up.
 class NetworkRequest : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(int queueDepth READ totalQueueDepth NOTIFY queueChanged)
+
 public:
+    enum Priority {
+        Interactive,    // metadata the user is waiting for
+        Thumbnail,
+        Bulk,           // file transfers
+        PriorityCount
+    };
+    Q_ENUM(Priority)
+
     explicit NetworkRequest(QObject *parent = nullptr);
+
+    // Runs start once a slot in the lane is free. The slot is held until
+    // cancel() is called for the owner or the owner is destroyed; for
+    // long-running work such as transfers that issue several replies.
+    void enqueue(Priority priority, QObject *owner, const std::function<void()> &start);
+
+    // Calls send once a slot is free and holds the slot until the returned
+    // reply finishes. send is expected to connect its own handlers. owner
+    // may be null for work that is canceled through its reply instead.
+    void enqueueReply(Priority priority, QObject *owner, const std::function<QNetworkReply*()> &send);
+
+    // Takes a free slot in the lane right away, for work that can also
+    // make do without it. Returns 0 when the lane is full or others are
+    // already waiting for it; otherwise a ticket for releaseSlot().
+    int tryAcquire(Priority priority, QObject *owner);
+    void releaseSlot(int ticket);
+
+    // Drops queued jobs of owner and releases its running slots, aborting
+    // replies that are still in flight
+    void cancel(QObject *owner);
+
+    int laneLimit(Priority priority) const { return m_limits[priority]; }
+    void setLaneLimit(Priority priority, int limit);
+
+    int queueDepth(Priority priority) const { return m_queues[priority].count(); }
+    int activeCount(Priority priority) const { return m_active[priority]; }
+    int peakQueueDepth(Priority priority) const { return m_peakDepth[priority]; }
+    int totalQueueDepth() const;
+
+    // Qt opens six connections per host; bulk transfers may hold at most
+    // this many so API calls and thumbnails always find one
+    static const int MAX_BULK_CONNECTIONS;
+
+signals:
+    void queueChanged();
+
+private slots:
+    void handleOwnerDestroyed(QObject *owner);
+
+private:
+    struct Job {
+        int ticket;
+        QObject *owner;
+        std::function<void()> start;
+        std::function<QNetworkReply*()> send;
+    };
+
+    struct Running {
+        Priority priority;
+        QObject *owner;
+        QPointer<QNetworkReply> reply;
+    };
+
+    void push(Priority priority, const Job &job);
+    void dispatch();
+    void run(Priority priority, const Job &job);
+    void release(int ticket);
+
+    QList<Job> m_queues[PriorityCount];
+    int m_limits[PriorityCount];
+    int m_active[PriorityCount];
+    int m_peakDepth[PriorityCount];
+    QHash<int, Running> m_running;
+    int m_nextTicket;
+    bool m_dispatching;
 };
 
 #endif // NETWORKREQUEST_H
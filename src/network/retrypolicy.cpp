@@ -0,0 +1,151 @@
+#include "retrypolicy.h"
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocale>
+#include <QTime>
+
+const int RetryPolicy::BASE_DELAY = 1000;
+const int RetryPolicy::MAX_DELAY = 32000;
+// Up to ten retries in a row, then one more per ten successful requests
+const double RetryPolicy::MAX_BUDGET = 10.0;
+const double RetryPolicy::SUCCESS_REFILL = 0.1;
+
+namespace {
+
+// Drive reports quota errors as 403 with a reason in the body
+bool isRateLimited(const QByteArray &body)
+{
+    QJsonObject error = QJsonDocument::fromJson(body).object().value("error").toObject();
+    const QJsonArray errors = error.value("errors").toArray();
+    for (const QJsonValue &entry : errors) {
+        QString reason = entry.toObject().value("reason").toString();
+        if (reason == "rateLimitExceeded" || reason == "userRateLimitExceeded")
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+RetryPolicy::RetryPolicy(QObject *parent)
+    : QObject(parent)
+    , m_maxAttempts(5)
+    , m_budget(MAX_BUDGET)
+    , m_retryCount(0)
+    , m_exhaustedCount(0)
+{
+    qsrand(static_cast<uint>(QTime::currentTime().msecsSinceStartOfDay()));
+}
+
+int RetryPolicy::retryDelay(QNetworkReply *reply, int attempt, bool idempotent)
+{
+    if (!isTransient(reply))
+        return -1;
+
+    if (!idempotent && !isUnprocessed(reply))
+        return -1;
+
+    if (attempt + 1 >= m_maxAttempts || m_budget < 1.0) {
+        ++m_exhaustedCount;
+        emit countersChanged();
+        return -1;
+    }
+
+    m_budget -= 1.0;
+    ++m_retryCount;
+    emit countersChanged();
+
+    int delay = retryAfter(reply);
+    return delay < 0 ? backoff(attempt) : delay;
+}
+
+void RetryPolicy::recordSuccess()
+{
+    m_budget = qMin(MAX_BUDGET, m_budget + SUCCESS_REFILL);
+}
+
+bool RetryPolicy::isTransient(QNetworkReply *reply)
+{
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status != 0)
+        return isTransientStatus(status, reply->peek(reply->bytesAvailable()));
+
+    switch (reply->error()) {
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownNetworkError:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool RetryPolicy::isUnprocessed(QNetworkReply *reply)
+{
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status != 0)
+        return isUnprocessedStatus(status, reply->peek(reply->bytesAvailable()));
+
+    return reply->error() == QNetworkReply::ConnectionRefusedError
+            || reply->error() == QNetworkReply::HostNotFoundError;
+}
+
+bool RetryPolicy::isTransientStatus(int status, const QByteArray &body)
+{
+    switch (status) {
+    case 408:
+    case 429:
+    case 500:
+    case 502:
+    case 503:
+    case 504:
+        return true;
+    case 403:
+        return isRateLimited(body);
+    default:
+        return false;
+    }
+}
+
+bool RetryPolicy::isUnprocessedStatus(int status, const QByteArray &body)
+{
+    // The request was turned away before the server acted on it
+    return status == 429 || status == 503 || (status == 403 && isRateLimited(body));
+}
+
+int RetryPolicy::retryAfter(QNetworkReply *reply)
+{
+    QByteArray value = reply->rawHeader("Retry-After").trimmed();
+    if (value.isEmpty())
+        return -1;
+
+    // Either delta-seconds or an HTTP date
+    bool ok = false;
+    int seconds = value.toInt(&ok);
+    if (ok)
+        return qBound(0, seconds, MAX_DELAY / 1000 * 2) * 1000;
+
+    QDateTime date = QLocale::c().toDateTime(QString::fromLatin1(value), "ddd, dd MMM yyyy HH:mm:ss 'GMT'");
+    if (!date.isValid())
+        return -1;
+    date.setTimeSpec(Qt::UTC);
+
+    qint64 delay = QDateTime::currentDateTimeUtc().msecsTo(date);
+    return static_cast<int>(qBound<qint64>(0, delay, MAX_DELAY * 2));
+}
+
+int RetryPolicy::backoff(int attempt) const
+{
+    // Equal jitter: half the exponential step plus a random share of the
+    // other half, so clients that failed together do not retry together
+    int ceiling = qMin(BASE_DELAY << qMin(attempt, 10), MAX_DELAY);
+    int half = ceiling / 2;
+    return half + qrand() % (half + 1);
+}
@@ -0,0 +1,62 @@
+#ifndef RETRYPOLICY_H
+#define RETRYPOLICY_H
+
+#include <QObject>
+#include <QNetworkReply>
+
+// Decides whether a failed request is sent again and after how long.
+// Transient failures are retried with exponential backoff and jitter, or
+// after the server's Retry-After when it sends one. Retries draw from a
+// budget that successful requests refill, so a struggling API is not
+// hammered into further throttling.
+class RetryPolicy : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int retryCount READ retryCount NOTIFY countersChanged)
+    Q_PROPERTY(int exhaustedCount READ exhaustedCount NOTIFY countersChanged)
+
+public:
+    explicit RetryPolicy(QObject *parent = nullptr);
+
+    // Milliseconds to wait before attempt number attempt + 1, or -1 if the
+    // request should fail now. Non-idempotent requests are only retried
+    // when the server cannot have acted on them.
+    int retryDelay(QNetworkReply *reply, int attempt, bool idempotent);
+
+    // Refills the retry budget
+    void recordSuccess();
+
+    int maxAttempts() const { return m_maxAttempts; }
+    void setMaxAttempts(int attempts) { m_maxAttempts = attempts; }
+
+    int retryCount() const { return m_retryCount; }
+    int exhaustedCount() const { return m_exhaustedCount; }
+
+    // Jittered exponential delay for the given attempt
+    int backoff(int attempt) const;
+
+    static bool isTransient(QNetworkReply *reply);
+    static bool isUnprocessed(QNetworkReply *reply);
+    static int retryAfter(QNetworkReply *reply);
+
+    // Same checks for responses that are not a QNetworkReply of their own,
+    // e.g. the parts of a batch response
+    static bool isTransientStatus(int status, const QByteArray &body);
+    static bool isUnprocessedStatus(int status, const QByteArray &body);
+
+signals:
+    void countersChanged();
+
+private:
+    int m_maxAttempts;
+    double m_budget;
+    int m_retryCount;
+    int m_exhaustedCount;
+
+    static const int BASE_DELAY;
+    static const int MAX_DELAY;
+    static const double MAX_BUDGET;
+    static const double SUCCESS_REFILL;
+};
+
+#endif // RETRYPOLICY_H
@@ -0,0 +1,273 @@
+#include "thumbnailprovider.h"
+#include <QDateTime>
+#include <QImageReader>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QtConcurrent>
+#include <QDebug>
+#include "../googledrive/googledriveapi.h"
+
+// Decoded images shared by all pages, counted in KiB
+const int ThumbnailProvider::MEMORY_CACHE_KB = 16 * 1024;
+// Size requested from Drive; one stored copy serves list rows and details
+const int ThumbnailProvider::THUMBNAIL_SIZE = 640;
+const QString ThumbnailProvider::PROVIDER_ID = "drivethumb";
+const QString ThumbnailProvider::FILES_URL = "https://www.googleapis.com/drive/v3/files/";
+
+namespace {
+
+// Runs on the decode pool
+QImage decodeThumbnail(const QString &path, const QSize &requestedSize)
+{
+    QImageReader reader(path);
+    QSize size = reader.size();
+
+    // Let the reader scale while decoding instead of decoding at full size.
+    // With both dimensions given the image covers the box, so cropping
+    // delegates never scale up.
+    int width = requestedSize.width();
+    int height = requestedSize.height();
+    if (size.isValid() && (width > 0 || height > 0)) {
+        QSize scaled = width > 0 && height > 0
+                ? size.scaled(requestedSize, Qt::KeepAspectRatioByExpanding)
+                : size.scaled(width > 0 ? width : size.width(), height > 0 ? height : size.height(),
+                              Qt::KeepAspectRatio);
+        if (scaled.width() < size.width())
+            reader.setScaledSize(scaled);
+    }
+
+    return reader.read();
+}
+
+} // namespace
+
+ThumbnailProvider::ThumbnailProvider(GoogleDriveApi *api, FileCache *fileCache)
+    : m_api(api)
+    , m_fileCache(fileCache)
+    , m_scheduler(api->scheduler())
+    , m_networkManager(new QNetworkAccessManager)
+    , m_images(MEMORY_CACHE_KB)
+{
+    m_decodePool.setMaxThreadCount(2);
+}
+
+ThumbnailProvider::~ThumbnailProvider()
+{
+    m_decodePool.waitForDone();
+    delete m_networkManager;
+}
+
+QQuickImageResponse *ThumbnailProvider::requestImageResponse(const QString &id, const QSize &requestedSize)
+{
+    // Called on the image loader thread; the work is done on the GUI thread
+    ThumbnailResponse *response = new ThumbnailResponse(this, id, requestedSize);
+    response->moveToThread(m_networkManager->thread());
+    QMetaObject::invokeMethod(response, "start", Qt::QueuedConnection);
+    return response;
+}
+
+ThumbnailResponse::ThumbnailResponse(ThumbnailProvider *provider, const QString &fileId, const QSize &requestedSize)
+    : m_provider(provider)
+    , m_fileId(fileId)
+    , m_requestedSize(requestedSize)
+    , m_cacheKey(QString("%1@%2x%3").arg(fileId).arg(requestedSize.width()).arg(requestedSize.height()))
+    , m_handler(nullptr)
+    , m_decoder(this)
+    , m_reauthorized(false)
+    , m_done(false)
+{
+    connect(&m_decoder, &QFutureWatcher<QImage>::finished, this, &ThumbnailResponse::handleDecoded);
+}
+
+QQuickTextureFactory *ThumbnailResponse::textureFactory() const
+{
+    return QQuickTextureFactory::textureFactoryForImage(m_image);
+}
+
+QString ThumbnailResponse::errorString() const
+{
+    return m_error;
+}
+
+void ThumbnailResponse::cancel()
+{
+    QMetaObject::invokeMethod(this, "abortRequest", Qt::QueuedConnection);
+}
+
+void ThumbnailResponse::start()
+{
+    if (m_done)
+        return;
+
+    QImage *cached = m_provider->m_images.object(m_cacheKey);
+    if (cached) {
+        finish(*cached);
+        return;
+    }
+
+    // A stored thumbnail is good unless the file changed after it was fetched
+    const QJsonObject metadata = m_provider->m_fileCache->fileMetadata(m_fileId);
+    QDateTime modified = QDateTime::fromString(metadata.value("modifiedTime").toString(), Qt::ISODate);
+    if (m_provider->m_fileCache->hasThumbnail(m_fileId, modified.isValid() ? modified.toMSecsSinceEpoch() : 0)) {
+        decode();
+        return;
+    }
+
+    QString link = metadata.value("thumbnailLink").toString();
+    if (link.isEmpty()) {
+        fetchMetadata();
+    } else {
+        fetchThumbnail(link);
+    }
+}
+
+void ThumbnailResponse::abortRequest()
+{
+    if (m_reply) {
+        m_reply->disconnect(this);
+        m_reply->deleteLater();
+        m_reply.clear();
+    }
+
+    // Drops the request if it is still queued, aborts it otherwise
+    m_provider->m_scheduler->cancel(this);
+
+    if (!m_done)
+        fail("Cancelled");
+}
+
+void ThumbnailResponse::fetchMetadata()
+{
+    // Files outside the cached listings, e.g. search results
+    QNetworkRequest request(QUrl(ThumbnailProvider::FILES_URL + m_fileId + "?fields=thumbnailLink"));
+    send(request, &ThumbnailResponse::handleMetadataReply);
+}
+
+void ThumbnailResponse::fetchThumbnail(const QString &link)
+{
+    // thumbnailLink ends in "=s220"; ask for the size we store instead
+    QString sized = link;
+    sized.replace(QRegularExpression("=s\\d+$"), QString("=s%1").arg(ThumbnailProvider::THUMBNAIL_SIZE));
+
+    QNetworkRequest request{QUrl(sized)};
+    send(request, &ThumbnailResponse::handleThumbnailReply);
+}
+
+void ThumbnailResponse::send(const QNetworkRequest &request, void (ThumbnailResponse::*handler)())
+{
+    m_request = request;
+    m_handler = handler;
+    authorize(QByteArray());
+}
+
+void ThumbnailResponse::authorize(const QByteArray &rejected)
+{
+    // The token comes from the API, which holds this back while it
+    // refreshes, just like its own requests
+    m_provider->m_api->authorize(this, rejected, [this](const QByteArray &authorization) {
+        if (m_done)
+            return;
+        if (authorization.isEmpty()) {
+            fail("Authorization failed");
+            return;
+        }
+
+        QNetworkRequest request = m_request;
+        request.setRawHeader("Authorization", authorization);
+        void (ThumbnailResponse::*handler)() = m_handler;
+
+        // Thumbnails have their own lane so they neither wait behind
+        // transfers nor delay folder listings
+        m_provider->m_scheduler->enqueueReply(NetworkRequest::Thumbnail, this, [this, request, handler]() {
+            m_reply = m_provider->m_networkManager->get(request);
+            connect(m_reply, &QNetworkReply::finished, this, handler);
+            return m_reply.data();
+        });
+    });
+}
+
+bool ThumbnailResponse::retryUnauthorized(QNetworkReply *reply)
+{
+    // Once only: a second 401 right after a refresh means the grant is gone
+    if (m_reauthorized || reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 401)
+        return false;
+
+    m_reauthorized = true;
+    authorize(reply->request().rawHeader("Authorization"));
+    return true;
+}
+
+void ThumbnailResponse::handleMetadataReply()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply.clear();
+    reply->deleteLater();
+
+    if (retryUnauthorized(reply))
+        return;
+    if (reply->error() != QNetworkReply::NoError) {
+        fail(reply->errorString());
+        return;
+    }
+
+    QString link = QJsonDocument::fromJson(reply->readAll()).object().value("thumbnailLink").toString();
+    if (link.isEmpty()) {
+        fail("No thumbnail available");
+        return;
+    }
+
+    fetchThumbnail(link);
+}
+
+void ThumbnailResponse::handleThumbnailReply()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply.clear();
+    reply->deleteLater();
+
+    if (retryUnauthorized(reply))
+        return;
+    if (reply->error() != QNetworkReply::NoError) {
+        fail(reply->errorString());
+        return;
+    }
+
+    m_provider->m_fileCache->storeThumbnail(m_fileId, reply->readAll());
+    decode();
+}
+
+void ThumbnailResponse::decode()
+{
+    m_decoder.setFuture(QtConcurrent::run(&m_provider->m_decodePool, decodeThumbnail,
+                                          m_provider->m_fileCache->thumbnailPath(m_fileId), m_requestedSize));
+}
+
+void ThumbnailResponse::handleDecoded()
+{
+    if (m_done)
+        return;
+
+    QImage image = m_decoder.result();
+    if (image.isNull()) {
+        fail("Cannot decode thumbnail");
+        return;
+    }
+
+    m_provider->m_images.insert(m_cacheKey, new QImage(image), qMax(1, image.byteCount() / 1024));
+    finish(image);
+}
+
+void ThumbnailResponse::finish(const QImage &image)
+{
+    m_image = image;
+    m_done = true;
+    emit finished();
+}
+
+void ThumbnailResponse::fail(const QString &error)
+{
+    m_error = error;
+    m_done = true;
+    emit finished();
+}
@@ -0,0 +1,91 @@
+#ifndef THUMBNAILPROVIDER_H
+#define THUMBNAILPROVIDER_H
+
+#include <QCache>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QQuickAsyncImageProvider>
+#include <QThreadPool>
+#include "networkrequest.h"
+#include "../storage/filecache.h"
+
+class GoogleDriveApi;
+class ThumbnailProvider;
+
+// One image://drivethumb request. Runs on the GUI thread, where the network
+// manager and the caches live; only decoding happens on the worker pool.
+class ThumbnailResponse : public QQuickImageResponse
+{
+    Q_OBJECT
+
+public:
+    ThumbnailResponse(ThumbnailProvider *provider, const QString &fileId, const QSize &requestedSize);
+
+    QQuickTextureFactory *textureFactory() const override;
+    QString errorString() const override;
+    void cancel() override;
+
+private slots:
+    void start();
+    void abortRequest();
+    void handleMetadataReply();
+    void handleThumbnailReply();
+    void handleDecoded();
+
+private:
+    void fetchMetadata();
+    void fetchThumbnail(const QString &link);
+    void send(const QNetworkRequest &request, void (ThumbnailResponse::*handler)());
+    void authorize(const QByteArray &rejected);
+    bool retryUnauthorized(QNetworkReply *reply);
+    void decode();
+    void finish(const QImage &image);
+    void fail(const QString &error);
+
+    ThumbnailProvider *m_provider;
+    QString m_fileId;
+    QSize m_requestedSize;
+    QString m_cacheKey;
+    QNetworkRequest m_request;
+    void (ThumbnailResponse::*m_handler)();
+    QPointer<QNetworkReply> m_reply;
+    QFutureWatcher<QImage> m_decoder;
+    QImage m_image;
+    QString m_error;
+    bool m_reauthorized;
+    bool m_done;
+};
+
+// Serves image://drivethumb/<file id>. Thumbnails are fetched with the
+// account's token through the API's scheduler and token refresh, kept on
+// disk by FileCache, decoded and downscaled to the
+// requested sourceSize off the GUI thread and shared through a memory LRU.
+class ThumbnailProvider : public QQuickAsyncImageProvider
+{
+public:
+    ThumbnailProvider(GoogleDriveApi *api, FileCache *fileCache);
+    ~ThumbnailProvider();
+
+    QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+
+    static const QString PROVIDER_ID;
+
+private:
+    friend class ThumbnailResponse;
+
+    GoogleDriveApi *m_api;
+    FileCache *m_fileCache;
+    NetworkRequest *m_scheduler;
+    QNetworkAccessManager *m_networkManager;
+    QCache<QString, QImage> m_images;
+    QThreadPool m_decodePool;
+
+    static const int MEMORY_CACHE_KB;
+    static const int THUMBNAIL_SIZE;
+    static const QString FILES_URL;
+};
+
+#endif // THUMBNAILPROVIDER_H
@@ -0,0 +1,489 @@
+#include "transfermanager.h"
+#include "downloadtask.h"
+#include "uploadtask.h"
+#include <QSettings>
+
+const int TransferManager::SAMPLE_INTERVAL = 500;
+// Throughput is judged over three seconds before the concurrency moves
+const int TransferManager::ADJUST_TICKS = 6;
+// Sampling periods to hold still after a 429, and after a probe that did
+// not pay off
+const int TransferManager::THROTTLE_COOLDOWN = 20;
+const int TransferManager::PROBE_COOLDOWN = 60;
+// An extra transfer has to add at least this share of throughput to stay
+const double TransferManager::PROBE_GAIN = 0.1;
+const double TransferManager::SMOOTHING = 0.3;
+const int TransferManager::DEFAULT_MAX_CONCURRENT = 4;
+
+TransferManager::TransferManager(NetworkRequest *scheduler, QObject *parent)
+    : QAbstractListModel(parent)
+    , m_scheduler(scheduler)
+    , m_throughput(0.0)
+    , m_baseline(0.0)
+    , m_probing(false)
+    , m_cooldown(0)
+    , m_ticks(0)
+{
+    QSettings settings;
+    m_maxConcurrent = qBound(1, settings.value("transfers/maxConcurrent", DEFAULT_MAX_CONCURRENT).toInt(),
+                             NetworkRequest::MAX_BULK_CONNECTIONS);
+    m_concurrency = qMin(m_scheduler->laneLimit(NetworkRequest::Bulk), m_maxConcurrent);
+    m_scheduler->setLaneLimit(NetworkRequest::Bulk, m_concurrency);
+
+    m_sampleTimer.setInterval(SAMPLE_INTERVAL);
+    connect(&m_sampleTimer, &QTimer::timeout, this, &TransferManager::sample);
+    m_clock.start();
+}
+
+int TransferManager::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_transfers.count();
+}
+
+QVariant TransferManager::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_transfers.count())
+        return QVariant();
+
+    const Transfer &transfer = m_transfers.at(index.row());
+
+    switch (role) {
+    case IdRole:
+        return transfer.id;
+    case NameRole:
+        return transfer.name;
+    case KindRole:
+        return transfer.kind;
+    case StateRole:
+        return transfer.state;
+    case BytesDoneRole:
+        return transfer.bytesDone;
+    case BytesTotalRole:
+        return transfer.bytesTotal;
+    case ProgressRole:
+        return transfer.bytesTotal > 0 ? static_cast<qreal>(transfer.bytesDone) / transfer.bytesTotal : 0.0;
+    case ThroughputRole:
+        return transfer.throughput;
+    case EtaRole:
+        // Seconds left at the current rate, -1 when it cannot be told
+        if (transfer.state != Running || transfer.bytesTotal <= 0 || transfer.throughput < 1.0)
+            return -1;
+        return qRound((transfer.bytesTotal - transfer.bytesDone) / transfer.throughput);
+    case ErrorRole:
+        return transfer.error;
+    default:
+        return QVariant();
+    }
+}
+
+QHash<int, QByteArray> TransferManager::roleNames() const
+{
+    QHash<int, QByteArray> roles;
+    roles[IdRole] = "transferId";
+    roles[NameRole] = "name";
+    roles[KindRole] = "kind";
+    roles[StateRole] = "transferState";
+    roles[BytesDoneRole] = "bytesDone";
+    roles[BytesTotalRole] = "bytesTotal";
+    roles[ProgressRole] = "progress";
+    roles[ThroughputRole] = "throughput";
+    roles[EtaRole] = "eta";
+    roles[ErrorRole] = "error";
+    return roles;
+}
+
+int TransferManager::activeCount() const
+{
+    int active = 0;
+    for (const Transfer &transfer : m_transfers) {
+        if (transfer.state == Running)
+            ++active;
+    }
+    return active;
+}
+
+void TransferManager::setMaxConcurrent(int count)
+{
+    count = qBound(1, count, NetworkRequest::MAX_BULK_CONNECTIONS);
+    if (m_maxConcurrent == count)
+        return;
+
+    m_maxConcurrent = count;
+    QSettings settings;
+    settings.setValue("transfers/maxConcurrent", count);
+    emit maxConcurrentChanged();
+
+    if (m_concurrency > count)
+        setConcurrency(count);
+}
+
+void TransferManager::add(QObject *task, Kind kind, int id, const QString &name)
+{
+    Transfer transfer;
+    transfer.id = id;
+    transfer.kind = kind;
+    transfer.name = name;
+    transfer.task = task;
+    transfer.state = Queued;
+    transfer.bytesDone = 0;
+    transfer.bytesTotal = -1;
+    transfer.throughput = 0.0;
+    transfer.sampleBytes = 0;
+    transfer.sampleTime = 0;
+    transfer.throttles = 0;
+    transfer.generation = 0;
+
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+        connect(download, &DownloadTask::progress, this, &TransferManager::handleProgress);
+        connect(download, &DownloadTask::finished, this, &TransferManager::handleFinished);
+        connect(download, &DownloadTask::failed, this, &TransferManager::handleFailed);
+        connect(download, &DownloadTask::throttled, this, &TransferManager::handleThrottled);
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+        connect(upload, &UploadTask::progress, this, &TransferManager::handleProgress);
+        connect(upload, &UploadTask::finished, this, &TransferManager::handleFinished);
+        connect(upload, &UploadTask::failed, this, &TransferManager::handleFailed);
+        connect(upload, &UploadTask::throttled, this, &TransferManager::handleThrottled);
+    }
+
+    beginInsertRows(QModelIndex(), m_transfers.count(), m_transfers.count());
+    m_transfers.append(transfer);
+    m_rowsById.insert(id, m_transfers.count() - 1);
+    m_rowsByTask.insert(task, m_transfers.count() - 1);
+    endInsertRows();
+    emit countChanged();
+
+    schedule(m_transfers.count() - 1);
+}
+
+void TransferManager::fail(QObject *task, const QString &error)
+{
+    int row = rowOf(task);
+    if (row >= 0)
+        setState(row, Failed, error);
+}
+
+bool TransferManager::isPaused(QObject *task) const
+{
+    int row = rowOf(task);
+    return row >= 0 && m_transfers.at(row).state == Paused;
+}
+
+qreal TransferManager::progress(Kind kind) const
+{
+    qint64 done = 0;
+    qint64 total = 0;
+    for (const Transfer &transfer : m_transfers) {
+        if (transfer.kind != kind || transfer.bytesTotal <= 0)
+            continue;
+        if (transfer.state == Queued || transfer.state == Running || transfer.state == Paused) {
+            done += transfer.bytesDone;
+            total += transfer.bytesTotal;
+        }
+    }
+    return total > 0 ? static_cast<qreal>(done) / total : 0.0;
+}
+
+void TransferManager::pause(int id)
+{
+    int row = rowOfId(id);
+    if (row < 0)
+        return;
+
+    Transfer &transfer = m_transfers[row];
+    if (transfer.state != Queued && transfer.state != Running)
+        return;
+
+    // Frees the slot; uploads keep their session and downloads their part
+    // file, and both continue from there on resume
+    ++transfer.generation;
+    m_scheduler->cancel(transfer.task);
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(transfer.task)) {
+        download->abort();
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(transfer.task)) {
+        upload->abort();
+    }
+    setState(row, Paused);
+}
+
+void TransferManager::resume(int id)
+{
+    int row = rowOfId(id);
+    if (row >= 0 && m_transfers.at(row).state == Paused)
+        schedule(row);
+}
+
+void TransferManager::cancel(int id)
+{
+    int row = rowOfId(id);
+    if (row < 0)
+        return;
+
+    Transfer &transfer = m_transfers[row];
+    if (transfer.state == Completed || transfer.state == Failed || transfer.state == Canceled)
+        return;
+
+    QObject *task = transfer.task;
+    ++transfer.generation;
+    m_scheduler->cancel(task);
+    if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+        download->discard();
+    } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+        upload->cancel();
+    }
+    setState(row, Canceled);
+
+    if (task)
+        emit transferCanceled(task);
+}
+
+void TransferManager::pauseAll()
+{
+    for (int row = 0; row < m_transfers.count(); ++row) {
+        pause(m_transfers.at(row).id);
+    }
+}
+
+void TransferManager::resumeAll()
+{
+    for (int row = 0; row < m_transfers.count(); ++row) {
+        resume(m_transfers.at(row).id);
+    }
+}
+
+void TransferManager::clearFinished()
+{
+    for (int row = m_transfers.count() - 1; row >= 0; --row) {
+        State state = m_transfers.at(row).state;
+        if (state == Completed || state == Failed || state == Canceled) {
+            beginRemoveRows(QModelIndex(), row, row);
+            m_transfers.remove(row);
+            endRemoveRows();
+        }
+    }
+
+    // Rows below the first removed one moved up
+    m_rowsById.clear();
+    m_rowsByTask.clear();
+    for (int row = 0; row < m_transfers.count(); ++row) {
+        const Transfer &transfer = m_transfers.at(row);
+        m_rowsById.insert(transfer.id, row);
+        if (transfer.task)
+            m_rowsByTask.insert(transfer.task, row);
+    }
+    emit countChanged();
+}
+
+void TransferManager::handleProgress(qint64 bytesDone, qint64 bytesTotal)
+{
+    int row = rowOf(sender());
+    if (row < 0)
+        return;
+
+    // Rows and the progress signal are refreshed on the next sample
+    Transfer &transfer = m_transfers[row];
+    transfer.bytesDone = bytesDone;
+    if (bytesTotal > 0)
+        transfer.bytesTotal = bytesTotal;
+    transfer.throttles = 0;
+}
+
+void TransferManager::handleFinished()
+{
+    int row = rowOf(sender());
+    if (row < 0)
+        return;
+
+    Transfer &transfer = m_transfers[row];
+    if (transfer.bytesTotal < 0)
+        transfer.bytesTotal = transfer.bytesDone;
+    transfer.bytesDone = transfer.bytesTotal;
+    setState(row, Completed);
+}
+
+void TransferManager::handleFailed(const QString &error)
+{
+    int row = rowOf(sender());
+    if (row >= 0)
+        setState(row, Failed, error);
+}
+
+void TransferManager::handleThrottled()
+{
+    int row = rowOf(sender());
+    if (row < 0)
+        return;
+
+    // Multiplicative decrease, then hold still for a while
+    setConcurrency(qMax(1, m_concurrency / 2));
+    m_probing = false;
+    m_cooldown = THROTTLE_COOLDOWN;
+
+    // Uploads recover on their own; a download gives up its slot and
+    // queues again after a backoff
+    Transfer &transfer = m_transfers[row];
+    if (transfer.kind != Download)
+        return;
+
+    ++transfer.throttles;
+    const int generation = ++transfer.generation;
+    const int delay = qMin(1000 << qMin(transfer.throttles - 1, 5), 32000);
+    QPointer<QObject> task = transfer.task;
+
+    m_scheduler->cancel(task);
+    setState(row, Queued);
+
+    QTimer::singleShot(delay, this, [this, task, generation]() {
+        int row = rowOf(task);
+        if (row >= 0 && m_transfers.at(row).state == Queued && m_transfers.at(row).generation == generation)
+            schedule(row);
+    });
+}
+
+void TransferManager::sample()
+{
+    const qint64 now = m_clock.elapsed();
+    double total = 0.0;
+    bool running = false;
+
+    for (int row = 0; row < m_transfers.count(); ++row) {
+        Transfer &transfer = m_transfers[row];
+        if (transfer.state != Running)
+            continue;
+        running = true;
+
+        qint64 elapsed = now - transfer.sampleTime;
+        if (elapsed > 0) {
+            double rate = (transfer.bytesDone - transfer.sampleBytes) * 1000.0 / elapsed;
+            transfer.throughput = transfer.throughput > 0.0
+                    ? SMOOTHING * rate + (1.0 - SMOOTHING) * transfer.throughput
+                    : rate;
+            transfer.sampleBytes = transfer.bytesDone;
+            transfer.sampleTime = now;
+        }
+        total += transfer.throughput;
+
+        QModelIndex modelIndex = index(row);
+        emit dataChanged(modelIndex, modelIndex);
+    }
+
+    m_throughput = total;
+    emit progressChanged();
+
+    if (!running) {
+        m_sampleTimer.stop();
+        m_throughput = 0.0;
+        return;
+    }
+
+    if (++m_ticks % ADJUST_TICKS == 0)
+        adjustConcurrency();
+}
+
+void TransferManager::adjustConcurrency()
+{
+    if (m_cooldown > 0) {
+        m_cooldown = qMax(0, m_cooldown - ADJUST_TICKS);
+        return;
+    }
+
+    if (m_probing) {
+        m_probing = false;
+        if (m_throughput < m_baseline * (1.0 + PROBE_GAIN)) {
+            // The extra transfer did not make things faster; the link is full
+            setConcurrency(m_concurrency - 1);
+            m_cooldown = PROBE_COOLDOWN;
+            return;
+        }
+    }
+
+    // Additive increase while every slot is busy and work is waiting. A
+    // ranged download may hold several slots, so count slots, not rows.
+    if (m_scheduler->activeCount(NetworkRequest::Bulk) >= m_concurrency && hasQueued()
+            && m_concurrency < m_maxConcurrent) {
+        m_baseline = m_throughput;
+        m_probing = true;
+        setConcurrency(m_concurrency + 1);
+    }
+}
+
+void TransferManager::setConcurrency(int concurrency)
+{
+    concurrency = qBound(1, concurrency, m_maxConcurrent);
+    if (m_concurrency == concurrency)
+        return;
+
+    m_concurrency = concurrency;
+    m_scheduler->setLaneLimit(NetworkRequest::Bulk, concurrency);
+    emit concurrencyChanged();
+}
+
+bool TransferManager::hasQueued() const
+{
+    for (const Transfer &transfer : m_transfers) {
+        if (transfer.state == Queued)
+            return true;
+    }
+    return false;
+}
+
+int TransferManager::rowOf(QObject *task) const
+{
+    if (!task)
+        return -1;
+
+    // Checked against the row: a destroyed task's address may come back
+    // for another object
+    const int row = m_rowsByTask.value(task, -1);
+    return row >= 0 && m_transfers.at(row).task == task ? row : -1;
+}
+
+int TransferManager::rowOfId(int id) const
+{
+    return m_rowsById.value(id, -1);
+}
+
+void TransferManager::schedule(int row)
+{
+    Transfer &transfer = m_transfers[row];
+    const int generation = ++transfer.generation;
+    QPointer<QObject> task = transfer.task;
+    setState(row, Queued);
+
+    m_scheduler->enqueue(NetworkRequest::Bulk, task, [this, task, generation]() {
+        int row = rowOf(task);
+        if (row < 0 || m_transfers.at(row).generation != generation)
+            return;
+
+        setState(row, Running);
+        if (DownloadTask *download = qobject_cast<DownloadTask*>(task)) {
+            download->start();
+        } else if (UploadTask *upload = qobject_cast<UploadTask*>(task)) {
+            upload->start();
+        }
+    });
+}
+
+void TransferManager::setState(int row, State state, const QString &error)
+{
+    Transfer &transfer = m_transfers[row];
+    transfer.state = state;
+    transfer.error = error;
+
+    if (state == Running) {
+        transfer.sampleBytes = transfer.bytesDone;
+        transfer.sampleTime = m_clock.elapsed();
+        if (!m_sampleTimer.isActive())
+            m_sampleTimer.start();
+    } else {
+        transfer.throughput = 0.0;
+    }
+
+    if (state == Completed || state == Failed || state == Canceled)
+        transfer.task = nullptr;
+
+    QModelIndex modelIndex = index(row);
+    emit dataChanged(modelIndex, modelIndex);
+    emit progressChanged();
+}
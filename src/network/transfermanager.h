@@ -0,0 +1,153 @@
+#ifndef TRANSFERMANAGER_H
+#define TRANSFERMANAGER_H
+
+#include <QAbstractListModel>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+#include "networkrequest.h"
+
+// Queues uploads and downloads in the bulk lane of the scheduler and lists
+// them for QML with per-transfer progress, throughput and ETA. How many run
+// at once follows the measured throughput: another slot is opened while it
+// still buys speed, and the count is halved when the server throttles us.
+class TransferManager : public QAbstractListModel
+{
+    Q_OBJECT
+    Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(int activeCount READ activeCount NOTIFY progressChanged)
+    Q_PROPERTY(int concurrency READ concurrency NOTIFY concurrencyChanged)
+    Q_PROPERTY(int maxConcurrent READ maxConcurrent WRITE setMaxConcurrent NOTIFY maxConcurrentChanged)
+    Q_PROPERTY(int maxConcurrentLimit READ maxConcurrentLimit CONSTANT)
+    Q_PROPERTY(double throughput READ throughput NOTIFY progressChanged)
+
+public:
+    enum Kind {
+        Download,
+        Upload
+    };
+    Q_ENUM(Kind)
+
+    enum State {
+        Queued,
+        Running,
+        Paused,
+        Completed,
+        Failed,
+        Canceled
+    };
+    Q_ENUM(State)
+
+    enum TransferRoles {
+        IdRole = Qt::UserRole + 1,
+        NameRole,
+        KindRole,
+        StateRole,
+        BytesDoneRole,
+        BytesTotalRole,
+        ProgressRole,
+        ThroughputRole,
+        EtaRole,
+        ErrorRole
+    };
+
+    explicit TransferManager(NetworkRequest *scheduler, QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    int count() const { return m_transfers.count(); }
+    int activeCount() const;
+    int concurrency() const { return m_concurrency; }
+    int maxConcurrent() const { return m_maxConcurrent; }
+    void setMaxConcurrent(int count);
+    // Upper bound for maxConcurrent
+    int maxConcurrentLimit() const { return NetworkRequest::MAX_BULK_CONNECTIONS; }
+    // Bytes per second over all running transfers
+    double throughput() const { return m_throughput; }
+
+    // Takes over scheduling of a DownloadTask or UploadTask; id is the
+    // request id the API handed out for it
+    void add(QObject *task, Kind kind, int id, const QString &name);
+    // For transfers that ended without a failed() signal, e.g. on an
+    // authorization error
+    void fail(QObject *task, const QString &error);
+    bool isPaused(QObject *task) const;
+
+    // Combined progress of the unfinished transfers of one kind, 0 if none
+    qreal progress(Kind kind) const;
+
+    Q_INVOKABLE void pause(int id);
+    Q_INVOKABLE void resume(int id);
+    Q_INVOKABLE void cancel(int id);
+    Q_INVOKABLE void pauseAll();
+    Q_INVOKABLE void resumeAll();
+    Q_INVOKABLE void clearFinished();
+
+signals:
+    void countChanged();
+    void progressChanged();
+    void concurrencyChanged();
+    void maxConcurrentChanged();
+    // The user canceled the transfer; the task is no longer scheduled
+    void transferCanceled(QObject *task);
+
+private slots:
+    void handleProgress(qint64 bytesDone, qint64 bytesTotal);
+    void handleFinished();
+    void handleFailed(const QString &error);
+    void handleThrottled();
+    void sample();
+
+private:
+    struct Transfer {
+        int id;
+        Kind kind;
+        QString name;
+        QPointer<QObject> task;
+        State state;
+        qint64 bytesDone;
+        qint64 bytesTotal;
+        double throughput;
+        qint64 sampleBytes;
+        qint64 sampleTime;
+        int throttles;
+        int generation;     // bumped whenever a pending start goes stale
+        QString error;
+    };
+
+    int rowOf(QObject *task) const;
+    int rowOfId(int id) const;
+    void schedule(int row);
+    void setState(int row, State state, const QString &error = QString());
+    void adjustConcurrency();
+    void setConcurrency(int concurrency);
+    bool hasQueued() const;
+
+    NetworkRequest *m_scheduler;
+    QVector<Transfer> m_transfers;
+    QHash<int, int> m_rowsById;
+    QHash<QObject*, int> m_rowsByTask;
+    QTimer m_sampleTimer;
+    QElapsedTimer m_clock;
+    int m_concurrency;
+    int m_maxConcurrent;
+    double m_throughput;
+    double m_baseline;
+    bool m_probing;
+    int m_cooldown;
+    int m_ticks;
+
+    static const int SAMPLE_INTERVAL;
+    static const int ADJUST_TICKS;
+    static const int THROTTLE_COOLDOWN;
+    static const int PROBE_COOLDOWN;
+    static const double PROBE_GAIN;
+    static const double SMOOTHING;
+    static const int DEFAULT_MAX_CONCURRENT;
+};
+
+#endif // TRANSFERMANAGER_H
@@ -0,0 +1,396 @@
+#include "uploadtask.h"
+#include "retrypolicy.h"
+#include <QBuffer>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMimeDatabase>
+#include <QSettings>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QDebug>
+
+// Drive requires every chunk except the last to be a multiple of 256 KiB
+const qint64 UploadTask::CHUNK_GRANULARITY = 256 * 1024;
+const qint64 UploadTask::DEFAULT_CHUNK_SIZE = 16 * UploadTask::CHUNK_GRANULARITY;
+const int UploadTask::MAX_ATTEMPTS = 8;
+const QString UploadTask::UPLOAD_URL = "https://www.googleapis.com/upload/drive/v3/files";
+
+UploadTask::UploadTask(QNetworkAccessManager *manager, CredentialStore *credentialStore,
+                       const QString &localPath, const QString &parentId, QObject *parent)
+    : QObject(parent)
+    , m_manager(manager)
+    , m_credentialStore(credentialStore)
+    , m_localPath(localPath)
+    , m_parentId(parentId)
+    , m_file(localPath)
+    , m_reply(nullptr)
+    , m_chunkSize(DEFAULT_CHUNK_SIZE)
+    , m_totalSize(0)
+    , m_offset(0)
+    , m_chunkLength(0)
+    , m_attempts(0)
+{
+}
+
+UploadTask::~UploadTask()
+{
+    abort();
+}
+
+void UploadTask::setChunkSize(qint64 size)
+{
+    // Round up to the chunk granularity the upload protocol expects
+    qint64 chunks = qMax<qint64>(1, (size + CHUNK_GRANULARITY - 1) / CHUNK_GRANULARITY);
+    m_chunkSize = chunks * CHUNK_GRANULARITY;
+}
+
+void UploadTask::start()
+{
+    if (m_file.isOpen())
+        return;
+
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        fail("Cannot open file: " + m_localPath);
+        return;
+    }
+
+    QFileInfo fileInfo(m_localPath);
+    QMimeDatabase mimeDb;
+    m_mimeType = mimeDb.mimeTypeForFile(fileInfo).name();
+    m_totalSize = m_file.size();
+    m_offset = 0;
+    m_attempts = 0;
+
+    // Continue a session left over from an earlier run if the file is unchanged
+    QSettings settings;
+    settings.beginGroup(settingsKey(m_localPath, sessionTarget()));
+    QUrl sessionUri = settings.value("sessionUri").toUrl();
+    qint64 savedSize = settings.value("size", -1).toLongLong();
+    qint64 savedModified = settings.value("modified", -1).toLongLong();
+    settings.endGroup();
+
+    if (sessionUri.isValid() && savedSize == m_totalSize
+            && savedModified == fileInfo.lastModified().toMSecsSinceEpoch()) {
+        qDebug() << "Resuming upload session for" << m_localPath;
+        m_sessionUri = sessionUri;
+        queryStatus();
+        return;
+    }
+
+    clearSession();
+    createSession();
+}
+
+void UploadTask::abort()
+{
+    // The persisted session is kept so the upload can be resumed later
+    releaseReply();
+    m_file.close();
+}
+
+void UploadTask::resume()
+{
+    if (!m_file.isOpen() || m_reply)
+        return;
+
+    if (m_sessionUri.isValid()) {
+        queryStatus();
+    } else {
+        createSession();
+    }
+}
+
+void UploadTask::cancel()
+{
+    abort();
+    clearSession();
+}
+
+QList<QStringList> UploadTask::pendingSessions()
+{
+    QList<QStringList> sessions;
+
+    QSettings settings;
+    settings.beginGroup("uploads");
+    const QStringList keys = settings.childGroups();
+    for (const QString &key : keys) {
+        settings.beginGroup(key);
+        sessions.append(QStringList() << settings.value("localPath").toString()
+                                      << settings.value("parentId").toString()
+                                      << settings.value("fileId").toString());
+        settings.endGroup();
+    }
+    settings.endGroup();
+
+    return sessions;
+}
+
+void UploadTask::discardSession(const QString &localPath, const QString &target)
+{
+    QSettings settings;
+    settings.remove(settingsKey(localPath, target));
+    settings.sync();
+}
+
+QNetworkRequest UploadTask::authorizedRequest(const QUrl &url) const
+{
+    QNetworkRequest request(url);
+    request.setRawHeader("Authorization", QString("Bearer %1").arg(m_credentialStore->accessToken()).toUtf8());
+    return request;
+}
+
+void UploadTask::createSession()
+{
+    // An update keeps the name and parents the file already has
+    QJsonObject metadata;
+    if (m_fileId.isEmpty()) {
+        metadata["name"] = QFileInfo(m_localPath).fileName();
+        metadata["parents"] = QJsonArray() << m_parentId;
+    }
+
+    QUrl url(m_fileId.isEmpty() ? UPLOAD_URL : UPLOAD_URL + "/" + m_fileId);
+    QUrlQuery urlQuery;
+    urlQuery.addQueryItem("uploadType", "resumable");
+    urlQuery.addQueryItem("fields", "id,name,mimeType,size,modifiedTime,parents,md5Checksum");
+    url.setQuery(urlQuery);
+
+    QNetworkRequest request = authorizedRequest(url);
+    request.setHeader(QNetworkRequest::ContentTypeHeader, "application/json; charset=UTF-8");
+    request.setRawHeader("X-Upload-Content-Type", m_mimeType.toUtf8());
+    request.setRawHeader("X-Upload-Content-Length", QByteArray::number(m_totalSize));
+
+    const QByteArray body = QJsonDocument(metadata).toJson(QJsonDocument::Compact);
+    if (m_fileId.isEmpty()) {
+        m_reply = m_manager->post(request, body);
+    } else {
+        // Qt 5.6 requires QIODevice* for sendCustomRequest
+        QBuffer *buffer = new QBuffer();
+        buffer->setData(body);
+        buffer->open(QIODevice::ReadOnly);
+        m_reply = m_manager->sendCustomRequest(request, "PATCH", buffer);
+        buffer->setParent(m_reply); // Cleanup with reply
+    }
+    connect(m_reply, &QNetworkReply::finished, this, &UploadTask::handleSessionReply);
+}
+
+void UploadTask::sendChunk()
+{
+    m_chunkLength = qMin(m_chunkSize, m_totalSize - m_offset);
+
+    QByteArray data;
+    if (m_chunkLength > 0) {
+        if (!m_file.seek(m_offset)) {
+            fail("Cannot read file: " + m_localPath);
+            return;
+        }
+        data = m_file.read(m_chunkLength);
+        if (data.size() != m_chunkLength) {
+            fail("Cannot read file: " + m_localPath);
+            return;
+        }
+    }
+
+    QNetworkRequest request = authorizedRequest(m_sessionUri);
+    if (m_chunkLength > 0) {
+        request.setRawHeader("Content-Range", QString("bytes %1-%2/%3")
+                             .arg(m_offset).arg(m_offset + m_chunkLength - 1).arg(m_totalSize).toUtf8());
+    } else {
+        request.setRawHeader("Content-Range", QString("bytes */%1").arg(m_totalSize).toUtf8());
+    }
+
+    m_reply = m_manager->put(request, data);
+    connect(m_reply, &QNetworkReply::finished, this, &UploadTask::handleChunkReply);
+    connect(m_reply, &QNetworkReply::uploadProgress, this, &UploadTask::handleChunkProgress);
+}
+
+void UploadTask::queryStatus()
+{
+    // An empty PUT with an unknown range asks the server how much it has
+    m_chunkLength = 0;
+
+    QNetworkRequest request = authorizedRequest(m_sessionUri);
+    request.setRawHeader("Content-Range", QString("bytes */%1").arg(m_totalSize).toUtf8());
+
+    m_reply = m_manager->put(request, QByteArray());
+    connect(m_reply, &QNetworkReply::finished, this, &UploadTask::handleChunkReply);
+}
+
+void UploadTask::handleSessionReply()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status == 401) {
+        emit authorizationExpired(reply->request().rawHeader("Authorization"));
+        return;
+    }
+
+    if (reply->error() != QNetworkReply::NoError) {
+        if (status >= 400 && RetryPolicy::isUnprocessed(reply)) {
+            emit throttled();
+            scheduleRecovery(reply->errorString());
+        } else if (status >= 400 && status < 500 && status != 408) {
+            fail(reply->errorString());
+        } else {
+            scheduleRecovery(reply->errorString());
+        }
+        return;
+    }
+
+    m_sessionUri = QUrl::fromEncoded(reply->rawHeader("Location"));
+    if (!m_sessionUri.isValid()) {
+        fail("Upload session was not created");
+        return;
+    }
+
+    saveSession();
+    m_offset = 0;
+    m_attempts = 0;
+    sendChunk();
+}
+
+void UploadTask::handleChunkReply()
+{
+    QNetworkReply *reply = m_reply;
+    m_reply = nullptr;
+    reply->deleteLater();
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+
+    if (status == 200 || status == 201) {
+        finish(QJsonDocument::fromJson(reply->readAll()).object());
+        return;
+    }
+
+    if (status == 401) {
+        // The session survives; the last chunk is re-sent after the refresh
+        emit authorizationExpired(reply->request().rawHeader("Authorization"));
+        return;
+    }
+
+    if (status == 308) {
+        // Resume Incomplete: the server tells us what it has committed
+        readCommittedRange(reply);
+        m_attempts = 0;
+        emit progress(m_offset, m_totalSize);
+        sendChunk();
+        return;
+    }
+
+    if (status == 404 || status == 410) {
+        // The session expired, start over with a new one
+        qDebug() << "Upload session expired for" << m_localPath;
+        clearSession();
+        m_sessionUri.clear();
+        m_offset = 0;
+        scheduleRecovery(reply->errorString());
+        return;
+    }
+
+    if (status >= 400 && RetryPolicy::isUnprocessed(reply)) {
+        // Throttled; the session survives and the chunk is sent again
+        emit throttled();
+        scheduleRecovery(reply->errorString());
+        return;
+    }
+
+    if (status >= 400 && status < 500 && status != 408) {
+        clearSession();
+        fail(reply->errorString());
+        return;
+    }
+
+    scheduleRecovery(reply->errorString());
+}
+
+void UploadTask::handleChunkProgress(qint64 bytesSent, qint64 bytesTotal)
+{
+    Q_UNUSED(bytesTotal)
+    emit progress(m_offset + bytesSent, m_totalSize);
+}
+
+bool UploadTask::readCommittedRange(QNetworkReply *reply)
+{
+    // Range: bytes=0-<last committed byte>; absent when nothing was stored
+    QByteArray range = reply->rawHeader("Range");
+    int dash = range.lastIndexOf('-');
+    if (dash < 0) {
+        m_offset = 0;
+        return false;
+    }
+
+    bool ok = false;
+    qint64 last = range.mid(dash + 1).toLongLong(&ok);
+    m_offset = ok ? qMin(last + 1, m_totalSize) : 0;
+    return ok;
+}
+
+void UploadTask::scheduleRecovery(const QString &error)
+{
+    if (++m_attempts > MAX_ATTEMPTS) {
+        fail(error);
+        return;
+    }
+
+    int delay = qMin(1000 << (m_attempts - 1), 32000);
+    qDebug() << "Upload interrupted:" << error << "- retrying in" << delay << "ms";
+
+    QTimer::singleShot(delay, this, &UploadTask::resume);
+}
+
+void UploadTask::finish(const QJsonObject &metadata)
+{
+    clearSession();
+    m_file.close();
+    m_offset = m_totalSize;
+
+    emit progress(m_totalSize, m_totalSize);
+    emit finished(metadata);
+}
+
+void UploadTask::fail(const QString &error)
+{
+    releaseReply();
+    m_file.close();
+    emit failed(error);
+}
+
+void UploadTask::releaseReply()
+{
+    if (m_reply) {
+        QNetworkReply *reply = m_reply;
+        m_reply = nullptr;
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+QString UploadTask::settingsKey(const QString &localPath, const QString &target)
+{
+    QByteArray key = (localPath + '\n' + target).toUtf8();
+    return "uploads/" + QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex());
+}
+
+void UploadTask::saveSession()
+{
+    QSettings settings;
+    settings.beginGroup(settingsKey(m_localPath, sessionTarget()));
+    settings.setValue("sessionUri", m_sessionUri);
+    settings.setValue("localPath", m_localPath);
+    settings.setValue("parentId", m_parentId);
+    settings.setValue("fileId", m_fileId);
+    settings.setValue("size", m_totalSize);
+    settings.setValue("modified", QFileInfo(m_localPath).lastModified().toMSecsSinceEpoch());
+    settings.endGroup();
+    settings.sync();
+}
+
+void UploadTask::clearSession()
+{
+    discardSession(m_localPath, sessionTarget());
+}
@@ -0,0 +1,104 @@
+#ifndef UPLOADTASK_H
+#define UPLOADTASK_H
+
+#include <QObject>
+#include <QFile>
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QStringList>
+#include <QUrl>
+#include "../storage/credentialstore.h"
+
+// Uploads one local file through a Drive resumable upload session. The file
+// is sent in fixed-size chunks; after a failure the session is queried for
+// the committed offset and the upload continues from there. Session URIs are
+// kept in QSettings so an interrupted upload can be picked up after restart.
+class UploadTask : public QObject
+{
+    Q_OBJECT
+
+public:
+    UploadTask(QNetworkAccessManager *manager, CredentialStore *credentialStore,
+               const QString &localPath, const QString &parentId, QObject *parent = nullptr);
+    ~UploadTask();
+
+    QString localPath() const { return m_localPath; }
+    QString parentId() const { return m_parentId; }
+    // Set to replace the content of that file instead of creating a new
+    // one in parentId
+    QString fileId() const { return m_fileId; }
+    void setFileId(const QString &fileId) { m_fileId = fileId; }
+    qint64 bytesSent() const { return m_offset; }
+    qint64 bytesTotal() const { return m_totalSize; }
+
+    qint64 chunkSize() const { return m_chunkSize; }
+    void setChunkSize(qint64 size);
+
+    void start();
+    void abort();
+    // Continues a started upload, e.g. once a new token is available
+    void resume();
+    // Stops for good and forgets the persisted session
+    void cancel();
+
+    // Local paths, parent ids and, for updates, file ids of uploads with
+    // a persisted session
+    static QList<QStringList> pendingSessions();
+    // Forgets the session of an upload that will not be continued; target
+    // is the parent id, or the file id of an update
+    static void discardSession(const QString &localPath, const QString &target);
+
+    static const qint64 CHUNK_GRANULARITY;
+    static const qint64 DEFAULT_CHUNK_SIZE;
+
+signals:
+    void progress(qint64 bytesSent, qint64 bytesTotal);
+    void finished(const QJsonObject &metadata);
+    void failed(const QString &error);
+    // The server rejected the token; resume() once it is refreshed
+    void authorizationExpired(const QByteArray &authorization);
+    // The server asked us to slow down; the upload recovers on its own
+    void throttled();
+
+private slots:
+    void handleSessionReply();
+    void handleChunkReply();
+    void handleChunkProgress(qint64 bytesSent, qint64 bytesTotal);
+
+private:
+    QNetworkRequest authorizedRequest(const QUrl &url) const;
+    void createSession();
+    void sendChunk();
+    void queryStatus();
+    void scheduleRecovery(const QString &error);
+    bool readCommittedRange(QNetworkReply *reply);
+    void finish(const QJsonObject &metadata);
+    void fail(const QString &error);
+    void releaseReply();
+
+    static QString settingsKey(const QString &localPath, const QString &target);
+    QString sessionTarget() const { return m_fileId.isEmpty() ? m_parentId : m_fileId; }
+    void saveSession();
+    void clearSession();
+
+    QNetworkAccessManager *m_manager;
+    CredentialStore *m_credentialStore;
+    QString m_localPath;
+    QString m_parentId;
+    QString m_fileId;
+    QString m_mimeType;
+    QFile m_file;
+    QNetworkReply *m_reply;
+    QUrl m_sessionUri;
+    qint64 m_chunkSize;
+    qint64 m_totalSize;
+    qint64 m_offset;
+    qint64 m_chunkLength;
+    int m_attempts;
+
+    static const int MAX_ATTEMPTS;
+    static const QString UPLOAD_URL;
+};
+
+#endif // UPLOADTASK_H
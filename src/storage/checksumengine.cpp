@@ -0,0 +1,165 @@
+#include "checksumengine.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThread>
+#include <QtConcurrent>
+#include <QDebug>
+
+// Read per call; with MAX_THREADS this is all the memory hashing takes
+const int ChecksumEngine::BLOCK_SIZE = 256 * 1024;
+// Beyond this the storage, not the CPU, is the limit
+const int ChecksumEngine::MAX_THREADS = 4;
+// Remembered files; a photo library fits comfortably
+const int ChecksumEngine::MAX_ENTRIES = 20000;
+
+ChecksumEngine::ChecksumEngine(QObject *parent)
+    : QObject(parent)
+    , m_indexPath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/checksums.json")
+{
+    m_pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount(), MAX_THREADS));
+
+    // A folder upload hashes many files in a row; batch the index writes
+    m_indexSaveTimer.setSingleShot(true);
+    m_indexSaveTimer.setInterval(2000);
+    connect(&m_indexSaveTimer, &QTimer::timeout, this, &ChecksumEngine::saveIndex);
+
+    loadIndex();
+}
+
+ChecksumEngine::~ChecksumEngine()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+    if (m_indexSaveTimer.isActive()) {
+        saveIndex();
+    }
+}
+
+void ChecksumEngine::requestMd5(const QString &localPath)
+{
+    const QFileInfo info(localPath);
+    Checksum job;
+    job.size = info.size();
+    job.modified = info.lastModified().toMSecsSinceEpoch();
+
+    if (!info.isFile()) {
+        QTimer::singleShot(0, this, [this, localPath]() {
+            emit checksumReady(localPath, QString());
+        });
+        return;
+    }
+
+    QHash<QString, Checksum>::const_iterator known = m_checksums.constFind(localPath);
+    if (known != m_checksums.constEnd() && known->size == job.size && known->modified == job.modified) {
+        const QString md5 = known->md5;
+        QTimer::singleShot(0, this, [this, localPath, md5]() {
+            emit checksumReady(localPath, md5);
+        });
+        return;
+    }
+
+    // One read per file version however often it is asked for
+    QHash<QString, Checksum>::const_iterator running = m_running.constFind(localPath);
+    if (running != m_running.constEnd() && running->size == job.size && running->modified == job.modified)
+        return;
+    m_running.insert(localPath, job);
+
+    QFutureWatcher<QString> *watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcher<QString>::finished, this, [this, watcher, localPath, job]() {
+        watcher->deleteLater();
+
+        // The file changed while it was read; the newer request answers
+        const Checksum current = m_running.value(localPath);
+        if (current.size != job.size || current.modified != job.modified)
+            return;
+        m_running.remove(localPath);
+
+        const QString md5 = watcher->result();
+        if (!md5.isEmpty()) {
+            if (m_checksums.size() >= MAX_ENTRIES && !m_checksums.contains(localPath)) {
+                m_checksums.erase(m_checksums.begin());
+            }
+            Checksum checksum = job;
+            checksum.md5 = md5;
+            m_checksums.insert(localPath, checksum);
+            if (!m_indexSaveTimer.isActive()) {
+                m_indexSaveTimer.start();
+            }
+        }
+        emit checksumReady(localPath, md5);
+    });
+    watcher->setFuture(QtConcurrent::run(&m_pool, &ChecksumEngine::hashFile, localPath));
+}
+
+QString ChecksumEngine::hashFile(const QString &localPath)
+{
+    // Runs on the pool
+    QFile file(localPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot read" << localPath << "for checksum:" << file.errorString();
+        return QString();
+    }
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    QByteArray block(BLOCK_SIZE, Qt::Uninitialized);
+    qint64 read;
+    while ((read = file.read(block.data(), block.size())) > 0) {
+        hash.addData(block.constData(), static_cast<int>(read));
+    }
+    if (read < 0) {
+        qWarning() << "Checksum of" << localPath << "failed:" << file.errorString();
+        return QString();
+    }
+
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+void ChecksumEngine::loadIndex()
+{
+    // Entries are checked against the file when asked for, not here, so
+    // start-up does not stat every file ever uploaded
+    QFile file(m_indexPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    const QJsonObject index = QJsonDocument::fromJson(file.readAll()).object();
+    for (QJsonObject::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+        const QJsonObject value = it.value().toObject();
+        Checksum checksum;
+        checksum.size = static_cast<qint64>(value.value("size").toDouble());
+        checksum.modified = static_cast<qint64>(value.value("modified").toDouble());
+        checksum.md5 = value.value("md5").toString();
+        if (!checksum.md5.isEmpty()) {
+            m_checksums.insert(it.key(), checksum);
+        }
+    }
+}
+
+void ChecksumEngine::saveIndex()
+{
+    QJsonObject index;
+    for (QHash<QString, Checksum>::const_iterator it = m_checksums.constBegin(); it != m_checksums.constEnd(); ++it) {
+        QJsonObject value;
+        value["size"] = static_cast<double>(it->size);
+        value["modified"] = static_cast<double>(it->modified);
+        value["md5"] = it->md5;
+        index[it.key()] = value;
+    }
+
+    QDir().mkpath(QFileInfo(m_indexPath).path());
+    QSaveFile file(m_indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write checksum index";
+        return;
+    }
+    file.write(QJsonDocument(index).toJson(QJsonDocument::Compact));
+    file.commit();
+}
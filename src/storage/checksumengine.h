@@ -0,0 +1,52 @@
+#ifndef CHECKSUMENGINE_H
+#define CHECKSUMENGINE_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+// MD5 of local files, as Drive reports it in md5Checksum. Files are read in
+// fixed-size blocks on a small thread pool, so memory stays bounded however
+// large or numerous they are. Results are remembered per path, size and
+// modification time, across restarts, so asking again for an unchanged file
+// costs a stat instead of a read.
+class ChecksumEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ChecksumEngine(QObject *parent = nullptr);
+    ~ChecksumEngine();
+
+    // Answered by checksumReady(), never synchronously
+    void requestMd5(const QString &localPath);
+
+signals:
+    // md5 is lowercase hex, empty if the file could not be read
+    void checksumReady(const QString &localPath, const QString &md5);
+
+private:
+    struct Checksum {
+        qint64 size;
+        qint64 modified;
+        QString md5;
+    };
+
+    static QString hashFile(const QString &localPath);
+    void loadIndex();
+    void saveIndex();
+
+    QThreadPool m_pool;
+    QString m_indexPath;
+    QHash<QString, Checksum> m_checksums;
+    QHash<QString, Checksum> m_running;
+    QTimer m_indexSaveTimer;
+
+    static const int BLOCK_SIZE;
+    static const int MAX_THREADS;
+    static const int MAX_ENTRIES;
+};
+
+#endif // CHECKSUMENGINE_H
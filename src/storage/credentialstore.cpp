@@ -17,26 +17,47 @@ bool CredentialStore::hasCredentials() const
     return !m_accessToken.isEmpty() && !m_refreshToken.isEmpty();
 }
 
-void CredentialStore::saveCredentials(const QString &accessToken, const QString &refreshToken)
+bool CredentialStore::tokenExpiresWithin(int seconds) const
+{
+    return m_tokenExpiry.isValid() && QDateTime::currentDateTimeUtc().secsTo(m_tokenExpiry) < seconds;
+}
+
+void CredentialStore::saveCredentials(const QString &accessToken, const QString &refreshToken, int expiresIn)
 {
     m_settings->setValue("oauth/accessToken", accessToken);
     m_settings->setValue("oauth/refreshToken", refreshToken);
+    setTokenExpiry(expiresIn);
     m_settings->sync();
 
-    setAccessToken(accessToken);
     m_refreshToken = refreshToken;
+    setAccessToken(accessToken);
 
     emit hasCredentialsChanged();
 }
 
+void CredentialStore::updateAccessToken(const QString &accessToken, int expiresIn, const QString &refreshToken)
+{
+    m_settings->setValue("oauth/accessToken", accessToken);
+    if (!refreshToken.isEmpty()) {
+        m_settings->setValue("oauth/refreshToken", refreshToken);
+        m_refreshToken = refreshToken;
+    }
+    setTokenExpiry(expiresIn);
+    m_settings->sync();
+
+    setAccessToken(accessToken);
+}
+
 void CredentialStore::clearCredentials()
 {
     m_settings->remove("oauth/accessToken");
     m_settings->remove("oauth/refreshToken");
+    m_settings->remove("oauth/tokenExpiry");
     m_settings->sync();
 
-    setAccessToken(QString());
+    m_tokenExpiry = QDateTime();
     m_refreshToken.clear();
+    setAccessToken(QString());
 
     emit hasCredentialsChanged();
 }
@@ -46,8 +67,9 @@ void CredentialStore::loadCredentials()
     QString accessToken = m_settings->value("oauth/accessToken").toString();
     QString refreshToken = m_settings->value("oauth/refreshToken").toString();
 
-    setAccessToken(accessToken);
+    m_tokenExpiry = m_settings->value("oauth/tokenExpiry").toDateTime();
     m_refreshToken = refreshToken;
+    setAccessToken(accessToken);
 
     if (hasCredentials()) {
         emit hasCredentialsChanged();
@@ -61,3 +83,14 @@ void CredentialStore::setAccessToken(const QString &token)
         emit accessTokenChanged();
     }
 }
+
+void CredentialStore::setTokenExpiry(int expiresIn)
+{
+    if (expiresIn > 0) {
+        m_tokenExpiry = QDateTime::currentDateTimeUtc().addSecs(expiresIn);
+        m_settings->setValue("oauth/tokenExpiry", m_tokenExpiry);
+    } else {
+        m_tokenExpiry = QDateTime();
+        m_settings->remove("oauth/tokenExpiry");
+    }
+}
@@ -2,6 +2,7 @@
 #define CREDENTIALSTORE_H
 
 #include <QObject>
+#include <QDateTime>
 #include <QSettings>
 #include <QString>
 
@@ -18,8 +19,16 @@ public:
     bool hasCredentials() const;
     QString accessToken() const { return m_accessToken; }
     QString refreshToken() const { return m_refreshToken; }
+    QDateTime tokenExpiry() const { return m_tokenExpiry; }
 
-    Q_INVOKABLE void saveCredentials(const QString &accessToken, const QString &refreshToken);
+    // False when the expiry is unknown, e.g. for credentials saved before
+    // it was recorded
+    bool tokenExpiresWithin(int seconds) const;
+
+    Q_INVOKABLE void saveCredentials(const QString &accessToken, const QString &refreshToken, int expiresIn = 0);
+    // Stores a refreshed access token; Google only sometimes rotates the
+    // refresh token, so an empty one keeps the current
+    void updateAccessToken(const QString &accessToken, int expiresIn, const QString &refreshToken = QString());
     Q_INVOKABLE void clearCredentials();
     Q_INVOKABLE void loadCredentials();
 
@@ -29,10 +38,12 @@ signals:
 
 private:
     void setAccessToken(const QString &token);
+    void setTokenExpiry(int expiresIn);
 
     QSettings *m_settings;
     QString m_accessToken;
     QString m_refreshToken;
+    QDateTime m_tokenExpiry;
 };
 
 #endif // CREDENTIALSTORE_H
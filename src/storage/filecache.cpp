@@ -1,6 +1,575 @@
 #include "filecache.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QUrl>
+#include <QtConcurrent>
+#include <QDebug>
+#include <algorithm>
+#include <cstdio>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+// Listings kept decoded in memory, counted in rows
+const int FileCache::MEMORY_CACHE_ROWS = 20000;
+const qint64 FileCache::DEFAULT_CONTENT_LIMIT = 256 * 1024 * 1024;
+const qint64 FileCache::THUMBNAIL_LIMIT = 32 * 1024 * 1024;
+
+namespace {
+
+const QString FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
+
+// Matches the "folder,name" order listings are requested in
+bool listedBefore(const QJsonObject &a, const QJsonObject &b)
+{
+    bool aFolder = a.value("mimeType").toString() == FOLDER_MIME_TYPE;
+    bool bFolder = b.value("mimeType").toString() == FOLDER_MIME_TYPE;
+    if (aFolder != bFolder)
+        return aFolder;
+    return a.value("name").toString().compare(b.value("name").toString(), Qt::CaseInsensitive) < 0;
+}
+
+int indexOfFile(const QJsonArray &files, const QString &fileId)
+{
+    for (int i = 0; i < files.count(); ++i) {
+        if (files.at(i).toObject().value("id").toString() == fileId)
+            return i;
+    }
+    return -1;
+}
+
+// Hard links when both paths are on one filesystem, which neither copies
+// nor doubles the disk use; copies otherwise. Either way through a
+// temporary name and rename, so a crash never leaves a truncated file.
+// Runs on a worker thread.
+bool placeFile(const QString &source, const QString &destination)
+{
+    const QString partPath = destination + ".copying";
+    QFile::remove(partPath);
+
+    bool placed = false;
+#ifdef Q_OS_UNIX
+    placed = ::link(QFile::encodeName(source).constData(), QFile::encodeName(partPath).constData()) == 0;
+#endif
+    if (!placed && !QFile::copy(source, partPath))
+        return false;
+
+    if (std::rename(QFile::encodeName(partPath).constData(), QFile::encodeName(destination).constData()) != 0) {
+        QFile::remove(partPath);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
 
 FileCache::FileCache(QObject *parent)
     : QObject(parent)
+    , m_metadataPath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/metadata")
+    , m_contentPath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/content")
+    , m_thumbnailPath(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails")
+    , m_folders(MEMORY_CACHE_ROWS)
+    , m_generation(0)
+    , m_contentSize(0)
+    , m_contentLimit(QSettings().value("cache/contentLimit", DEFAULT_CONTENT_LIMIT).toLongLong())
+    , m_thumbnailSize(0)
+    , m_listingsLoaded(false)
+{
+    QDir().mkpath(m_metadataPath);
+    QDir().mkpath(m_contentPath);
+    QDir().mkpath(m_thumbnailPath);
+
+    // LRU timestamps change on every hit; batch the index writes
+    m_indexSaveTimer.setSingleShot(true);
+    m_indexSaveTimer.setInterval(2000);
+    connect(&m_indexSaveTimer, &QTimer::timeout, this, &FileCache::saveContentIndex);
+
+    loadContentIndex();
+    loadThumbnails();
+}
+
+FileCache::~FileCache()
+{
+    if (m_indexSaveTimer.isActive()) {
+        saveContentIndex();
+    }
+}
+
+void FileCache::setContentLimit(qint64 limit)
+{
+    if (m_contentLimit != limit && limit >= 0) {
+        m_contentLimit = limit;
+        QSettings().setValue("cache/contentLimit", limit);
+        evictContent(m_contentLimit);
+        emit contentLimitChanged();
+    }
+}
+
+void FileCache::clear()
+{
+    m_folders.clear();
+    m_fileFolders.clear();
+    m_content.clear();
+    m_searchIndex.clear();
+    m_indexSaveTimer.stop();
+
+    // Stores still running may land their file in the new directory; they
+    // see the generation changed and remove it. Their ids stay in
+    // m_storing until then, so no new store of the same file collides.
+    ++m_generation;
+
+    // Also drops the changes token, which only makes sense with the listings
+    QDir(m_metadataPath).removeRecursively();
+    QDir(m_contentPath).removeRecursively();
+    QDir(m_thumbnailPath).removeRecursively();
+    QDir().mkpath(m_metadataPath);
+    QDir().mkpath(m_contentPath);
+    QDir().mkpath(m_thumbnailPath);
+
+    if (cacheSize() != 0) {
+        m_contentSize = 0;
+        m_thumbnailSize = 0;
+        emit cacheSizeChanged();
+    }
+}
+
+QJsonObject FileCache::fileMetadata(const QString &fileId)
+{
+    const QString folderId = m_fileFolders.value(fileId);
+    if (folderId.isEmpty())
+        return QJsonObject();
+
+    QJsonArray files;
+    if (!folderListing(folderId, &files))
+        return QJsonObject();
+
+    int row = indexOfFile(files, fileId);
+    return row >= 0 ? files.at(row).toObject() : QJsonObject();
+}
+
+QString FileCache::contentVersion(const QJsonObject &metadata)
+{
+    // Prefer the checksum; Google Docs formats have none, fall back to mtime
+    QString md5 = metadata.value("md5Checksum").toString();
+    if (!md5.isEmpty())
+        return md5;
+    return metadata.value("modifiedTime").toString();
+}
+
+bool FileCache::restoreContent(const QString &fileId, const QString &version, const QString &localPath)
+{
+    if (version.isEmpty())
+        return false;
+
+    QHash<QString, ContentEntry>::iterator it = m_content.find(fileId);
+    if (it == m_content.end())
+        return false;
+
+    // A cached file is shared with the copies placed from it; one edited
+    // in place changes the entry too
+    const QFileInfo info(contentPath(fileId));
+    if (it->version != version || info.size() != it->size
+            || (it->modified > 0 && info.lastModified().toMSecsSinceEpoch() != it->modified)) {
+        removeContent(fileId);
+        return false;
+    }
+
+    it->lastAccess = QDateTime::currentMSecsSinceEpoch();
+    scheduleIndexSave();
+
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, localPath]() {
+        watcher->deleteLater();
+        emit contentRestored(localPath, watcher->result());
+    });
+    watcher->setFuture(QtConcurrent::run(placeFile, contentPath(fileId), localPath));
+    return true;
+}
+
+void FileCache::storeContent(const QString &fileId, const QString &version, const QString &localPath)
+{
+    if (version.isEmpty() || m_storing.contains(fileId))
+        return;
+
+    qint64 size = QFileInfo(localPath).size();
+    if (size > m_contentLimit)
+        return;
+
+    removeContent(fileId);
+    evictContent(m_contentLimit - size);
+
+    const QString path = contentPath(fileId);
+    const int generation = m_generation;
+    m_storing.insert(fileId);
+
+    QFutureWatcher<bool> *watcher = new QFutureWatcher<bool>(this);
+    connect(watcher, &QFutureWatcher<bool>::finished, this, [this, watcher, fileId, version, path, size, generation]() {
+        watcher->deleteLater();
+        m_storing.remove(fileId);
+        if (generation != m_generation) {
+            QFile::remove(path);
+            return;
+        }
+        if (!watcher->result()) {
+            qWarning() << "Cannot cache content of" << fileId;
+            return;
+        }
+
+        ContentEntry entry;
+        entry.version = version;
+        entry.size = size;
+        entry.modified = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+        entry.lastAccess = QDateTime::currentMSecsSinceEpoch();
+        m_content.insert(fileId, entry);
+        m_contentSize += size;
+        evictContent(m_contentLimit);
+
+        scheduleIndexSave();
+        emit cacheSizeChanged();
+    });
+    watcher->setFuture(QtConcurrent::run(placeFile, localPath, path));
+}
+
+QString FileCache::thumbnailPath(const QString &fileId) const
+{
+    return m_thumbnailPath + "/" + QString::fromLatin1(QUrl::toPercentEncoding(fileId));
+}
+
+bool FileCache::hasThumbnail(const QString &fileId, qint64 notBefore) const
+{
+    QFileInfo info(thumbnailPath(fileId));
+    return info.exists() && info.lastModified().toMSecsSinceEpoch() >= notBefore;
+}
+
+void FileCache::storeThumbnail(const QString &fileId, const QByteArray &data)
+{
+    const QString path = thumbnailPath(fileId);
+    qint64 previous = QFileInfo(path).size();
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "Cannot cache thumbnail of" << fileId;
+        return;
+    }
+
+    m_thumbnailSize += data.size() - previous;
+    evictThumbnails(THUMBNAIL_LIMIT);
+    emit cacheSizeChanged();
+}
+
+bool FileCache::folderListing(const QString &folderId, QJsonArray *files)
+{
+    if (QJsonArray *cached = m_folders.object(folderId)) {
+        *files = *cached;
+        return true;
+    }
+
+    QFile file(folderPath(folderId));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    // Binary JSON loads without a text parse
+    QJsonDocument doc = QJsonDocument::fromBinaryData(file.readAll());
+    if (!doc.isArray()) {
+        qWarning() << "Discarding unreadable metadata cache for folder" << folderId;
+        file.remove();
+        return false;
+    }
+
+    *files = doc.array();
+    m_folders.insert(folderId, new QJsonArray(*files), qMax(1, files->count()));
+    indexListing(folderId, *files);
+    return true;
+}
+
+void FileCache::storeFolderListing(const QString &folderId, const QJsonArray &files)
+{
+    m_folders.insert(folderId, new QJsonArray(files), qMax(1, files.count()));
+    indexListing(folderId, files);
+
+    QSaveFile file(folderPath(folderId));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write metadata cache for folder" << folderId;
+        return;
+    }
+    file.write(QJsonDocument(files).toBinaryData());
+    if (!file.commit()) {
+        qWarning() << "Cannot write metadata cache for folder" << folderId;
+    }
+}
+
+void FileCache::removeFolderListing(const QString &folderId)
+{
+    m_folders.remove(folderId);
+    m_searchIndex.removeFolder(folderId);
+    QFile::remove(folderPath(folderId));
+}
+
+void FileCache::applyChanges(const QJsonArray &changes)
+{
+    if (changes.isEmpty())
+        return;
+
+    // The index says where a file is listed now and its parents where it
+    // goes, so only those listings are read and rewritten
+    loadListings();
+
+    QHash<QString, QJsonArray> listings;
+    QSet<QString> modified;
+    for (const QJsonValue &value : changes) {
+        const QJsonObject change = value.toObject();
+        const QString fileId = change.value("fileId").toString();
+        QJsonObject file = change.value("file").toObject();
+        const bool gone = change.value("removed").toBool() || file.value("trashed").toBool();
+        const QJsonArray parents = gone ? QJsonArray() : file.value("parents").toArray();
+
+        QStringList folderIds;
+        if (m_fileFolders.contains(fileId))
+            folderIds.append(m_fileFolders.value(fileId));
+        for (const QJsonValue &parent : parents) {
+            const QString folderId = parent.toString();
+            if (!folderIds.contains(folderId) && (m_folders.contains(folderId) || QFile::exists(folderPath(folderId))))
+                folderIds.append(folderId);
+        }
+
+        file.remove("parents");
+        file.remove("trashed");
+        m_fileFolders.remove(fileId);
+
+        for (const QString &folderId : folderIds) {
+            if (!listings.contains(folderId)) {
+                QJsonArray files;
+                if (!folderListing(folderId, &files))
+                    continue;
+                listings.insert(folderId, files);
+            }
+            QJsonArray &files = listings[folderId];
+
+            int row = indexOfFile(files, fileId);
+            if (row >= 0) {
+                files.removeAt(row);
+                modified.insert(folderId);
+            }
+            if (!parents.contains(folderId))
+                continue;
+
+            int position = 0;
+            while (position < files.count() && !listedBefore(file, files.at(position).toObject()))
+                ++position;
+            files.insert(position, file);
+            m_fileFolders.insert(fileId, folderId);
+            modified.insert(folderId);
+        }
+    }
+
+    for (const QString &folderId : modified) {
+        storeFolderListing(folderId, listings.value(folderId));
+    }
+
+    // Listings of deleted folders are of no further use
+    for (const QJsonValue &value : changes) {
+        const QJsonObject change = value.toObject();
+        if (change.value("removed").toBool() || change.value("file").toObject().value("trashed").toBool()) {
+            removeFolderListing(change.value("fileId").toString());
+        }
+    }
+}
+
+QString FileCache::changesToken() const
+{
+    QSettings state(statePath(), QSettings::IniFormat);
+    return state.value("changes/startPageToken").toString();
+}
+
+void FileCache::setChangesToken(const QString &token)
+{
+    QSettings state(statePath(), QSettings::IniFormat);
+    state.setValue("changes/startPageToken", token);
+    state.sync();
+}
+
+QString FileCache::rootFolderId() const
+{
+    QSettings state(statePath(), QSettings::IniFormat);
+    return state.value("drive/rootFolderId").toString();
+}
+
+void FileCache::setRootFolderId(const QString &folderId)
+{
+    QSettings state(statePath(), QSettings::IniFormat);
+    state.setValue("drive/rootFolderId", folderId);
+    state.sync();
+}
+
+QString FileCache::statePath() const
+{
+    // Lives next to the listings so both are dropped together
+    return m_metadataPath + "/state.ini";
+}
+
+QString FileCache::contentPath(const QString &fileId) const
+{
+    return m_contentPath + "/" + QString::fromLatin1(QUrl::toPercentEncoding(fileId));
+}
+
+void FileCache::indexListing(const QString &folderId, const QJsonArray &files)
+{
+    for (const QJsonValue &file : files) {
+        m_fileFolders.insert(file.toObject().value("id").toString(), folderId);
+    }
+    m_searchIndex.setFolder(folderId, files);
+}
+
+QJsonArray FileCache::searchNames(const QString &query, int limit)
+{
+    loadListings();
+    return m_searchIndex.search(query, limit);
+}
+
+void FileCache::loadListings()
+{
+    // Listings are otherwise loaded as folders are opened; searching and
+    // the file index should cover everything browsed before, also in
+    // earlier runs. Stored listings keep both up to date from then on.
+    if (m_listingsLoaded)
+        return;
+    m_listingsLoaded = true;
+
+    const QStringList entries = QDir(m_metadataPath).entryList(QStringList() << "*.bin", QDir::Files);
+    for (const QString &entry : entries) {
+        const QString folderId = QUrl::fromPercentEncoding(entry.left(entry.size() - 4).toLatin1());
+        if (!m_folders.contains(folderId)) {
+            QJsonArray files;
+            folderListing(folderId, &files);
+        }
+    }
+}
+
+void FileCache::loadContentIndex()
+{
+    QFile file(m_contentPath + "/index.json");
+    if (file.open(QIODevice::ReadOnly)) {
+        const QJsonObject index = QJsonDocument::fromJson(file.readAll()).object();
+        for (QJsonObject::const_iterator it = index.constBegin(); it != index.constEnd(); ++it) {
+            const QJsonObject value = it.value().toObject();
+
+            // Trust the index only where the file on disk agrees with it
+            ContentEntry entry;
+            entry.version = value.value("version").toString();
+            entry.size = static_cast<qint64>(value.value("size").toDouble());
+            entry.lastAccess = static_cast<qint64>(value.value("lastAccess").toDouble());
+            entry.modified = static_cast<qint64>(value.value("modified").toDouble());
+            if (QFileInfo(contentPath(it.key())).size() != entry.size)
+                continue;
+
+            m_content.insert(it.key(), entry);
+            m_contentSize += entry.size;
+        }
+    }
+
+    // Drop anything the index does not know about, e.g. after a crash
+    const QStringList entries = QDir(m_contentPath).entryList(QDir::Files);
+    for (const QString &entry : entries) {
+        if (entry == "index.json")
+            continue;
+        if (!m_content.contains(QUrl::fromPercentEncoding(entry.toLatin1())))
+            QFile::remove(m_contentPath + "/" + entry);
+    }
+
+    evictContent(m_contentLimit);
+}
+
+void FileCache::saveContentIndex()
+{
+    QJsonObject index;
+    for (QHash<QString, ContentEntry>::const_iterator it = m_content.constBegin(); it != m_content.constEnd(); ++it) {
+        QJsonObject value;
+        value["version"] = it->version;
+        value["size"] = static_cast<double>(it->size);
+        value["lastAccess"] = static_cast<double>(it->lastAccess);
+        value["modified"] = static_cast<double>(it->modified);
+        index[it.key()] = value;
+    }
+
+    QSaveFile file(m_contentPath + "/index.json");
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write content cache index";
+        return;
+    }
+    file.write(QJsonDocument(index).toJson(QJsonDocument::Compact));
+    file.commit();
+}
+
+void FileCache::evictContent(qint64 budget)
+{
+    if (m_contentSize <= budget)
+        return;
+
+    QList<QPair<qint64, QString> > byAccess;
+    for (QHash<QString, ContentEntry>::const_iterator it = m_content.constBegin(); it != m_content.constEnd(); ++it) {
+        byAccess.append(qMakePair(it->lastAccess, it.key()));
+    }
+    std::sort(byAccess.begin(), byAccess.end());
+
+    for (int i = 0; i < byAccess.count() && m_contentSize > budget; ++i) {
+        removeContent(byAccess.at(i).second);
+    }
+}
+
+void FileCache::removeContent(const QString &fileId)
+{
+    QHash<QString, ContentEntry>::iterator it = m_content.find(fileId);
+    if (it == m_content.end())
+        return;
+
+    QFile::remove(contentPath(fileId));
+    m_contentSize -= it->size;
+    m_content.erase(it);
+
+    scheduleIndexSave();
+    emit cacheSizeChanged();
+}
+
+void FileCache::scheduleIndexSave()
+{
+    if (!m_indexSaveTimer.isActive()) {
+        m_indexSaveTimer.start();
+    }
+}
+
+void FileCache::loadThumbnails()
+{
+    const QFileInfoList entries = QDir(m_thumbnailPath).entryInfoList(QDir::Files);
+    for (const QFileInfo &entry : entries) {
+        m_thumbnailSize += entry.size();
+    }
+    evictThumbnails(THUMBNAIL_LIMIT);
+}
+
+void FileCache::evictThumbnails(qint64 budget)
+{
+    if (m_thumbnailSize <= budget)
+        return;
+
+    // Oldest first; thumbnails are cheap to fetch again
+    const QFileInfoList entries = QDir(m_thumbnailPath).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    for (int i = 0; i < entries.count() && m_thumbnailSize > budget; ++i) {
+        if (QFile::remove(entries.at(i).filePath()))
+            m_thumbnailSize -= entries.at(i).size();
+    }
+}
+
+QString FileCache::folderPath(const QString &folderId) const
 {
+    // Drive ids are URL-safe already; encode anyway so an alias can never
+    // escape the cache directory
+    return m_metadataPath + "/" + QString::fromLatin1(QUrl::toPercentEncoding(folderId)) + ".bin";
 }
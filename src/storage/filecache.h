@@ -2,12 +2,115 @@
 #define FILECACHE_H
 
 #include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include "searchindex.h"
 
+// On-disk store of Drive metadata and file contents. Folder listings are
+// kept per folder id so a folder that was seen before can be painted
+// without the network and then revalidated in the background. Downloaded
+// files are kept in a size-bounded LRU keyed on file id and revision, and
+// fetched thumbnails in a smaller bounded store next to them.
 class FileCache : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(qint64 cacheSize READ cacheSize NOTIFY cacheSizeChanged)
+    Q_PROPERTY(qint64 contentLimit READ contentLimit WRITE setContentLimit NOTIFY contentLimitChanged)
+
 public:
     explicit FileCache(QObject *parent = nullptr);
+    ~FileCache();
+
+    qint64 cacheSize() const { return m_contentSize + m_thumbnailSize; }
+    qint64 contentLimit() const { return m_contentLimit; }
+    void setContentLimit(qint64 limit);
+
+    Q_INVOKABLE void clear();
+
+    // Metadata of a file seen in any loaded listing
+    QJsonObject fileMetadata(const QString &fileId);
+    static QString contentVersion(const QJsonObject &metadata);
+
+    // Both place the file on a worker thread, as a hard link where the
+    // filesystem allows and a copy otherwise. restoreContent() returns
+    // false when nothing current is cached; otherwise contentRestored()
+    // follows.
+    bool restoreContent(const QString &fileId, const QString &version, const QString &localPath);
+    void storeContent(const QString &fileId, const QString &version, const QString &localPath);
+
+    // Encoded thumbnail bytes; stale if older than notBefore (msecs)
+    QString thumbnailPath(const QString &fileId) const;
+    bool hasThumbnail(const QString &fileId, qint64 notBefore) const;
+    void storeThumbnail(const QString &fileId, const QByteArray &data);
+
+    bool folderListing(const QString &folderId, QJsonArray *files);
+    void storeFolderListing(const QString &folderId, const QJsonArray &files);
+    void removeFolderListing(const QString &folderId);
+
+    // Applies entries from the changes feed to the cached listings that
+    // held or now hold the files
+    void applyChanges(const QJsonArray &changes);
+
+    // Files in any cached listing whose name contains query, ranked; see
+    // SearchIndex. The first call reads every stored listing.
+    QJsonArray searchNames(const QString &query, int limit);
+
+    QString changesToken() const;
+    void setChangesToken(const QString &token);
+    QString rootFolderId() const;
+    void setRootFolderId(const QString &folderId);
+
+signals:
+    void cacheSizeChanged();
+    void contentLimitChanged();
+    void contentRestored(const QString &localPath, bool restored);
+
+private slots:
+    void saveContentIndex();
+
+private:
+    struct ContentEntry {
+        QString version;
+        qint64 size;
+        qint64 modified;    // of the cached file, 0 if not recorded
+        qint64 lastAccess;
+    };
+
+    QString folderPath(const QString &folderId) const;
+    QString statePath() const;
+    QString contentPath(const QString &fileId) const;
+    void indexListing(const QString &folderId, const QJsonArray &files);
+    void loadListings();
+    void loadContentIndex();
+    void evictContent(qint64 budget);
+    void removeContent(const QString &fileId);
+    void scheduleIndexSave();
+    void loadThumbnails();
+    void evictThumbnails(qint64 budget);
+
+    QString m_metadataPath;
+    QString m_contentPath;
+    QString m_thumbnailPath;
+    QCache<QString, QJsonArray> m_folders;
+    QHash<QString, QString> m_fileFolders;
+    QHash<QString, ContentEntry> m_content;
+    QSet<QString> m_storing;    // file ids being placed in the cache
+    int m_generation;           // bumped by clear() to drop stores in flight
+    qint64 m_contentSize;
+    qint64 m_contentLimit;
+    qint64 m_thumbnailSize;
+    QTimer m_indexSaveTimer;
+    SearchIndex m_searchIndex;
+    bool m_listingsLoaded;
+
+    static const int MEMORY_CACHE_ROWS;
+    static const qint64 DEFAULT_CONTENT_LIMIT;
+    static const qint64 THUMBNAIL_LIMIT;
 };
 
 #endif // FILECACHE_H
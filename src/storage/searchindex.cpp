@@ -0,0 +1,198 @@
+#include "searchindex.h"
+#include <QSet>
+#include <algorithm>
+
+namespace {
+
+struct Hit {
+    int rank;
+    int length;
+    int slot;
+};
+
+} // namespace
+
+SearchIndex::SearchIndex()
+    : m_stalePostings(0)
+    , m_livePostings(0)
+{
+}
+
+void SearchIndex::setFolder(const QString &folderId, const QJsonArray &files)
+{
+    removeFolder(folderId);
+
+    QVector<int> &folderSlots = m_folders[folderId];
+    folderSlots.reserve(files.count());
+    for (const QJsonValue &value : files) {
+        const QJsonObject file = value.toObject();
+        const QString fileId = file.value("id").toString();
+        if (fileId.isEmpty())
+            continue;
+
+        // A file with several parents is found once, under the folder
+        // listed last
+        if (m_slots.contains(fileId)) {
+            removeDocument(m_slots.value(fileId));
+        }
+
+        int slot;
+        if (!m_freeSlots.isEmpty()) {
+            slot = m_freeSlots.takeLast();
+        } else {
+            slot = m_documents.count();
+            m_documents.append(Document());
+        }
+
+        Document &document = m_documents[slot];
+        document.fileId = fileId;
+        document.folderId = folderId;
+        document.name = fold(file.value("name").toString());
+        document.metadata = file;
+        document.live = true;
+        m_slots.insert(fileId, slot);
+        folderSlots.append(slot);
+        indexDocument(slot);
+    }
+
+    if (m_stalePostings > m_livePostings) {
+        compact();
+    }
+}
+
+void SearchIndex::removeFolder(const QString &folderId)
+{
+    const QVector<int> folderSlots = m_folders.take(folderId);
+    for (int slot : folderSlots) {
+        // Slots are reused, so check the document still belongs here
+        const Document &document = m_documents.at(slot);
+        if (document.live && document.folderId == folderId) {
+            removeDocument(slot);
+        }
+    }
+}
+
+void SearchIndex::clear()
+{
+    m_documents.clear();
+    m_freeSlots.clear();
+    m_slots.clear();
+    m_folders.clear();
+    m_postings.clear();
+    m_stalePostings = 0;
+    m_livePostings = 0;
+}
+
+QJsonArray SearchIndex::search(const QString &query, int limit) const
+{
+    const QString needle = fold(query.trimmed());
+    if (needle.isEmpty() || limit <= 0)
+        return QJsonArray();
+
+    // Only names holding the query's rarest trigram can match. Shorter
+    // queries have no trigram and check every name, which is still cheap.
+    const QVector<int> *candidates = nullptr;
+    for (int i = 0; i + 3 <= needle.length(); ++i) {
+        QHash<quint64, QVector<int> >::const_iterator it = m_postings.constFind(trigram(needle, i));
+        if (it == m_postings.constEnd())
+            return QJsonArray();
+        if (!candidates || it->count() < candidates->count())
+            candidates = &it.value();
+    }
+
+    QVector<Hit> hits;
+    QSet<int> seen;
+    const int count = candidates ? candidates->count() : m_documents.count();
+    for (int i = 0; i < count; ++i) {
+        const int slot = candidates ? candidates->at(i) : i;
+        const Document &document = m_documents.at(slot);
+        // Postings of removed names linger until the next compaction
+        if (!document.live || seen.contains(slot))
+            continue;
+        seen.insert(slot);
+
+        const int position = document.name.indexOf(needle);
+        if (position < 0)
+            continue;
+
+        Hit hit;
+        hit.rank = document.name.length() == needle.length() ? 0
+                 : position == 0 ? 1
+                 : !document.name.at(position - 1).isLetterOrNumber() ? 2
+                 : 3;
+        hit.length = document.name.length();
+        hit.slot = slot;
+        hits.append(hit);
+    }
+
+    const int wanted = qMin(limit, hits.count());
+    std::partial_sort(hits.begin(), hits.begin() + wanted, hits.end(), [this](const Hit &a, const Hit &b) {
+        if (a.rank != b.rank)
+            return a.rank < b.rank;
+        if (a.length != b.length)
+            return a.length < b.length;
+        return m_documents.at(a.slot).name < m_documents.at(b.slot).name;
+    });
+
+    QJsonArray results;
+    for (int i = 0; i < wanted; ++i) {
+        results.append(m_documents.at(hits.at(i).slot).metadata);
+    }
+    return results;
+}
+
+QString SearchIndex::fold(const QString &text)
+{
+    // "Kesä" is found by "kesa": decompose and drop the combining marks
+    const QString decomposed = text.normalized(QString::NormalizationForm_KD);
+    QString folded;
+    folded.reserve(decomposed.length());
+    for (const QChar c : decomposed) {
+        if (c.category() != QChar::Mark_NonSpacing)
+            folded.append(c);
+    }
+    return folded.toCaseFolded();
+}
+
+void SearchIndex::removeDocument(int slot)
+{
+    Document &document = m_documents[slot];
+    if (m_slots.value(document.fileId, -1) == slot) {
+        m_slots.remove(document.fileId);
+    }
+
+    const int postings = qMax(0, document.name.length() - 2);
+    m_stalePostings += postings;
+    m_livePostings -= postings;
+
+    document.live = false;
+    document.metadata = QJsonObject();
+    m_freeSlots.append(slot);
+}
+
+void SearchIndex::indexDocument(int slot)
+{
+    const QString &name = m_documents.at(slot).name;
+    for (int i = 0; i + 3 <= name.length(); ++i) {
+        m_postings[trigram(name, i)].append(slot);
+        m_livePostings++;
+    }
+}
+
+void SearchIndex::compact()
+{
+    m_postings.clear();
+    m_stalePostings = 0;
+    m_livePostings = 0;
+    for (int slot = 0; slot < m_documents.count(); ++slot) {
+        if (m_documents.at(slot).live)
+            indexDocument(slot);
+    }
+}
+
+quint64 SearchIndex::trigram(const QString &text, int position)
+{
+    return (quint64(text.at(position).unicode()) << 32)
+            | (quint64(text.at(position + 1).unicode()) << 16)
+            | quint64(text.at(position + 2).unicode());
+}
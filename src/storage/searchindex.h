@@ -0,0 +1,53 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+#include <QVector>
+
+// In-memory name index over file metadata, fed per folder listing. Names
+// are case- and accent-folded and broken into trigrams; a query walks the
+// shortest posting list of its trigrams and checks only those names, so
+// it answers in well under a frame even for tens of thousands of files.
+class SearchIndex
+{
+public:
+    SearchIndex();
+
+    // Replaces whatever was indexed for folderId
+    void setFolder(const QString &folderId, const QJsonArray &files);
+    void removeFolder(const QString &folderId);
+    void clear();
+
+    // Metadata of files whose name contains query, best matches first:
+    // whole name, then name prefix, then word prefix, then anywhere
+    QJsonArray search(const QString &query, int limit) const;
+
+    static QString fold(const QString &text);
+
+private:
+    struct Document {
+        QString fileId;
+        QString folderId;
+        QString name;       // folded
+        QJsonObject metadata;
+        bool live;
+    };
+
+    void removeDocument(int slot);
+    void indexDocument(int slot);
+    void compact();
+    static quint64 trigram(const QString &text, int position);
+
+    QVector<Document> m_documents;
+    QVector<int> m_freeSlots;
+    QHash<QString, int> m_slots;                // file id
+    QHash<QString, QVector<int> > m_folders;    // folder id to slots
+    QHash<quint64, QVector<int> > m_postings;
+    int m_stalePostings;
+    int m_livePostings;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,163 @@
+#include "syncjournal.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QDebug>
+
+SyncJournal::SyncJournal(const QString &path)
+    : m_path(path)
+{
+}
+
+void SyncJournal::load()
+{
+    m_entries.clear();
+    m_paths.clear();
+
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    const QJsonObject journal = QJsonDocument::fromJson(file.readAll()).object();
+    m_folderId = journal.value("folderId").toString();
+    m_changesToken = journal.value("changesToken").toString();
+
+    const QJsonObject entries = journal.value("entries").toObject();
+    for (QJsonObject::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QJsonObject value = it.value().toObject();
+        Entry entry;
+        entry.fileId = value.value("fileId").toString();
+        entry.folder = value.value("folder").toBool();
+        entry.md5 = value.value("md5").toString();
+        entry.size = static_cast<qint64>(value.value("size").toDouble(-1));
+        entry.modified = static_cast<qint64>(value.value("modified").toDouble(-1));
+        insert(it.key(), entry);
+    }
+}
+
+void SyncJournal::save()
+{
+    QJsonObject entries;
+    for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        QJsonObject value;
+        value["fileId"] = it->fileId;
+        if (it->folder) {
+            value["folder"] = true;
+        } else {
+            value["md5"] = it->md5;
+            value["size"] = static_cast<double>(it->size);
+            value["modified"] = static_cast<double>(it->modified);
+        }
+        entries[it.key()] = value;
+    }
+
+    QJsonObject journal;
+    journal["folderId"] = m_folderId;
+    journal["changesToken"] = m_changesToken;
+    journal["entries"] = entries;
+
+    QDir().mkpath(QFileInfo(m_path).path());
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Cannot write sync journal";
+        return;
+    }
+    file.write(QJsonDocument(journal).toJson(QJsonDocument::Compact));
+    file.commit();
+}
+
+void SyncJournal::reset(const QString &folderId)
+{
+    m_entries.clear();
+    m_paths.clear();
+    m_folderId = folderId;
+    m_changesToken.clear();
+
+    Entry root;
+    root.fileId = folderId;
+    root.folder = true;
+    insert(QString(""), root);
+}
+
+void SyncJournal::insert(const QString &path, const Entry &entry)
+{
+    if (m_entries.contains(path)) {
+        m_paths.remove(m_entries.value(path).fileId);
+    }
+    m_entries.insert(path, entry);
+    m_paths.insert(entry.fileId, path);
+}
+
+void SyncJournal::remove(const QString &path)
+{
+    const QStringList paths = subtree(path);
+    for (const QString &entry : paths) {
+        m_paths.remove(m_entries.take(entry).fileId);
+    }
+}
+
+void SyncJournal::move(const QString &from, const QString &to)
+{
+    const QStringList paths = subtree(from);
+    QHash<QString, Entry> moved;
+    for (const QString &path : paths) {
+        moved.insert(to + path.mid(from.length()), m_entries.take(path));
+    }
+    for (QHash<QString, Entry>::const_iterator it = moved.constBegin(); it != moved.constEnd(); ++it) {
+        insert(it.key(), it.value());
+    }
+}
+
+bool SyncJournal::findFile(const QString &fileId, QString *path) const
+{
+    QHash<QString, QString>::const_iterator it = m_paths.constFind(fileId);
+    if (it == m_paths.constEnd())
+        return false;
+    *path = it.value();
+    return true;
+}
+
+QStringList SyncJournal::children(const QString &path) const
+{
+    QStringList children;
+    for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (!it.key().isEmpty() && parentPath(it.key()) == path)
+            children << it.key();
+    }
+    return children;
+}
+
+QStringList SyncJournal::folders() const
+{
+    QStringList folders;
+    for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (it->folder)
+            folders << it.key();
+    }
+    return folders;
+}
+
+QString SyncJournal::parentPath(const QString &path)
+{
+    const int slash = path.lastIndexOf('/');
+    return slash < 0 ? QString("") : path.left(slash);
+}
+
+QString SyncJournal::childPath(const QString &parent, const QString &name)
+{
+    return parent.isEmpty() ? name : parent + "/" + name;
+}
+
+QStringList SyncJournal::subtree(const QString &path) const
+{
+    QStringList paths;
+    const QString prefix = path + "/";
+    for (QHash<QString, Entry>::const_iterator it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (it.key() == path || it.key().startsWith(prefix))
+            paths << it.key();
+    }
+    return paths;
+}
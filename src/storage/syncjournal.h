@@ -0,0 +1,61 @@
+#ifndef SYNCJOURNAL_H
+#define SYNCJOURNAL_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+// What a synced folder looked like on both sides the last time they
+// agreed, by path relative to the local root ("" is the root itself).
+// Each sync pass compares only what changed against this instead of
+// walking both trees.
+class SyncJournal
+{
+public:
+    struct Entry {
+        Entry() : folder(false), size(-1), modified(-1) {}
+
+        QString fileId;
+        bool folder;
+        QString md5;        // content both sides last agreed on
+        qint64 size;        // local size and mtime (msecs) at that point
+        qint64 modified;
+    };
+
+    explicit SyncJournal(const QString &path);
+
+    void load();
+    void save();
+    // Starts over for a new pinned folder
+    void reset(const QString &folderId);
+
+    QString folderId() const { return m_folderId; }
+    // Where the changes feed continues from; empty before the first run
+    QString changesToken() const { return m_changesToken; }
+    void setChangesToken(const QString &token) { m_changesToken = token; }
+
+    bool contains(const QString &path) const { return m_entries.contains(path); }
+    Entry entry(const QString &path) const { return m_entries.value(path); }
+    void insert(const QString &path, const Entry &entry);
+    // Both take the entries below a folder along
+    void remove(const QString &path);
+    void move(const QString &from, const QString &to);
+
+    bool findFile(const QString &fileId, QString *path) const;
+    QStringList children(const QString &path) const;
+    QStringList folders() const;
+
+    static QString parentPath(const QString &path);
+    static QString childPath(const QString &parent, const QString &name);
+
+private:
+    QStringList subtree(const QString &path) const;
+
+    QString m_path;
+    QString m_folderId;
+    QString m_changesToken;
+    QHash<QString, Entry> m_entries;
+    QHash<QString, QString> m_paths;    // file id to path
+};
+
+#endif // SYNCJOURNAL_H
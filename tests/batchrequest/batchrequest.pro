@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_batchrequest
+
+SOURCES += \
+    tst_batchrequest.cpp \
+    $$SRC_DIR/network/batchrequest.cpp
+
+HEADERS += \
+    $$SRC_DIR/network/batchrequest.h
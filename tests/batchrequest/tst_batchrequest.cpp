@@ -0,0 +1,189 @@
+#include <QtTest>
+#include "network/batchrequest.h"
+
+namespace {
+
+const QByteArray BOUNDARY = "batch_pK7JBAk73-E=_AA5eFwv4m2Q=";
+const QByteArray CONTENT_TYPE = "multipart/mixed; boundary=" + BOUNDARY;
+
+// One part of a response as the Drive batch endpoint sends it
+QByteArray responsePart(int index, int status, const QByteArray &reason, const QByteArray &body = QByteArray())
+{
+    QByteArray part = "--" + BOUNDARY + "\r\n"
+            "Content-Type: application/http\r\n"
+            "Content-ID: <response-item-" + QByteArray::number(index) + ">\r\n"
+            "\r\n"
+            "HTTP/1.1 " + QByteArray::number(status) + ' ' + reason + "\r\n";
+    if (!body.isEmpty()) {
+        part += "Content-Type: application/json; charset=UTF-8\r\n"
+                "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    }
+    part += "\r\n" + body + "\r\n";
+    return part;
+}
+
+QByteArray closing()
+{
+    return "--" + BOUNDARY + "--\r\n";
+}
+
+QByteArray errorBody(int code, const QByteArray &message)
+{
+    return "{\n \"error\": {\n  \"code\": " + QByteArray::number(code)
+            + ",\n  \"message\": \"" + message + "\"\n }\n}";
+}
+
+} // namespace
+
+class TestBatchRequest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void buildsOnePartPerCall();
+    void parsesEveryPart();
+    void skipsMissingPart();
+    void keepsPerItemErrors();
+    void parsesMoreThanMaxParts();
+    void acceptsQuotedBoundaryAndBareNewlines();
+    void ignoresUnknownParts();
+    void needsBoundary();
+};
+
+void TestBatchRequest::buildsOnePartPerCall()
+{
+    BatchRequest batch;
+    QCOMPARE(batch.addPart("DELETE", QUrl("https://www.googleapis.com/drive/v3/files/abc")), 0);
+    QCOMPARE(batch.addPart("PATCH", QUrl("https://www.googleapis.com/drive/v3/files/def?fields=id"), "{\"starred\":true}"), 1);
+    QCOMPARE(batch.count(), 2);
+
+    const QByteArray contentType = batch.contentType();
+    QVERIFY(contentType.startsWith("multipart/mixed; boundary="));
+    const QByteArray delimiter = "--" + contentType.mid(contentType.indexOf('=') + 1);
+
+    const QByteArray body = batch.body();
+    QCOMPARE(body.count(delimiter + "\r\n"), 2);
+    QVERIFY(body.endsWith(delimiter + "--\r\n"));
+    QVERIFY(body.contains("Content-ID: <item-0>\r\n"));
+    QVERIFY(body.contains("Content-ID: <item-1>\r\n"));
+    QVERIFY(body.contains("DELETE /drive/v3/files/abc HTTP/1.1\r\n"));
+    QVERIFY(body.contains("PATCH /drive/v3/files/def?fields=id HTTP/1.1\r\n"));
+    QVERIFY(body.contains("Content-Length: 16\r\n\r\n{\"starred\":true}\r\n"));
+}
+
+void TestBatchRequest::parsesEveryPart()
+{
+    const QByteArray data = responsePart(0, 200, "OK", "{\"id\":\"abc\",\"starred\":true}")
+            + responsePart(1, 204, "No Content")
+            + responsePart(2, 200, "OK", "{\"id\":\"ghi\",\"name\":\"Renamed\"}")
+            + closing();
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(CONTENT_TYPE, data);
+    QCOMPARE(responses.count(), 3);
+    QCOMPARE(responses.at(0).index, 0);
+    QCOMPARE(responses.at(0).status, 200);
+    QCOMPARE(responses.at(0).body, QByteArray("{\"id\":\"abc\",\"starred\":true}"));
+    QCOMPARE(responses.at(1).index, 1);
+    QCOMPARE(responses.at(1).status, 204);
+    QVERIFY(responses.at(1).body.isEmpty());
+    QCOMPARE(responses.at(2).index, 2);
+    QCOMPARE(responses.at(2).body, QByteArray("{\"id\":\"ghi\",\"name\":\"Renamed\"}"));
+}
+
+void TestBatchRequest::skipsMissingPart()
+{
+    // The caller tells which calls went unanswered from the indexes
+    const QByteArray data = responsePart(0, 204, "No Content")
+            + responsePart(1, 204, "No Content")
+            + responsePart(3, 204, "No Content")
+            + closing();
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(CONTENT_TYPE, data);
+    QCOMPARE(responses.count(), 3);
+    QCOMPARE(responses.at(0).index, 0);
+    QCOMPARE(responses.at(1).index, 1);
+    QCOMPARE(responses.at(2).index, 3);
+}
+
+void TestBatchRequest::keepsPerItemErrors()
+{
+    const QByteArray notFound = errorBody(404, "File not found: def.");
+    const QByteArray unavailable = errorBody(503, "Service unavailable");
+    const QByteArray data = responsePart(0, 200, "OK", "{\"id\":\"abc\"}")
+            + responsePart(1, 404, "Not Found", notFound)
+            + responsePart(2, 503, "Service Unavailable", unavailable)
+            + responsePart(3, 403, "Forbidden", errorBody(403, "Rate Limit Exceeded"))
+            + closing();
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(CONTENT_TYPE, data);
+    QCOMPARE(responses.count(), 4);
+    QCOMPARE(responses.at(0).status, 200);
+    QCOMPARE(responses.at(1).status, 404);
+    QCOMPARE(responses.at(1).body, notFound);
+    QCOMPARE(responses.at(2).status, 503);
+    QCOMPARE(responses.at(2).body, unavailable);
+    QCOMPARE(responses.at(3).index, 3);
+    QCOMPARE(responses.at(3).status, 403);
+}
+
+void TestBatchRequest::parsesMoreThanMaxParts()
+{
+    // The server may answer out of order; indexes come from Content-ID
+    const int count = BatchRequest::MAX_PARTS + 20;
+    QByteArray data;
+    for (int i = count - 1; i >= 0; --i) {
+        data += responsePart(i, 200, "OK", "{\"id\":\"file" + QByteArray::number(i) + "\"}");
+    }
+    data += closing();
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(CONTENT_TYPE, data);
+    QCOMPARE(responses.count(), count);
+    for (int i = 0; i < count; ++i) {
+        const BatchRequest::Response &response = responses.at(i);
+        QCOMPARE(response.index, count - 1 - i);
+        QCOMPARE(response.status, 200);
+        QCOMPARE(response.body, "{\"id\":\"file" + QByteArray::number(response.index) + "\"}");
+    }
+}
+
+void TestBatchRequest::acceptsQuotedBoundaryAndBareNewlines()
+{
+    QByteArray data = responsePart(0, 200, "OK", "{\"id\":\"abc\"}")
+            + responsePart(1, 500, "Internal Server Error", errorBody(500, "Backend Error"))
+            + closing();
+    data.replace("\r\n", "\n");
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(
+                "multipart/mixed; boundary=\"" + BOUNDARY + "\"; charset=UTF-8", data);
+    QCOMPARE(responses.count(), 2);
+    QCOMPARE(responses.at(0).status, 200);
+    QCOMPARE(responses.at(0).body, QByteArray("{\"id\":\"abc\"}"));
+    QCOMPARE(responses.at(1).index, 1);
+    QCOMPARE(responses.at(1).status, 500);
+}
+
+void TestBatchRequest::ignoresUnknownParts()
+{
+    QByteArray stray = responsePart(7, 200, "OK", "{}");
+    stray.replace("<response-item-7>", "<something-else>");
+    const QByteArray data = "This is a preamble.\r\n"
+            + responsePart(0, 200, "OK", "{}")
+            + stray
+            + "--" + BOUNDARY + "\r\nContent-Type: application/http\r\n"
+            + closing();
+
+    const QList<BatchRequest::Response> responses = BatchRequest::parseResponse(CONTENT_TYPE, data);
+    QCOMPARE(responses.count(), 1);
+    QCOMPARE(responses.at(0).index, 0);
+}
+
+void TestBatchRequest::needsBoundary()
+{
+    const QByteArray data = responsePart(0, 200, "OK", "{}") + closing();
+    QVERIFY(BatchRequest::parseResponse("application/json; charset=UTF-8", data).isEmpty());
+    QVERIFY(BatchRequest::parseResponse(CONTENT_TYPE, QByteArray()).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(TestBatchRequest)
+
+#include "tst_batchrequest.moc"
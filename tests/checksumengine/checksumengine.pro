@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_checksumengine
+
+SOURCES += \
+    tst_checksumengine.cpp \
+    $$SRC_DIR/storage/checksumengine.cpp
+
+HEADERS += \
+    $$SRC_DIR/storage/checksumengine.h
@@ -0,0 +1,145 @@
+#include <QtTest>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <utime.h>
+#include "storage/checksumengine.h"
+
+namespace {
+
+// Not a multiple of the read block, so the last read is a short one
+const int LARGE_SIZE = 3 * 256 * 1024 + 17;
+
+QByteArray content(int size, char seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i) {
+        data[i] = static_cast<char>(seed + i * 31 + i / 7);
+    }
+    return data;
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+// Pins the modification time, so rewriting a file can leave it as it was
+bool setModified(const QString &path, time_t seconds)
+{
+    utimbuf times;
+    times.actime = seconds;
+    times.modtime = seconds;
+    return ::utime(QFile::encodeName(path).constData(), &times) == 0;
+}
+
+QString md5(const QByteArray &data)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex());
+}
+
+QString requestMd5(ChecksumEngine &engine, const QString &path)
+{
+    QSignalSpy ready(&engine, &ChecksumEngine::checksumReady);
+    engine.requestMd5(path);
+    if (!ready.wait(10000))
+        return "no answer";
+    if (ready.first().at(0).toString() != path)
+        return "answer for " + ready.first().at(0).toString();
+    return ready.first().at(1).toString();
+}
+
+} // namespace
+
+class TestChecksumEngine : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void matchesMd5_data();
+    void matchesMd5();
+    void failsOnMissingFile();
+    void remembersUnchangedFiles();
+
+private:
+    QTemporaryDir *m_dir;
+};
+
+void TestChecksumEngine::initTestCase()
+{
+    // Keeps checksums.json out of the user's cache
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void TestChecksumEngine::init()
+{
+    m_dir = new QTemporaryDir;
+    QVERIFY(m_dir->isValid());
+}
+
+void TestChecksumEngine::cleanup()
+{
+    QFile::remove(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/checksums.json");
+    delete m_dir;
+}
+
+void TestChecksumEngine::matchesMd5_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("empty") << 0;
+    QTest::newRow("small") << 1000;
+    QTest::newRow("one block") << 256 * 1024;
+    QTest::newRow("several blocks") << LARGE_SIZE;
+}
+
+void TestChecksumEngine::matchesMd5()
+{
+    QFETCH(int, size);
+
+    const QByteArray data = content(size, 'a');
+    const QString path = m_dir->path() + "/file";
+    QVERIFY(writeFile(path, data));
+
+    ChecksumEngine engine;
+    QCOMPARE(requestMd5(engine, path), md5(data));
+}
+
+void TestChecksumEngine::failsOnMissingFile()
+{
+    ChecksumEngine engine;
+    QCOMPARE(requestMd5(engine, m_dir->path() + "/missing"), QString());
+}
+
+void TestChecksumEngine::remembersUnchangedFiles()
+{
+    const QString path = m_dir->path() + "/photo.jpg";
+    const QByteArray original = content(LARGE_SIZE, 'a');
+    const QByteArray edited = content(LARGE_SIZE, 'b');
+    QVERIFY(writeFile(path, original));
+    QVERIFY(setModified(path, 1500000000));
+
+    {
+        ChecksumEngine engine;
+        QCOMPARE(requestMd5(engine, path), md5(original));
+    }
+
+    // Same size and time: a new engine answers from the stored index
+    // without reading, so it still reports the original content
+    QVERIFY(writeFile(path, edited));
+    QVERIFY(setModified(path, 1500000000));
+    {
+        ChecksumEngine engine;
+        QCOMPARE(requestMd5(engine, path), md5(original));
+
+        QVERIFY(setModified(path, 1500000060));
+        QCOMPARE(requestMd5(engine, path), md5(edited));
+    }
+}
+
+QTEST_GUILESS_MAIN(TestChecksumEngine)
+#include "tst_checksumengine.moc"
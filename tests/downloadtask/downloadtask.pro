@@ -0,0 +1,16 @@
+include(../tests.pri)
+
+TARGET = tst_downloadtask
+
+SOURCES += \
+    tst_downloadtask.cpp \
+    $$SRC_DIR/network/downloadtask.cpp \
+    $$SRC_DIR/network/networkrequest.cpp \
+    $$SRC_DIR/network/retrypolicy.cpp \
+    $$SRC_DIR/storage/checksumengine.cpp
+
+HEADERS += \
+    $$SRC_DIR/network/downloadtask.h \
+    $$SRC_DIR/network/networkrequest.h \
+    $$SRC_DIR/network/retrypolicy.h \
+    $$SRC_DIR/storage/checksumengine.h
@@ -0,0 +1,464 @@
+#include <QtTest>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QStorageInfo>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <cstring>
+#include "network/downloadtask.h"
+#include "network/networkrequest.h"
+#include "testutils.h"
+
+namespace {
+
+// Served bodies repeat a pattern of prime length, so a block written at
+// the wrong offset never matches by accident
+const int PATTERN_PERIOD = 65521;
+const int BLOCK_SIZE = 1024 * 1024;
+const int PACE_CHUNK = 64 * 1024;
+
+const char *patternAt(qint64 offset)
+{
+    static QByteArray pattern;
+    if (pattern.isEmpty()) {
+        pattern.resize(PATTERN_PERIOD + BLOCK_SIZE);
+        for (int i = 0; i < pattern.size(); ++i) {
+            pattern[i] = static_cast<char>((i % PATTERN_PERIOD) % 251);
+        }
+    }
+    return pattern.constData() + offset % PATTERN_PERIOD;
+}
+
+} // namespace
+
+// Local stand-in for the Drive content endpoint. Streams a generated body
+// of any size without holding it, honours "Range: bytes=N-" and
+// "bytes=N-M", and answers requests without the current token with a 401.
+class StandInServer : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit StandInServer(qint64 size, QObject *parent = nullptr)
+        : QTcpServer(parent)
+        , m_size(size)
+        , m_stallAt(-1)
+        , m_failures(0)
+        , m_rate(0)
+        , m_token("Bearer valid")
+    {
+    }
+
+    QUrl url() const { return QUrl(QString("http://127.0.0.1:%1/content").arg(serverPort())); }
+    void setToken(const QByteArray &token) { m_token = token; }
+    // Bodies starting below offset stop there until the client gives up
+    void setStallAt(qint64 offset) { m_stallAt = offset; }
+    // The next count authorized requests get a 503 with an error body
+    void setFailures(int count) { m_failures = count; }
+    // Caps each connection at this many bytes a second; 0 for no cap
+    void setRateLimit(qint64 bytesPerSecond) { m_rate = bytesPerSecond; }
+
+    // Of every request, in order
+    QList<QByteArray> authorizations;
+    QList<qint64> offsets;
+    // Body bytes sent over all connections
+    qint64 served = 0;
+
+protected:
+    void incomingConnection(qintptr descriptor) override
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(descriptor);
+        m_streams.insert(socket, Stream());
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { readRequest(socket); });
+        connect(socket, &QTcpSocket::bytesWritten, this, [this, socket]() { writeBody(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_streams.remove(socket);
+            socket->deleteLater();
+        });
+    }
+
+private:
+    struct Stream {
+        Stream() : start(0), next(0), end(0), stall(-1), paced(false) {}
+        QByteArray header;
+        qint64 start;
+        qint64 next;
+        qint64 end;
+        qint64 stall;
+        QElapsedTimer timer;
+        bool paced;     // a rate-limited write is already scheduled
+    };
+
+    void readRequest(QTcpSocket *socket)
+    {
+        Stream &stream = m_streams[socket];
+        stream.header += socket->readAll();
+        const int headerEnd = stream.header.indexOf("\r\n\r\n");
+        if (headerEnd < 0)
+            return;
+
+        QByteArray authorization;
+        qint64 offset = 0;
+        qint64 last = m_size - 1;
+        bool ranged = false;
+        for (const QByteArray &line : stream.header.left(headerEnd).split('\n')) {
+            const int colon = line.indexOf(':');
+            const QByteArray name = line.left(colon).trimmed().toLower();
+            const QByteArray value = line.mid(colon + 1).trimmed();
+            if (name == "authorization")
+                authorization = value;
+            else if (name == "range" && value.startsWith("bytes=")) {
+                const int dash = value.indexOf('-');
+                offset = value.mid(6, dash - 6).toLongLong();
+                if (dash + 1 < value.size())
+                    last = qMin(last, value.mid(dash + 1).toLongLong());
+                ranged = true;
+            }
+        }
+        stream.header.remove(0, headerEnd + 4);
+        authorizations.append(authorization);
+        offsets.append(offset);
+
+        if (authorization != m_token) {
+            socket->write("HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n");
+            return;
+        }
+
+        if (m_failures > 0) {
+            --m_failures;
+            const QByteArray body = "{\"error\":{\"code\":503,\"message\":\"Backend Error\"}}";
+            socket->write("HTTP/1.1 503 Service Unavailable\r\nContent-Type: application/json\r\nContent-Length: "
+                          + QByteArray::number(body.size()) + "\r\n\r\n" + body);
+            return;
+        }
+
+        QByteArray response;
+        if (ranged) {
+            response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + QByteArray::number(offset)
+                    + '-' + QByteArray::number(last) + '/' + QByteArray::number(m_size) + "\r\n";
+        } else {
+            response = "HTTP/1.1 200 OK\r\n";
+        }
+        response += "Content-Type: application/octet-stream\r\nContent-Length: "
+                + QByteArray::number(last + 1 - offset) + "\r\n\r\n";
+        socket->write(response);
+
+        stream.start = offset;
+        stream.next = offset;
+        stream.end = last + 1;
+        stream.stall = offset < m_stallAt && m_stallAt < stream.end ? m_stallAt : -1;
+        stream.timer.start();
+        writeBody(socket);
+    }
+
+    void writeBody(QTcpSocket *socket)
+    {
+        if (!m_streams.contains(socket))
+            return;
+
+        // A megabyte in flight at most, like a real server behind a socket
+        Stream &stream = m_streams[socket];
+        qint64 end = stream.stall >= 0 ? stream.stall : stream.end;
+        if (m_rate > 0)
+            end = qMin(end, stream.start + stream.timer.elapsed() * m_rate / 1000 + PACE_CHUNK);
+        while (stream.next < end && socket->bytesToWrite() < BLOCK_SIZE) {
+            const qint64 length = qMin<qint64>(PACE_CHUNK, end - stream.next);
+            socket->write(patternAt(stream.next), length);
+            stream.next += length;
+            served += length;
+        }
+
+        // Held back by the cap: come back for more once time has passed
+        if (m_rate > 0 && stream.next < stream.end && stream.stall < 0 && !stream.paced) {
+            stream.paced = true;
+            QTimer::singleShot(10, socket, [this, socket]() {
+                if (m_streams.contains(socket)) {
+                    m_streams[socket].paced = false;
+                    writeBody(socket);
+                }
+            });
+        }
+    }
+
+    qint64 m_size;
+    qint64 m_stallAt;
+    int m_failures;
+    qint64 m_rate;
+    QByteArray m_token;
+    QHash<QTcpSocket*, Stream> m_streams;
+};
+
+class TestDownloadTask : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init();
+    void cleanup();
+    void streamsLargeBodyInBoundedMemory();
+    void startsAgainAfterUnauthorized();
+    void resumesPartFile();
+    void retriesTransientFailure();
+    void rangesBeatOneCappedStream();
+    void resumesSegmentedPartFile();
+
+private:
+    QNetworkRequest request(const StandInServer &server, const QByteArray &token = "Bearer valid") const;
+    bool run(DownloadTask &task, int timeout = 60 * 1000);
+    bool matchesBody(const QString &path, qint64 size) const;
+
+    QTemporaryDir *m_dir;
+    QNetworkAccessManager *m_manager;
+};
+
+void TestDownloadTask::init()
+{
+    m_dir = new QTemporaryDir;
+    QVERIFY(m_dir->isValid());
+    m_manager = new QNetworkAccessManager;
+}
+
+void TestDownloadTask::cleanup()
+{
+    delete m_manager;
+    delete m_dir;
+}
+
+void TestDownloadTask::streamsLargeBodyInBoundedMemory()
+{
+    // Several GB by default; PILVI_TEST_DOWNLOAD_SIZE picks another size
+    qint64 size = qgetenv("PILVI_TEST_DOWNLOAD_SIZE").toLongLong();
+    if (size <= 0)
+        size = Q_INT64_C(3) * 1024 * 1024 * 1024;
+    if (QStorageInfo(m_dir->path()).bytesAvailable() < size + BLOCK_SIZE)
+        QSKIP("Not enough free space for the download");
+
+    const qint64 baseline = residentKb();
+    if (baseline < 0)
+        QSKIP("Resident memory cannot be read on this platform");
+
+    StandInServer server(size);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    const QString path = m_dir->path() + "/large.bin";
+    DownloadTask task(m_manager, request(server), path);
+    qint64 peak = baseline;
+    connect(&task, &DownloadTask::progress, this, [&peak]() {
+        peak = qMax(peak, residentKb());
+    });
+
+    QVERIFY(run(task, 10 * 60 * 1000));
+    QCOMPARE(QFileInfo(path).size(), size);
+    QVERIFY(!QFile::exists(DownloadTask::partPath(path)));
+    QVERIFY(matchesBody(path, size));
+
+    qDebug() << "Resident memory grew by" << (peak - baseline) << "kB for" << size << "bytes";
+    QVERIFY2(peak - baseline < 64 * 1024, "Memory use grows with the size of the file");
+}
+
+void TestDownloadTask::startsAgainAfterUnauthorized()
+{
+    const qint64 size = 4 * 1024 * 1024 + 17;
+    StandInServer server(size);
+    server.setToken("Bearer fresh");
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    const QString path = m_dir->path() + "/small.bin";
+    DownloadTask task(m_manager, request(server, "Bearer stale"), path);
+    QByteArray expired;
+    connect(&task, &DownloadTask::authorizationExpired, this, [&](const QByteArray &authorization) {
+        expired = authorization;
+        QNetworkRequest fresh = task.request();
+        fresh.setRawHeader("Authorization", "Bearer fresh");
+        task.setRequest(fresh);
+        QTimer::singleShot(0, &task, [&task]() { task.start(); });
+    });
+
+    QVERIFY(run(task));
+    QCOMPARE(expired, QByteArray("Bearer stale"));
+    QCOMPARE(server.authorizations, QList<QByteArray>() << "Bearer stale" << "Bearer fresh");
+    QCOMPARE(server.offsets, QList<qint64>() << 0 << 0);
+    QVERIFY(matchesBody(path, size));
+}
+
+void TestDownloadTask::resumesPartFile()
+{
+    const qint64 size = 8 * 1024 * 1024 + 5;
+    StandInServer server(size);
+    server.setStallAt(size / 2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    const QString path = m_dir->path() + "/resumed.bin";
+    DownloadTask task(m_manager, request(server), path);
+    task.setFileId("file");
+    task.setVersion("1");
+
+    // Stop once the server has stalled half way, as a dropped link would
+    {
+        QEventLoop loop;
+        connect(&task, &DownloadTask::progress, &loop, [&loop, size](qint64 received) {
+            if (received >= size / 2)
+                loop.quit();
+        });
+        QTimer::singleShot(60 * 1000, &loop, &QEventLoop::quit);
+        task.start();
+        loop.exec();
+    }
+    task.abort();
+    QVERIFY(QFile::exists(DownloadTask::partPath(path)));
+    QVERIFY(QFile::exists(DownloadTask::progressPath(path)));
+
+    QVERIFY(run(task));
+    QCOMPARE(server.offsets.count(), 2);
+    QVERIFY(server.offsets.last() > 0 && server.offsets.last() <= size / 2);
+    QVERIFY(!QFile::exists(DownloadTask::progressPath(path)));
+    QVERIFY(matchesBody(path, size));
+}
+
+void TestDownloadTask::retriesTransientFailure()
+{
+    const qint64 size = 2 * 1024 * 1024 + 3;
+    StandInServer server(size);
+    server.setFailures(2);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    const QString path = m_dir->path() + "/retried.bin";
+    DownloadTask task(m_manager, request(server), path);
+    QSignalSpy failed(&task, &DownloadTask::failed);
+
+    QVERIFY(run(task));
+    QCOMPARE(failed.count(), 0);
+    QCOMPARE(server.offsets.count(), 3);
+    QVERIFY(matchesBody(path, size));
+}
+
+void TestDownloadTask::rangesBeatOneCappedStream()
+{
+    // Large enough for ranges, with each connection held to 2 MB/s as if
+    // the server throttled them one by one
+    const qint64 size = 16 * 1024 * 1024 + 11;
+    StandInServer server(size);
+    server.setRateLimit(2 * 1024 * 1024);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    QElapsedTimer timer;
+
+    // Without a known size the file comes as one stream
+    const QString streamed = m_dir->path() + "/streamed.bin";
+    DownloadTask single(m_manager, request(server), streamed);
+    timer.start();
+    QVERIFY(run(single));
+    const qint64 streamTime = timer.elapsed();
+    QCOMPARE(server.offsets.count(), 1);
+    QVERIFY(matchesBody(streamed, size));
+
+    NetworkRequest scheduler;
+    scheduler.setLaneLimit(NetworkRequest::Bulk, NetworkRequest::MAX_BULK_CONNECTIONS);
+    const QString ranged = m_dir->path() + "/ranged.bin";
+    DownloadTask parallel(m_manager, request(server), ranged);
+    parallel.setExpectedSize(size);
+    parallel.setScheduler(&scheduler);
+    timer.restart();
+    QVERIFY(run(parallel));
+    const qint64 rangedTime = timer.elapsed();
+    QVERIFY(server.offsets.count() > 2);
+    QVERIFY(matchesBody(ranged, size));
+    QCOMPARE(scheduler.activeCount(NetworkRequest::Bulk), 0);
+
+    qDebug() << "One stream took" << streamTime << "ms," << server.offsets.count() - 1
+             << "ranges took" << rangedTime << "ms";
+    QVERIFY2(rangedTime < streamTime * 3 / 4, "Ranges over several connections are no faster than one stream");
+}
+
+void TestDownloadTask::resumesSegmentedPartFile()
+{
+    const qint64 size = 16 * 1024 * 1024 + 7;
+    StandInServer server(size);
+    server.setRateLimit(4 * 1024 * 1024);
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    NetworkRequest scheduler;
+    scheduler.setLaneLimit(NetworkRequest::Bulk, NetworkRequest::MAX_BULK_CONNECTIONS);
+    const QString path = m_dir->path() + "/segmented.bin";
+    DownloadTask task(m_manager, request(server), path);
+    task.setFileId("file");
+    task.setVersion("1");
+    task.setExpectedSize(size);
+    task.setScheduler(&scheduler);
+
+    // Stop with several ranges part way through
+    {
+        QEventLoop loop;
+        connect(&task, &DownloadTask::progress, &loop, [&loop, size](qint64 received) {
+            if (received >= size / 3)
+                loop.quit();
+        });
+        QTimer::singleShot(60 * 1000, &loop, &QEventLoop::quit);
+        task.start();
+        loop.exec();
+    }
+    task.abort();
+    QVERIFY(QFile::exists(DownloadTask::partPath(path)));
+    QVERIFY(QFile::exists(DownloadTask::progressPath(path)));
+
+    const qint64 servedBefore = server.served;
+    server.setRateLimit(0);
+    QVERIFY(run(task));
+    QVERIFY(!QFile::exists(DownloadTask::progressPath(path)));
+    QVERIFY(matchesBody(path, size));
+
+    // Only the gaps were fetched again
+    qDebug() << "Resuming fetched" << server.served - servedBefore << "of" << size << "bytes";
+    QVERIFY(server.served - servedBefore < size - size / 4);
+}
+
+QNetworkRequest TestDownloadTask::request(const StandInServer &server, const QByteArray &token) const
+{
+    QNetworkRequest request(server.url());
+    request.setRawHeader("Authorization", token);
+    return request;
+}
+
+bool TestDownloadTask::run(DownloadTask &task, int timeout)
+{
+    QEventLoop loop;
+    bool finished = false;
+    connect(&task, &DownloadTask::finished, &loop, [&]() {
+        finished = true;
+        loop.quit();
+    });
+    connect(&task, &DownloadTask::failed, &loop, [&](const QString &error) {
+        qWarning() << "Download failed:" << error;
+        loop.quit();
+    });
+    QTimer::singleShot(timeout, &loop, &QEventLoop::quit);
+    task.start();
+    loop.exec();
+    return finished;
+}
+
+bool TestDownloadTask::matchesBody(const QString &path, qint64 size) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() != size)
+        return false;
+
+    QByteArray block;
+    for (qint64 offset = 0; offset < size; offset += block.size()) {
+        block = file.read(BLOCK_SIZE);
+        if (block.isEmpty() || memcmp(block.constData(), patternAt(offset), block.size()) != 0) {
+            qWarning() << "Content differs in the block at" << offset;
+            return false;
+        }
+    }
+    return true;
+}
+
+QTEST_GUILESS_MAIN(TestDownloadTask)
+
+#include "tst_downloadtask.moc"
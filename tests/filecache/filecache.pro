@@ -0,0 +1,12 @@
+include(../tests.pri)
+
+TARGET = tst_filecache
+
+SOURCES += \
+    tst_filecache.cpp \
+    $$SRC_DIR/storage/filecache.cpp \
+    $$SRC_DIR/storage/searchindex.cpp
+
+HEADERS += \
+    $$SRC_DIR/storage/filecache.h \
+    $$SRC_DIR/storage/searchindex.h
@@ -0,0 +1,116 @@
+#include <QtTest>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QThreadPool>
+#include "storage/filecache.h"
+
+namespace {
+
+QByteArray readAll(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+QString cachedPath(const QString &fileId)
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/content/" + fileId;
+}
+
+// Lets the store workers finish and their results reach the cache
+void settle()
+{
+    QThreadPool::globalInstance()->waitForDone();
+    QTest::qWait(50);
+}
+
+} // namespace
+
+class TestFileCache : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+
+    void storesAndRestoresContent();
+    void clearDropsStoresInFlight();
+
+private:
+    QTemporaryDir *m_dir;
+    FileCache *m_cache;
+};
+
+void TestFileCache::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void TestFileCache::init()
+{
+    m_dir = new QTemporaryDir;
+    QVERIFY(m_dir->isValid());
+    m_cache = new FileCache;
+    m_cache->clear();
+}
+
+void TestFileCache::cleanup()
+{
+    settle();
+    delete m_cache;
+    delete m_dir;
+}
+
+void TestFileCache::storesAndRestoresContent()
+{
+    const QByteArray data(100000, 'x');
+    const QString source = m_dir->path() + "/source";
+    QVERIFY(writeFile(source, data));
+
+    m_cache->storeContent("file", "v1", source);
+    QTRY_COMPARE(m_cache->cacheSize(), qint64(data.size()));
+    QCOMPARE(readAll(cachedPath("file")), data);
+
+    QSignalSpy restored(m_cache, &FileCache::contentRestored);
+    const QString target = m_dir->path() + "/target";
+    QVERIFY(m_cache->restoreContent("file", "v1", target));
+    QTRY_COMPARE(restored.count(), 1);
+    QCOMPARE(restored.at(0).at(1).toBool(), true);
+    QCOMPARE(readAll(target), data);
+
+    // A newer revision on Drive makes the cached one useless
+    QVERIFY(!m_cache->restoreContent("file", "v2", m_dir->path() + "/stale"));
+    QCOMPARE(m_cache->cacheSize(), qint64(0));
+}
+
+void TestFileCache::clearDropsStoresInFlight()
+{
+    const QByteArray data(100000, 'x');
+    const QString source = m_dir->path() + "/source";
+    QVERIFY(writeFile(source, data));
+
+    // The store completes only after clear(), wherever the worker is by then
+    m_cache->storeContent("file", "v1", source);
+    m_cache->clear();
+    settle();
+
+    QCOMPARE(m_cache->cacheSize(), qint64(0));
+    QVERIFY(!QFile::exists(cachedPath("file")));
+    QVERIFY(!m_cache->restoreContent("file", "v1", m_dir->path() + "/target"));
+
+    // The file can be stored again once the dropped store is through
+    m_cache->storeContent("file", "v1", source);
+    QTRY_COMPARE(m_cache->cacheSize(), qint64(data.size()));
+    QCOMPARE(readAll(cachedPath("file")), data);
+}
+
+QTEST_GUILESS_MAIN(TestFileCache)
+#include "tst_filecache.moc"
@@ -0,0 +1,14 @@
+include(../tests.pri)
+
+QT += qml
+
+TARGET = tst_filemodel
+
+SOURCES += \
+    tst_filemodel.cpp \
+    $$SRC_DIR/models/filemodel.cpp \
+    $$SRC_DIR/models/fileitem.cpp
+
+HEADERS += \
+    $$SRC_DIR/models/filemodel.h \
+    $$SRC_DIR/models/fileitem.h
@@ -0,0 +1,251 @@
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "models/filemodel.h"
+#include "testutils.h"
+
+namespace {
+
+const QString FOLDER_ID = "folder";
+
+QJsonObject fileObject(const QString &id, const QString &name, bool isFolder, int number)
+{
+    QJsonObject file;
+    file["id"] = id;
+    file["name"] = name;
+    file["mimeType"] = isFolder ? "application/vnd.google-apps.folder" : "image/jpeg";
+    file["size"] = QString::number(number * 1000);
+    file["modifiedTime"] = "2024-05-01T12:34:56.789Z";
+    file["starred"] = number % 7 == 0;
+    file["iconLink"] = isFolder ? "https://drive-thirdparty.googleusercontent.com/16/type/application/vnd.google-apps.folder"
+                                : "https://drive-thirdparty.googleusercontent.com/16/type/image/jpeg";
+    file["thumbnailLink"] = "https://lh3.googleusercontent.com/drive-storage/thumb" + QString::number(number);
+    file["webViewLink"] = "https://drive.google.com/file/d/" + id + "/view";
+    file["parents"] = QJsonArray() << FOLDER_ID;
+    return file;
+}
+
+// In "folder,name" order: folders for the first tenth, then files
+QJsonArray listing(int count)
+{
+    QJsonArray files;
+    for (int i = 0; i < count; ++i) {
+        const bool isFolder = i < count / 10;
+        const QString name = QString("%1 %2").arg(isFolder ? "Folder" : "File").arg(i, 6, 10, QChar('0'));
+        files.append(fileObject("id" + QString::number(i), name, isFolder, i));
+    }
+    return files;
+}
+
+QJsonObject listedChange(const QJsonObject &file)
+{
+    QJsonObject change;
+    change["fileId"] = file.value("id");
+    change["removed"] = false;
+    change["file"] = file;
+    return change;
+}
+
+QJsonObject removedChange(const QString &id)
+{
+    QJsonObject change;
+    change["fileId"] = id;
+    change["removed"] = true;
+    return change;
+}
+
+} // namespace
+
+class TestFileModel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void applyChangesKeepsListingOrder();
+    void applyChangesRePlacesRenamedRows();
+    void setFilesFollowsListing();
+
+    void rowMemory_data() { sizes(); }
+    void rowMemory();
+    void dataLookup_data() { sizes(); }
+    void dataLookup();
+    void relist_data() { sizes(); }
+    void relist();
+    void applyChanges_data() { sizes(); }
+    void applyChanges();
+
+private:
+    void sizes();
+};
+
+void TestFileModel::sizes()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void TestFileModel::applyChangesKeepsListingOrder()
+{
+    FileModel model;
+    model.setFiles(listing(50));
+
+    QJsonObject restarred = fileObject("id6", "File 000006", false, 6);
+    restarred["starred"] = true;
+
+    QJsonArray changes;
+    changes << listedChange(fileObject("new1", "Folder 000002a", true, 1))
+            << listedChange(fileObject("new2", "File 000020a", false, 2))
+            << listedChange(fileObject("new3", "AAA", false, 3))
+            << removedChange("id3")
+            << listedChange(fileObject("new4", "File 000030a", false, 4))
+            << removedChange("new4")
+            << removedChange("id6")
+            << listedChange(restarred);
+    model.applyChanges(changes, FOLDER_ID);
+
+    QCOMPARE(model.count(), 52);
+    QCOMPARE(model.findFileById("new1"), 3);
+    QCOMPARE(model.findFileById("id4"), 4);
+    QCOMPARE(model.findFileById("new3"), 5);
+    QCOMPARE(model.findFileById("id5"), 6);
+    QCOMPARE(model.findFileById("id20"), 21);
+    QCOMPARE(model.findFileById("new2"), 22);
+    QCOMPARE(model.findFileById("id49"), 51);
+    QCOMPARE(model.findFileById("id3"), -1);
+    QCOMPARE(model.findFileById("new4"), -1);
+    QVERIFY(model.data(model.index(model.findFileById("id6")), FileModel::StarredRole).toBool());
+}
+
+void TestFileModel::applyChangesRePlacesRenamedRows()
+{
+    FileModel model;
+    model.setFiles(listing(50));
+
+    QJsonArray changes;
+    changes << listedChange(fileObject("id1", "Folder 000009", true, 1))
+            << listedChange(fileObject("id10", "File 000040a", false, 10))
+            << listedChange(fileObject("id45", "File 000001", false, 45))
+            << listedChange(fileObject("id7", "Folder 000000a", true, 7));
+    model.applyChanges(changes, FOLDER_ID);
+
+    QCOMPARE(model.count(), 50);
+    QCOMPARE(model.findFileById("id0"), 0);
+    QCOMPARE(model.findFileById("id7"), 1);
+    QCOMPARE(model.findFileById("id1"), 5);
+    QCOMPARE(model.findFileById("id45"), 6);
+    QCOMPARE(model.findFileById("id5"), 7);
+    QCOMPARE(model.findFileById("id40"), 40);
+    QCOMPARE(model.findFileById("id10"), 41);
+    QCOMPARE(model.findFileById("id49"), 49);
+    QCOMPARE(model.data(model.index(41), FileModel::NameRole).toString(), QString("File 000040a"));
+}
+
+void TestFileModel::setFilesFollowsListing()
+{
+    FileModel model;
+    model.setFiles(listing(100));
+
+    QJsonArray files = listing(100);
+    files.removeAt(40);
+    files.insert(10, fileObject("moved", "File 000009a", false, 9));
+    files.append(fileObject("last", "Zzz", false, 1));
+    model.setFiles(files);
+
+    QCOMPARE(model.count(), files.count());
+    for (int row = 0; row < files.count(); ++row) {
+        QCOMPARE(model.data(model.index(row), FileModel::IdRole).toString(),
+                 files.at(row).toObject().value("id").toString());
+    }
+}
+
+void TestFileModel::rowMemory()
+{
+    QFETCH(int, count);
+
+    const QJsonArray files = listing(count);
+    const qint64 before = residentKb();
+    if (before < 0)
+        QSKIP("Resident memory cannot be read on this platform");
+
+    FileModel *model = new FileModel;
+    model->setFiles(files);
+    const qint64 after = residentKb();
+    QCOMPARE(model->count(), count);
+
+    qDebug() << "Rows take about" << (after - before) * 1024 / count << "bytes each;"
+             << sizeof(FileRow) << "of that is the row itself";
+    delete model;
+}
+
+void TestFileModel::dataLookup()
+{
+    QFETCH(int, count);
+
+    FileModel model;
+    model.setFiles(listing(count));
+
+    // What a delegate asks for as the list scrolls by
+    QBENCHMARK {
+        for (int row = 0; row < count; ++row) {
+            const QModelIndex index = model.index(row);
+            model.data(index, FileModel::NameRole);
+            model.data(index, FileModel::MimeTypeRole);
+            model.data(index, FileModel::ModifiedTimeRole);
+            model.data(index, FileModel::IsFolderRole);
+            model.data(index, FileModel::ThumbnailUrlRole);
+        }
+    }
+}
+
+void TestFileModel::relist()
+{
+    QFETCH(int, count);
+
+    // A fresh listing after a few renames, one deletion and one new file
+    const QJsonArray original = listing(count);
+    QJsonArray changed = original;
+    for (int i = count / 10; i < count; i += 100) {
+        QJsonObject file = changed.at(i).toObject();
+        file["starred"] = !file.value("starred").toBool();
+        changed.replace(i, file);
+    }
+    changed.removeAt(count / 2);
+    changed.insert(count / 3, fileObject("new", "File " + QString::number(count / 3 - 1).rightJustified(6, '0') + "a",
+                                         false, 1));
+
+    FileModel model;
+    model.setFiles(original);
+    bool flip = false;
+    QBENCHMARK {
+        model.setFiles(flip ? original : changed);
+        flip = !flip;
+    }
+    QVERIFY(model.count() == original.count() || model.count() == changed.count());
+}
+
+void TestFileModel::applyChanges()
+{
+    QFETCH(int, count);
+
+    // A thousand files appearing all over the folder, then going away
+    QJsonArray added;
+    QJsonArray removed;
+    for (int i = count / 10; i < count; i += (count - count / 10) / 1000) {
+        const QString id = "new" + QString::number(i);
+        added.append(listedChange(fileObject(id, "File " + QString::number(i).rightJustified(6, '0') + "a", false, i)));
+        removed.append(removedChange(id));
+    }
+
+    FileModel model;
+    model.setFiles(listing(count));
+    QBENCHMARK {
+        model.applyChanges(added, FOLDER_ID);
+        model.applyChanges(removed, FOLDER_ID);
+    }
+    QCOMPARE(model.count(), count);
+}
+
+QTEST_GUILESS_MAIN(TestFileModel)
+
+#include "tst_filemodel.moc"
@@ -0,0 +1,42 @@
+include(../tests.pri)
+
+QT += gui qml
+
+TARGET = tst_googledriveapi
+
+DEFINES += PILVI_CLIENT_ID=\\\"\\\" PILVI_CLIENT_SECRET=\\\"\\\"
+
+SOURCES += \
+    tst_googledriveapi.cpp \
+    $$SRC_DIR/googledrive/foldertransfer.cpp \
+    $$SRC_DIR/googledrive/googledriveapi.cpp \
+    $$SRC_DIR/googledrive/oauthflow.cpp \
+    $$SRC_DIR/models/filemodel.cpp \
+    $$SRC_DIR/models/fileitem.cpp \
+    $$SRC_DIR/network/batchrequest.cpp \
+    $$SRC_DIR/network/downloadtask.cpp \
+    $$SRC_DIR/network/networkrequest.cpp \
+    $$SRC_DIR/network/retrypolicy.cpp \
+    $$SRC_DIR/network/transfermanager.cpp \
+    $$SRC_DIR/network/uploadtask.cpp \
+    $$SRC_DIR/storage/checksumengine.cpp \
+    $$SRC_DIR/storage/credentialstore.cpp \
+    $$SRC_DIR/storage/filecache.cpp \
+    $$SRC_DIR/storage/searchindex.cpp
+
+HEADERS += \
+    $$SRC_DIR/googledrive/foldertransfer.h \
+    $$SRC_DIR/googledrive/googledriveapi.h \
+    $$SRC_DIR/googledrive/oauthflow.h \
+    $$SRC_DIR/models/filemodel.h \
+    $$SRC_DIR/models/fileitem.h \
+    $$SRC_DIR/network/batchrequest.h \
+    $$SRC_DIR/network/downloadtask.h \
+    $$SRC_DIR/network/networkrequest.h \
+    $$SRC_DIR/network/retrypolicy.h \
+    $$SRC_DIR/network/transfermanager.h \
+    $$SRC_DIR/network/uploadtask.h \
+    $$SRC_DIR/storage/checksumengine.h \
+    $$SRC_DIR/storage/credentialstore.h \
+    $$SRC_DIR/storage/filecache.h \
+    $$SRC_DIR/storage/searchindex.h
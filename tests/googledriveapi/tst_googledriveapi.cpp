@@ -0,0 +1,661 @@
+#include <QtTest>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QUrlQuery>
+#include <functional>
+#include "googledrive/googledriveapi.h"
+
+namespace {
+
+const int PAGES = 3;
+const int PAGE_SIZE = 4;
+const QByteArray BATCH_BOUNDARY = "batch_stand-in";
+const QString FOLDER_MIME_TYPE = "application/vnd.google-apps.folder";
+
+QJsonObject fileObject(int number)
+{
+    QJsonObject file;
+    file["id"] = QString("file%1").arg(number);
+    file["name"] = QString("File %1").arg(number, 4, 10, QChar('0'));
+    file["mimeType"] = "text/plain";
+    return file;
+}
+
+QJsonArray fullListing()
+{
+    QJsonArray files;
+    for (int i = 0; i < PAGES * PAGE_SIZE; ++i) {
+        files.append(fileObject(i));
+    }
+    return files;
+}
+
+// One call inside a batch request
+struct BatchCall {
+    int index;
+    QByteArray method;
+    QString path;
+};
+
+QList<BatchCall> batchCalls(const QByteArray &body)
+{
+    QList<BatchCall> calls;
+    int index = -1;
+    for (const QByteArray &line : body.split('\n')) {
+        const QByteArray trimmed = line.trimmed();
+        if (trimmed.startsWith("Content-ID: <item-")) {
+            index = trimmed.mid(18, trimmed.indexOf('>') - 18).toInt();
+        } else if (index >= 0 && trimmed.endsWith(" HTTP/1.1")) {
+            const QList<QByteArray> requestLine = trimmed.split(' ');
+            BatchCall call;
+            call.index = index;
+            call.method = requestLine.value(0);
+            call.path = QUrl(QString::fromLatin1(requestLine.value(1))).path();
+            calls.append(call);
+            index = -1;
+        }
+    }
+    return calls;
+}
+
+QByteArray batchPart(int index, int status, const QByteArray &body = QByteArray())
+{
+    QByteArray part = "--" + BATCH_BOUNDARY + "\r\n"
+            "Content-Type: application/http\r\n"
+            "Content-ID: <response-item-" + QByteArray::number(index) + ">\r\n"
+            "\r\n"
+            "HTTP/1.1 " + QByteArray::number(status) + " Stand-in\r\n";
+    if (!body.isEmpty()) {
+        part += "Content-Type: application/json; charset=UTF-8\r\n"
+                "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    }
+    part += "\r\n" + body + "\r\n";
+    return part;
+}
+
+// What Drive answers to the deletes and PATCHes the tests send
+QByteArray callResult(const QString &path)
+{
+    QJsonObject file;
+    file["id"] = path.section('/', -1);
+    file["name"] = "Renamed";
+    return QJsonDocument(file).toJson(QJsonDocument::Compact);
+}
+
+QByteArray batchAnswer(const BatchCall &call)
+{
+    return call.method == "DELETE" ? batchPart(call.index, 204) : batchPart(call.index, 200, callResult(call.path));
+}
+
+// A listing entry; md5Checksum is filled in for content
+QJsonObject driveFile(const QString &id, const QString &name, const QString &mimeType,
+                      const QByteArray &content = QByteArray())
+{
+    QJsonObject file;
+    file["id"] = id;
+    file["name"] = name;
+    file["mimeType"] = mimeType;
+    if (!content.isNull())
+        file["md5Checksum"] = QString::fromLatin1(QCryptographicHash::hash(content, QCryptographicHash::Md5).toHex());
+    return file;
+}
+
+QByteArray listingBody(const QJsonArray &files)
+{
+    QJsonObject listing;
+    listing["files"] = files;
+    return QJsonDocument(listing).toJson(QJsonDocument::Compact);
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+QByteArray readAll(const QString &path)
+{
+    QFile file(path);
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+}
+
+} // namespace
+
+// Local stand-in for the Drive API. Reads every request on a kept-alive
+// connection and answers with whatever respond gives back.
+class StandInDrive : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    struct Request {
+        QByteArray method;
+        QString path;
+        QUrlQuery query;
+        QHash<QByteArray, QByteArray> headers;  // by lower-case name
+        QByteArray body;
+    };
+
+    struct Response {
+        Response(int status = 200, const QByteArray &body = QByteArray(),
+                 const QByteArray &contentType = "application/json; charset=UTF-8")
+            : status(status), body(body), contentType(contentType) {}
+
+        int status;
+        QByteArray body;
+        QByteArray contentType;
+    };
+
+    explicit StandInDrive(QObject *parent = nullptr)
+        : QTcpServer(parent)
+    {
+    }
+
+    QString url() const { return QString("http://127.0.0.1:%1").arg(serverPort()); }
+
+    std::function<Response(const Request &)> respond;
+
+    // Of every request, in order
+    QList<Request> requests;
+
+protected:
+    void incomingConnection(qintptr descriptor) override
+    {
+        QTcpSocket *socket = new QTcpSocket(this);
+        socket->setSocketDescriptor(descriptor);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { readRequests(socket); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+            m_buffers.remove(socket);
+            socket->deleteLater();
+        });
+    }
+
+private:
+    void readRequests(QTcpSocket *socket)
+    {
+        QByteArray &buffer = m_buffers[socket];
+        buffer += socket->readAll();
+
+        forever {
+            const int headerEnd = buffer.indexOf("\r\n\r\n");
+            if (headerEnd < 0)
+                return;
+
+            Request request;
+            const QList<QByteArray> lines = buffer.left(headerEnd).split('\n');
+            const QList<QByteArray> requestLine = lines.first().trimmed().split(' ');
+            const QUrl target(QString::fromLatin1(requestLine.value(1)));
+            request.method = requestLine.value(0);
+            request.path = target.path();
+            request.query = QUrlQuery(target);
+            for (int i = 1; i < lines.count(); ++i) {
+                const int colon = lines.at(i).indexOf(':');
+                request.headers.insert(lines.at(i).left(colon).trimmed().toLower(), lines.at(i).mid(colon + 1).trimmed());
+            }
+
+            const int length = request.headers.value("content-length").toInt();
+            if (buffer.size() < headerEnd + 4 + length)
+                return;
+            request.body = buffer.mid(headerEnd + 4, length);
+            buffer.remove(0, headerEnd + 4 + length);
+            requests.append(request);
+
+            const Response response = respond ? respond(request) : Response(404);
+            socket->write("HTTP/1.1 " + QByteArray::number(response.status) + " Stand-in\r\n"
+                          "Content-Type: " + response.contentType + "\r\n"
+                          "Content-Length: " + QByteArray::number(response.body.size()) + "\r\n\r\n"
+                          + response.body);
+        }
+    }
+
+    QHash<QTcpSocket*, QByteArray> m_buffers;
+};
+
+class TestGoogleDriveApi : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void init();
+    void cleanup();
+    void sharesListingFromFirstPage();
+    void listingJoinedMidwayIsComplete();
+    void matchesBatchPartsToCalls();
+    void retriesUnansweredBatchCalls();
+    void replaysBatchCallsRejectedWithStaleToken();
+    void failsBatchCallsRejectedWithoutRefreshToken();
+    void skipsUploadsAlreadyInFolder();
+    void downloadsFolderTree();
+    void uploadsOnlyMissingFolders();
+    void searchesCacheBeforeServer();
+
+private:
+    void sendBatch();
+    static StandInDrive::Response listingPage(const StandInDrive::Request &request);
+    static StandInDrive::Response batchResponse(const QByteArray &parts);
+    static StandInDrive::Response singleResponse(const StandInDrive::Request &request);
+    static QString listedFolder(const StandInDrive::Request &request);
+    int listingRequests() const;
+
+    StandInDrive *m_server;
+    CredentialStore *m_credentials;
+    FileCache *m_cache;
+    GoogleDriveApi *m_api;
+};
+
+void TestGoogleDriveApi::initTestCase()
+{
+    // Keeps the cache and the stored token out of the user's own
+    QStandardPaths::setTestModeEnabled(true);
+}
+
+void TestGoogleDriveApi::init()
+{
+    m_server = new StandInDrive;
+    QVERIFY(m_server->listen(QHostAddress::LocalHost));
+
+    m_credentials = new CredentialStore;
+    m_credentials->saveCredentials("valid", "refresh", 3600);
+    m_cache = new FileCache;
+    m_cache->clear();
+
+    m_api = new GoogleDriveApi(m_credentials, m_cache);
+    m_api->setApiUrl(m_server->url());
+    m_api->setBatchUrl(m_server->url() + "/batch");
+    m_api->setFreshnessWindow(0);
+}
+
+void TestGoogleDriveApi::cleanup()
+{
+    delete m_api;
+    delete m_cache;
+    m_credentials->clearCredentials();
+    delete m_credentials;
+    delete m_server;
+}
+
+void TestGoogleDriveApi::sharesListingFromFirstPage()
+{
+    m_server->respond = &TestGoogleDriveApi::listingPage;
+    QSignalSpy listed(m_api, &GoogleDriveApi::filesListed);
+
+    const int first = m_api->listFiles("folder");
+    const int second = m_api->listFiles("folder");
+
+    QTRY_COMPARE(listed.count(), 2);
+    for (const QList<QVariant> &arguments : listed) {
+        QVERIFY(arguments.at(0).toInt() == first || arguments.at(0).toInt() == second);
+        QCOMPARE(arguments.at(1).toJsonArray(), fullListing());
+    }
+    QCOMPARE(listingRequests(), PAGES);
+}
+
+void TestGoogleDriveApi::listingJoinedMidwayIsComplete()
+{
+    m_server->respond = &TestGoogleDriveApi::listingPage;
+    QSignalSpy listed(m_api, &GoogleDriveApi::filesListed);
+
+    // The same listing asked for again once the first page is out
+    const int first = m_api->listFiles("folder");
+    int second = 0;
+    QObject context;
+    connect(m_api, &GoogleDriveApi::filesPageListed, &context, [&](int requestId, const QJsonArray &, bool isLastPage) {
+        if (requestId == first && !isLastPage && second == 0)
+            second = m_api->listFiles("folder");
+    });
+
+    QTRY_COMPARE(listed.count(), 2);
+    QVERIFY(second != 0);
+    for (const QList<QVariant> &arguments : listed) {
+        QVERIFY(arguments.at(0).toInt() == first || arguments.at(0).toInt() == second);
+        QCOMPARE(arguments.at(1).toJsonArray(), fullListing());
+    }
+    QCOMPARE(listingRequests(), 2 * PAGES);
+}
+
+void TestGoogleDriveApi::matchesBatchPartsToCalls()
+{
+    m_server->respond = [](const StandInDrive::Request &request) -> StandInDrive::Response {
+        // Back to front; the Content-ID tells which call a part answers
+        const QList<BatchCall> calls = batchCalls(request.body);
+        QByteArray parts;
+        for (int i = calls.count() - 1; i >= 0; --i) {
+            parts += batchAnswer(calls.at(i));
+        }
+        return batchResponse(parts);
+    };
+    QSignalSpy deleted(m_api, &GoogleDriveApi::fileDeleted);
+    QSignalSpy renamed(m_api, &GoogleDriveApi::fileRenamed);
+    QSignalSpy starred(m_api, &GoogleDriveApi::fileStarred);
+
+    m_api->beginBatch();
+    const int deleteId = m_api->deleteFile("a");
+    const int renameId = m_api->renameFile("b", "Renamed");
+    const int starId = m_api->starFile("c", true);
+    m_api->commitBatch();
+
+    QTRY_COMPARE(deleted.count() + renamed.count() + starred.count(), 3);
+    QCOMPARE(deleted.count(), 1);
+    QCOMPARE(deleted.at(0).at(0).toInt(), deleteId);
+    QCOMPARE(deleted.at(0).at(1).toString(), QString("a"));
+    QCOMPARE(renamed.count(), 1);
+    QCOMPARE(renamed.at(0).at(0).toInt(), renameId);
+    QCOMPARE(renamed.at(0).at(1).toJsonObject().value("id").toString(), QString("b"));
+    QCOMPARE(starred.count(), 1);
+    QCOMPARE(starred.at(0).at(0).toInt(), starId);
+    QCOMPARE(starred.at(0).at(1).toString(), QString("c"));
+    QVERIFY(starred.at(0).at(2).toBool());
+
+    QCOMPARE(m_server->requests.count(), 1);
+    QCOMPARE(m_server->requests.first().path, QString("/batch"));
+    QCOMPARE(batchCalls(m_server->requests.first().body).count(), 3);
+}
+
+void TestGoogleDriveApi::retriesUnansweredBatchCalls()
+{
+    // The rename goes unanswered in the batch and is sent again alone
+    m_server->respond = [](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.path != "/batch")
+            return singleResponse(request);
+        QByteArray parts;
+        for (const BatchCall &call : batchCalls(request.body)) {
+            if (call.method == "DELETE")
+                parts += batchAnswer(call);
+        }
+        return batchResponse(parts);
+    };
+    QSignalSpy deleted(m_api, &GoogleDriveApi::fileDeleted);
+    QSignalSpy renamed(m_api, &GoogleDriveApi::fileRenamed);
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    sendBatch();
+
+    QTRY_COMPARE_WITH_TIMEOUT(renamed.count(), 1, 10000);
+    QCOMPARE(deleted.count(), 1);
+    QCOMPARE(failed.count(), 0);
+    QCOMPARE(m_server->requests.count(), 2);
+    QCOMPARE(m_server->requests.at(1).method, QByteArray("PATCH"));
+    QCOMPARE(m_server->requests.at(1).path, QString("/files/b"));
+}
+
+void TestGoogleDriveApi::replaysBatchCallsRejectedWithStaleToken()
+{
+    // The token changes while the batch is out, so its 401s need no refresh
+    m_server->respond = [this](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.headers.value("authorization") != "Bearer fresh") {
+            m_credentials->updateAccessToken("fresh", 3600);
+            if (request.path != "/batch")
+                return StandInDrive::Response(401);
+            QByteArray parts;
+            for (const BatchCall &call : batchCalls(request.body)) {
+                parts += batchPart(call.index, 401, "{\"error\":{\"code\":401,\"message\":\"Invalid Credentials\"}}");
+            }
+            return batchResponse(parts);
+        }
+        return singleResponse(request);
+    };
+    QSignalSpy deleted(m_api, &GoogleDriveApi::fileDeleted);
+    QSignalSpy renamed(m_api, &GoogleDriveApi::fileRenamed);
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    sendBatch();
+
+    QTRY_COMPARE(deleted.count() + renamed.count(), 2);
+    QCOMPARE(failed.count(), 0);
+    QCOMPARE(m_server->requests.count(), 3);
+    QCOMPARE(m_server->requests.at(0).headers.value("authorization"), QByteArray("Bearer valid"));
+    QCOMPARE(m_server->requests.at(1).headers.value("authorization"), QByteArray("Bearer fresh"));
+    QCOMPARE(m_server->requests.at(2).headers.value("authorization"), QByteArray("Bearer fresh"));
+}
+
+void TestGoogleDriveApi::failsBatchCallsRejectedWithoutRefreshToken()
+{
+    m_credentials->saveCredentials("valid", QString(), 3600);
+    m_server->respond = [](const StandInDrive::Request &request) -> StandInDrive::Response {
+        QByteArray parts;
+        for (const BatchCall &call : batchCalls(request.body)) {
+            parts += batchPart(call.index, 401, "{\"error\":{\"code\":401,\"message\":\"Invalid Credentials\"}}");
+        }
+        return batchResponse(parts);
+    };
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    sendBatch();
+
+    QTRY_COMPARE(failed.count(), 2);
+    QCOMPARE(failed.at(0).at(1).toString(), QString("Invalid Credentials"));
+    QCOMPARE(m_server->requests.count(), 1);
+}
+
+void TestGoogleDriveApi::skipsUploadsAlreadyInFolder()
+{
+    const QByteArray photo = "the same bytes as in Drive";
+    QTemporaryDir dir;
+    QVERIFY(writeFile(dir.path() + "/photo.jpg", photo));
+    QVERIFY(writeFile(dir.path() + "/copy.jpg", photo));
+
+    // Another photo.jpg with other content is not a duplicate
+    m_server->respond = [photo](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.path != "/files")
+            return StandInDrive::Response(404);
+        QJsonArray files;
+        files << driveFile("older", "photo.jpg", "image/jpeg", "older bytes")
+              << driveFile("photo", "photo.jpg", "image/jpeg", photo)
+              << driveFile("copy", "copy.jpg", "image/jpeg", photo);
+        return StandInDrive::Response(200, listingBody(files));
+    };
+    QSignalSpy skipped(m_api, &GoogleDriveApi::uploadSkipped);
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    const int photoId = m_api->uploadFile(dir.path() + "/photo.jpg", "folder");
+    const int copyId = m_api->uploadFile(dir.path() + "/copy.jpg", "folder");
+
+    QTRY_COMPARE(skipped.count(), 2);
+    QHash<int, QString> existing;
+    for (const QList<QVariant> &arguments : skipped) {
+        existing.insert(arguments.at(0).toInt(), arguments.at(1).toJsonObject().value("id").toString());
+    }
+    QCOMPARE(existing.value(photoId), QString("photo"));
+    QCOMPARE(existing.value(copyId), QString("copy"));
+    QCOMPARE(failed.count(), 0);
+
+    // Both checks share one listing, and nothing is sent to the upload endpoint
+    QCOMPARE(m_server->requests.count(), 1);
+    QCOMPARE(listingRequests(), 1);
+    QTRY_VERIFY(!m_api->busy());
+}
+
+void TestGoogleDriveApi::downloadsFolderTree()
+{
+    QHash<QString, QJsonArray> folders;
+    folders["top"] = QJsonArray() << driveFile("sub", "Sub", FOLDER_MIME_TYPE)
+                                  << driveFile("notes", "notes.txt", "text/plain")
+                                  << driveFile("plan", "Plan", "application/vnd.google-apps.document");
+    folders["sub"] = QJsonArray() << driveFile("deep", "deep.txt", "text/plain");
+    m_server->respond = [folders](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.path == "/files")
+            return StandInDrive::Response(200, listingBody(folders.value(listedFolder(request))));
+        if (request.query.queryItemValue("alt") == "media")
+            return StandInDrive::Response(200, "content of " + request.path.section('/', -1).toUtf8(),
+                                          "application/octet-stream");
+        return StandInDrive::Response(404);
+    };
+    QSignalSpy downloaded(m_api, &GoogleDriveApi::folderDownloaded);
+    QSignalSpy progress(m_api, &GoogleDriveApi::folderProgress);
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    QTemporaryDir dir;
+    const QString target = dir.path() + "/copy";
+    const int requestId = m_api->downloadFolder("top", target);
+
+    QTRY_COMPARE(downloaded.count(), 1);
+    QCOMPARE(downloaded.first().at(0).toInt(), requestId);
+    QCOMPARE(failed.count(), 0);
+    QCOMPARE(readAll(target + "/notes.txt"), QByteArray("content of notes"));
+    QCOMPARE(readAll(target + "/Sub/deep.txt"), QByteArray("content of deep"));
+    QCOMPARE(progress.last().at(1).toInt(), 2);
+    QCOMPARE(progress.last().at(2).toInt(), 2);
+
+    // Google Docs have no content to fetch
+    QVERIFY(!QFile::exists(target + "/Plan"));
+    for (const StandInDrive::Request &request : m_server->requests) {
+        QVERIFY(request.path != "/files/plan");
+    }
+}
+
+void TestGoogleDriveApi::uploadsOnlyMissingFolders()
+{
+    QTemporaryDir dir;
+    const QString root = dir.path() + "/tree";
+    QVERIFY(QDir().mkpath(root + "/sub/inner"));
+    QVERIFY(writeFile(root + "/a.txt", "a"));
+    QVERIFY(writeFile(root + "/sub/b.txt", "b"));
+
+    // The tree and its file are in Drive already, the subfolders are not
+    QHash<QString, QJsonArray> folders;
+    folders["parent"] = QJsonArray() << driveFile("tree", "tree", FOLDER_MIME_TYPE);
+    folders["tree"] = QJsonArray() << driveFile("a", "a.txt", "text/plain", "a");
+    folders["created-sub"] = QJsonArray() << driveFile("b", "b.txt", "text/plain", "b");
+    m_server->respond = [folders](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.path != "/files")
+            return StandInDrive::Response(404);
+        if (request.method == "GET")
+            return StandInDrive::Response(200, listingBody(folders.value(listedFolder(request))));
+
+        QJsonObject folder = QJsonDocument::fromJson(request.body).object();
+        folder["id"] = "created-" + folder.value("name").toString();
+        return StandInDrive::Response(200, QJsonDocument(folder).toJson(QJsonDocument::Compact));
+    };
+    QSignalSpy uploaded(m_api, &GoogleDriveApi::folderUploaded);
+    QSignalSpy skipped(m_api, &GoogleDriveApi::uploadSkipped);
+    QSignalSpy failed(m_api, &GoogleDriveApi::requestFailed);
+
+    const int requestId = m_api->uploadFolder(root, "parent");
+
+    QTRY_COMPARE(uploaded.count(), 1);
+    QCOMPARE(uploaded.first().at(0).toInt(), requestId);
+    QCOMPARE(uploaded.first().at(1).toJsonObject().value("id").toString(), QString("tree"));
+    QCOMPARE(skipped.count(), 2);
+    QCOMPARE(failed.count(), 0);
+
+    // Only the missing folders are created, each once its parent exists
+    QList<QJsonObject> created;
+    for (const StandInDrive::Request &request : m_server->requests) {
+        if (request.method == "POST")
+            created.append(QJsonDocument::fromJson(request.body).object());
+    }
+    QCOMPARE(created.count(), 2);
+    QCOMPARE(created.at(0).value("name").toString(), QString("sub"));
+    QCOMPARE(created.at(0).value("parents").toArray(), QJsonArray() << "tree");
+    QCOMPARE(created.at(1).value("name").toString(), QString("inner"));
+    QCOMPARE(created.at(1).value("parents").toArray(), QJsonArray() << "created-sub");
+}
+
+void TestGoogleDriveApi::searchesCacheBeforeServer()
+{
+    m_cache->storeFolderListing("folder", QJsonArray()
+                                << driveFile("summer", QString::fromUtf8("Kesä's photos"), FOLDER_MIME_TYPE)
+                                << driveFile("budget", "Budget.ods", "application/vnd.oasis.opendocument.spreadsheet"));
+
+    // The server knows the cached hit too, and one more
+    m_server->respond = [](const StandInDrive::Request &request) -> StandInDrive::Response {
+        if (request.path != "/files")
+            return StandInDrive::Response(404);
+        QJsonArray files;
+        files << driveFile("summer", QString::fromUtf8("Kesä's photos"), FOLDER_MIME_TYPE)
+              << driveFile("shared", QString::fromUtf8("kesä's shared.jpg"), "image/jpeg");
+        return StandInDrive::Response(200, listingBody(files));
+    };
+    QSignalSpy pages(m_api, &GoogleDriveApi::filesPageListed);
+    QSignalSpy completed(m_api, &GoogleDriveApi::searchCompleted);
+
+    const int requestId = m_api->searchFiles("kesa's", 50);
+
+    QTRY_COMPARE(completed.count(), 1);
+    QCOMPARE(completed.first().at(0).toInt(), requestId);
+    QCOMPARE(completed.first().at(1).toJsonArray(), QJsonArray()
+             << driveFile("summer", QString::fromUtf8("Kesä's photos"), FOLDER_MIME_TYPE)
+             << driveFile("shared", QString::fromUtf8("kesä's shared.jpg"), "image/jpeg"));
+
+    // The cached hit is the first page and is not repeated by the server page
+    QCOMPARE(pages.count(), 2);
+    QCOMPARE(pages.at(0).at(1).toJsonArray().count(), 1);
+    QCOMPARE(pages.at(0).at(1).toJsonArray().first().toObject().value("id").toString(), QString("summer"));
+    QVERIFY(!pages.at(0).at(2).toBool());
+    QCOMPARE(pages.at(1).at(1).toJsonArray().count(), 1);
+    QCOMPARE(pages.at(1).at(1).toJsonArray().first().toObject().value("id").toString(), QString("shared"));
+    QVERIFY(pages.at(1).at(2).toBool());
+
+    // The quote is escaped inside the Drive query string
+    QCOMPARE(m_server->requests.count(), 1);
+    QCOMPARE(m_server->requests.first().query.queryItemValue("q", QUrl::FullyDecoded),
+             QString("name contains 'kesa\\'s' and trashed=false"));
+}
+
+void TestGoogleDriveApi::sendBatch()
+{
+    m_api->beginBatch();
+    m_api->deleteFile("a");
+    m_api->renameFile("b", "Renamed");
+    m_api->commitBatch();
+}
+
+StandInDrive::Response TestGoogleDriveApi::batchResponse(const QByteArray &parts)
+{
+    return StandInDrive::Response(200, parts + "--" + BATCH_BOUNDARY + "--\r\n",
+                                  "multipart/mixed; boundary=" + BATCH_BOUNDARY);
+}
+
+StandInDrive::Response TestGoogleDriveApi::singleResponse(const StandInDrive::Request &request)
+{
+    if (request.method == "DELETE")
+        return StandInDrive::Response(204);
+    return StandInDrive::Response(200, callResult(request.path));
+}
+
+QString TestGoogleDriveApi::listedFolder(const StandInDrive::Request &request)
+{
+    // From "'<id>' in parents and trashed=false"
+    return request.query.queryItemValue("q").section('\'', 1, 1);
+}
+
+StandInDrive::Response TestGoogleDriveApi::listingPage(const StandInDrive::Request &request)
+{
+    if (request.path != "/files")
+        return StandInDrive::Response(404);
+
+    // Page tokens are plain page numbers; the first page has none
+    const int page = request.query.queryItemValue("pageToken").toInt();
+    QJsonArray files;
+    for (int i = 0; i < PAGE_SIZE; ++i) {
+        files.append(fileObject(page * PAGE_SIZE + i));
+    }
+
+    QJsonObject response;
+    response["files"] = files;
+    if (page + 1 < PAGES)
+        response["nextPageToken"] = QString::number(page + 1);
+    return StandInDrive::Response(200, QJsonDocument(response).toJson(QJsonDocument::Compact));
+}
+
+int TestGoogleDriveApi::listingRequests() const
+{
+    int count = 0;
+    for (const StandInDrive::Request &request : m_server->requests) {
+        if (request.path == "/files")
+            ++count;
+    }
+    return count;
+}
+
+QTEST_GUILESS_MAIN(TestGoogleDriveApi)
+
+#include "tst_googledriveapi.moc"
@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_retrypolicy
+
+SOURCES += \
+    tst_retrypolicy.cpp \
+    $$SRC_DIR/network/retrypolicy.cpp
+
+HEADERS += \
+    $$SRC_DIR/network/retrypolicy.h
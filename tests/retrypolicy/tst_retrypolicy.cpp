@@ -0,0 +1,166 @@
+#include <QtTest>
+#include <QDateTime>
+#include <QLocale>
+#include <QSet>
+#include "network/retrypolicy.h"
+
+namespace {
+
+// A finished reply with only a status and headers, nothing on the wire
+class StubReply : public QNetworkReply
+{
+public:
+    explicit StubReply(int status, const QByteArray &retryAfter = QByteArray())
+    {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+        if (!retryAfter.isNull())
+            setRawHeader("Retry-After", retryAfter);
+        if (status >= 400)
+            setError(QNetworkReply::UnknownContentError, QString("HTTP %1").arg(status));
+        open(QIODevice::ReadOnly);
+        setFinished(true);
+    }
+
+    void abort() override {}
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+};
+
+QByteArray httpDate(const QDateTime &time)
+{
+    return QLocale::c().toString(time.toUTC(), "ddd, dd MMM yyyy HH:mm:ss 'GMT'").toLatin1();
+}
+
+} // namespace
+
+class TestRetryPolicy : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void backoffUsesEqualJitter_data();
+    void backoffUsesEqualJitter();
+    void backoffSpreadsRetries();
+    void retryAfterSeconds_data();
+    void retryAfterSeconds();
+    void retryAfterDate();
+    void retryDelayPrefersRetryAfter();
+    void retryDelayStopsAtMaxAttempts();
+    void retryDelaySkipsPermanentErrors();
+};
+
+void TestRetryPolicy::backoffUsesEqualJitter_data()
+{
+    QTest::addColumn<int>("attempt");
+    QTest::addColumn<int>("ceiling");
+    QTest::newRow("first") << 0 << 1000;
+    QTest::newRow("second") << 1 << 2000;
+    QTest::newRow("fifth") << 4 << 16000;
+    QTest::newRow("capped") << 5 << 32000;
+    QTest::newRow("far past the cap") << 40 << 32000;
+}
+
+void TestRetryPolicy::backoffUsesEqualJitter()
+{
+    QFETCH(int, attempt);
+    QFETCH(int, ceiling);
+
+    RetryPolicy policy;
+    for (int i = 0; i < 1000; ++i) {
+        const int delay = policy.backoff(attempt);
+        QVERIFY2(delay >= ceiling / 2 && delay <= ceiling, qPrintable(QString::number(delay)));
+    }
+}
+
+void TestRetryPolicy::backoffSpreadsRetries()
+{
+    // Clients that failed together should not all come back together
+    RetryPolicy policy;
+    QSet<int> delays;
+    for (int i = 0; i < 100; ++i) {
+        delays.insert(policy.backoff(3));
+    }
+    QVERIFY(delays.count() > 50);
+}
+
+void TestRetryPolicy::retryAfterSeconds_data()
+{
+    QTest::addColumn<QByteArray>("header");
+    QTest::addColumn<int>("delay");
+    QTest::newRow("seconds") << QByteArray("7") << 7000;
+    QTest::newRow("padded") << QByteArray(" 3 ") << 3000;
+    QTest::newRow("zero") << QByteArray("0") << 0;
+    QTest::newRow("negative") << QByteArray("-5") << 0;
+    QTest::newRow("capped") << QByteArray("3600") << 64000;
+    QTest::newRow("garbage") << QByteArray("soon") << -1;
+    QTest::newRow("empty") << QByteArray("") << -1;
+    QTest::newRow("missing") << QByteArray() << -1;
+}
+
+void TestRetryPolicy::retryAfterSeconds()
+{
+    QFETCH(QByteArray, header);
+    QFETCH(int, delay);
+
+    StubReply reply(503, header);
+    QCOMPARE(RetryPolicy::retryAfter(&reply), delay);
+}
+
+void TestRetryPolicy::retryAfterDate()
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+
+    StubReply soon(503, httpDate(now.addSecs(10)));
+    const int delay = RetryPolicy::retryAfter(&soon);
+    QVERIFY2(delay > 8000 && delay <= 10000, qPrintable(QString::number(delay)));
+
+    StubReply past(503, httpDate(now.addSecs(-60)));
+    QCOMPARE(RetryPolicy::retryAfter(&past), 0);
+
+    StubReply far(503, httpDate(now.addDays(1)));
+    QCOMPARE(RetryPolicy::retryAfter(&far), 64000);
+}
+
+void TestRetryPolicy::retryDelayPrefersRetryAfter()
+{
+    RetryPolicy policy;
+
+    StubReply told(429, "2");
+    QCOMPARE(policy.retryDelay(&told, 3, false), 2000);
+
+    StubReply untold(503);
+    const int delay = policy.retryDelay(&untold, 1, true);
+    QVERIFY2(delay >= 1000 && delay <= 2000, qPrintable(QString::number(delay)));
+    QCOMPARE(policy.retryCount(), 2);
+}
+
+void TestRetryPolicy::retryDelayStopsAtMaxAttempts()
+{
+    RetryPolicy policy;
+    policy.setMaxAttempts(3);
+
+    StubReply reply(500);
+    QVERIFY(policy.retryDelay(&reply, 1, true) >= 0);
+    QCOMPARE(policy.retryDelay(&reply, 2, true), -1);
+    QCOMPARE(policy.exhaustedCount(), 1);
+}
+
+void TestRetryPolicy::retryDelaySkipsPermanentErrors()
+{
+    RetryPolicy policy;
+
+    StubReply missing(404, "1");
+    QCOMPARE(policy.retryDelay(&missing, 0, true), -1);
+
+    // A 500 may have been acted on, so only idempotent requests go again
+    StubReply failed(500);
+    QCOMPARE(policy.retryDelay(&failed, 0, false), -1);
+    QVERIFY(policy.retryDelay(&failed, 0, true) >= 0);
+
+    QCOMPARE(policy.retryCount(), 1);
+    QCOMPARE(policy.exhaustedCount(), 0);
+}
+
+QTEST_GUILESS_MAIN(TestRetryPolicy)
+#include "tst_retrypolicy.moc"
@@ -0,0 +1,10 @@
+include(../tests.pri)
+
+TARGET = tst_searchindex
+
+SOURCES += \
+    tst_searchindex.cpp \
+    $$SRC_DIR/storage/searchindex.cpp
+
+HEADERS += \
+    $$SRC_DIR/storage/searchindex.h
@@ -0,0 +1,157 @@
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringList>
+#include "storage/searchindex.h"
+
+namespace {
+
+QJsonObject file(const QString &id, const QString &name)
+{
+    QJsonObject file;
+    file["id"] = id;
+    file["name"] = name;
+    return file;
+}
+
+QStringList ids(const QJsonArray &results)
+{
+    QStringList ids;
+    for (const QJsonValue &result : results) {
+        ids << result.toObject().value("id").toString();
+    }
+    return ids;
+}
+
+} // namespace
+
+class TestSearchIndex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void ranksMatches();
+    void foldsCaseAndAccents_data();
+    void foldsCaseAndAccents();
+    void matchesShortQueries();
+    void keepsToLimit();
+    void replacesFolders();
+    void findsMovedFileOnce();
+    void staysRightAcrossCompaction();
+};
+
+void TestSearchIndex::ranksMatches()
+{
+    SearchIndex index;
+    index.setFolder("folder", QJsonArray()
+                    << file("substring", "Misreported")
+                    << file("word", "Old report")
+                    << file("other", "Holiday")
+                    << file("longer prefix", "Report draft two")
+                    << file("prefix", "Report draft")
+                    << file("whole", "REPORT"));
+
+    // Whole name, prefix, word prefix, anywhere; shorter names first
+    QCOMPARE(ids(index.search("report", 10)), QStringList()
+             << "whole" << "prefix" << "longer prefix" << "word" << "substring");
+}
+
+void TestSearchIndex::foldsCaseAndAccents_data()
+{
+    QTest::addColumn<QString>("query");
+    QTest::newRow("plain") << "kesa";
+    QTest::newRow("accented") << QString::fromUtf8("KESÄ");
+    QTest::newRow("extension") << "jpg";
+    QTest::newRow("padded") << "  kesä 20  ";
+}
+
+void TestSearchIndex::foldsCaseAndAccents()
+{
+    QFETCH(QString, query);
+
+    SearchIndex index;
+    index.setFolder("folder", QJsonArray()
+                    << file("summer", QString::fromUtf8("Kesä 2024.JPG"))
+                    << file("winter", "Talvi 2024.png"));
+
+    QCOMPARE(ids(index.search(query, 10)), QStringList() << "summer");
+}
+
+void TestSearchIndex::matchesShortQueries()
+{
+    // Under three characters there is no trigram to look up
+    SearchIndex index;
+    index.setFolder("folder", QJsonArray()
+                    << file("a", "Notes")
+                    << file("b", "Budget")
+                    << file("c", "todo"));
+
+    QCOMPARE(ids(index.search("to", 10)), QStringList() << "c" << "a");
+    QCOMPARE(ids(index.search("x", 10)), QStringList());
+    QCOMPARE(ids(index.search("   ", 10)), QStringList());
+}
+
+void TestSearchIndex::keepsToLimit()
+{
+    QJsonArray files;
+    for (int i = 0; i < 100; ++i) {
+        files << file(QString::number(i), QString("Photo %1").arg(i, 3, 10, QChar('0')));
+    }
+    SearchIndex index;
+    index.setFolder("folder", files);
+
+    QCOMPARE(index.search("photo", 5).count(), 5);
+    QCOMPARE(ids(index.search("photo", 2)), QStringList() << "0" << "1");
+    QCOMPARE(index.search("photo", 0).count(), 0);
+}
+
+void TestSearchIndex::replacesFolders()
+{
+    SearchIndex index;
+    index.setFolder("a", QJsonArray() << file("kept", "Kept notes") << file("gone", "Gone notes"));
+    index.setFolder("b", QJsonArray() << file("other", "Other notes"));
+
+    index.setFolder("a", QJsonArray() << file("kept", "Kept notes"));
+    QCOMPARE(ids(index.search("notes", 10)), QStringList() << "kept" << "other");
+
+    index.removeFolder("b");
+    QCOMPARE(ids(index.search("notes", 10)), QStringList() << "kept");
+
+    index.clear();
+    QCOMPARE(ids(index.search("notes", 10)), QStringList());
+}
+
+void TestSearchIndex::findsMovedFileOnce()
+{
+    SearchIndex index;
+    index.setFolder("a", QJsonArray() << file("moved", "Moved notes"));
+    index.setFolder("b", QJsonArray() << file("moved", "Moved notes"));
+    QCOMPARE(ids(index.search("notes", 10)), QStringList() << "moved");
+
+    // It is under b now; dropping a must not take it along
+    index.removeFolder("a");
+    QCOMPARE(ids(index.search("notes", 10)), QStringList() << "moved");
+
+    index.removeFolder("b");
+    QCOMPARE(ids(index.search("notes", 10)), QStringList());
+}
+
+void TestSearchIndex::staysRightAcrossCompaction()
+{
+    // Relisting leaves stale postings behind until they outweigh the live ones
+    SearchIndex index;
+    for (int round = 0; round < 20; ++round) {
+        QJsonArray files;
+        for (int i = 0; i < 50; ++i) {
+            files << file(QString("%1-%2").arg(round).arg(i), QString("Round %1 file %2").arg(round).arg(i));
+        }
+        index.setFolder("folder", files);
+    }
+
+    QCOMPARE(index.search("round 19 file", 100).count(), 50);
+    QCOMPARE(index.search("round 18", 100).count(), 0);
+    QCOMPARE(ids(index.search("round 19 file 7", 10)), QStringList() << "19-7");
+}
+
+QTEST_GUILESS_MAIN(TestSearchIndex)
+#include "tst_searchindex.moc"
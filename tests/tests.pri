@@ -0,0 +1,10 @@
+QT += testlib network concurrent
+QT -= gui
+
+CONFIG += testcase console c++11
+CONFIG -= app_bundle
+
+SRC_DIR = $$PWD/../src
+INCLUDEPATH += $$SRC_DIR $$PWD
+
+HEADERS += $$PWD/testutils.h
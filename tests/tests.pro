@@ -0,0 +1,13 @@
+# Host-side tests, built apart from the Sailfish app:
+#   qmake tests/tests.pro && make check
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    batchrequest \
+    checksumengine \
+    downloadtask \
+    filecache \
+    filemodel \
+    googledriveapi \
+    retrypolicy \
+    searchindex
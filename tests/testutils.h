@@ -0,0 +1,22 @@
+#ifndef TESTUTILS_H
+#define TESTUTILS_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+
+// Resident set of this process in kB, -1 without /proc
+inline qint64 residentKb()
+{
+    QFile status("/proc/self/status");
+    if (!status.open(QIODevice::ReadOnly))
+        return -1;
+
+    for (const QByteArray &line : status.readAll().split('\n')) {
+        if (line.startsWith("VmRSS:"))
+            return line.mid(6).simplified().split(' ').first().toLongLong();
+    }
+    return -1;
+}
+
+#endif // TESTUTILS_H